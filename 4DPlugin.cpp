@@ -12,24 +12,265 @@
 #include "4DPluginAPI.h"
 #include "4DPlugin.h"
 #include "base64.h"
+#include "utf8.h"
 
 #include "pty_session.h"
-
-#include <map>
+#include "pty_event_loop.h"
+#include "pty_pool.h"
+#include "pty_reaper.h"
+#include "pty_registry.h"
+#include "pty_screen.h"
+#include "pty_scrollback.h"
+#include "pty_zygote.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <vector>
 
 #pragma mark - Session Management
 
-static std::map<int, PtySession*> g_sessions;
-static int g_nextId = 1;
+// Only PTY Create and PTY Close modify the registry; other commands just look up
+// their session in its shard and then work under that session's own locks.
+static PtyRegistry g_sessions;
+
+// Pre-spawned shells for PTY Create, disabled until PTY Set pool options
+static PtyPool g_pool([] { return g_sessions.nextId(); });
+
+// Guards g_eventLoop
 static std::mutex g_mutex;
 
-static PtySession* getSession(int sessionId) {
-    auto it = g_sessions.find(sessionId);
-    if (it != g_sessions.end()) {
-        return it->second;
+// Shared I/O thread for sessions created with {reader: "loop"}, started on first use
+static PtyEventLoop* g_eventLoop = nullptr;
+
+// Called with g_mutex held.
+static PtyEventLoop* sharedEventLoop() {
+    if (g_eventLoop == nullptr) {
+        PtyEventLoop* loop = new PtyEventLoop();
+        if (!loop->start()) {
+            delete loop;
+            return nullptr;
+        }
+        g_eventLoop = loop;
+    }
+    return g_eventLoop;
+}
+
+static PtySessionRef getSession(int sessionId) {
+    return g_sessions.find(sessionId);
+}
+
+#pragma mark - Options
+
+static PA_Unistring createKey(const char* key) {
+    PA_Unichar buf[64];
+    size_t i = 0;
+    for (; key[i] != '\0' && i < 63; i++) {
+        buf[i] = (PA_Unichar)key[i];
+    }
+    buf[i] = 0;
+    return PA_CreateUnistring(buf);
+}
+
+static PA_Variable getOption(PA_ObjectRef options, const char* key) {
+    PA_Variable value = PA_CreateVariable(eVK_Undefined);
+    if (options != nullptr) {
+        PA_Unistring keyStr = createKey(key);
+        if (PA_HasObjectProperty(options, &keyStr)) {
+            value = PA_GetObjectProperty(options, &keyStr);
+        }
+        PA_DisposeUnistring(&keyStr);
+    }
+    return value;
+}
+
+static double getOptionNumber(PA_ObjectRef options, const char* key, double defaultValue) {
+    PA_Variable value = getOption(options, key);
+    double result = defaultValue;
+    switch (PA_GetVariableKind(value)) {
+        case eVK_Real:    result = PA_GetRealVariable(value); break;
+        case eVK_Longint: result = PA_GetLongintVariable(value); break;
+        case eVK_Boolean: result = PA_GetBooleanVariable(value) ? 1 : 0; break;
+        default: break;
+    }
+    PA_ClearVariable(&value);
+    return result;
+}
+
+static void setObjectNumber(PA_ObjectRef obj, const char* key, double number) {
+    PA_Unistring keyStr = createKey(key);
+    PA_Variable value = PA_CreateVariable(eVK_Real);
+    PA_SetRealVariable(&value, number);
+    PA_SetObjectProperty(obj, &keyStr, value);
+    PA_DisposeUnistring(&keyStr);
+    PA_ClearVariable(&value);
+}
+
+// The object (or collection) takes a copy of value, which is cleared.
+static void setObjectVariable(PA_ObjectRef obj, const char* key, PA_Variable& value) {
+    PA_Unistring keyStr = createKey(key);
+    PA_SetObjectProperty(obj, &keyStr, value);
+    PA_DisposeUnistring(&keyStr);
+    PA_ClearVariable(&value);
+}
+
+static void setObjectBoolean(PA_ObjectRef obj, const char* key, bool flag) {
+    PA_Variable value = PA_CreateVariable(eVK_Boolean);
+    PA_SetBooleanVariable(&value, flag ? 1 : 0);
+    setObjectVariable(obj, key, value);
+}
+
+static PA_Variable createTextVariable(const std::string& text) {
+    static thread_local std::vector<PA_Unichar> wide;
+    if (wide.size() < text.size() + 1) {
+        wide.resize(text.size() + 1);
+    }
+    size_t len = utf8_to_utf16((const uint8_t*)text.data(), text.size(), (uint16_t*)wide.data());
+    wide[len] = 0;
+
+    PA_Variable value = PA_CreateVariable(eVK_Unistring);
+    PA_Unistring ustr = PA_CreateUnistring(wide.data());
+    PA_SetStringVariable(&value, &ustr);
+    return value;
+}
+
+// Text as UTF-8; numbers are formatted so that {COLUMNS: 120} works in an environment.
+static bool getVariableText(PA_Variable value, std::string& result) {
+    switch (PA_GetVariableKind(value)) {
+        case eVK_Unistring: {
+            PA_Unistring ustr = PA_GetStringVariable(value);
+            C_TEXT text;
+            text.setUTF16String(&ustr);
+            CUTF8String utf8;
+            text.copyUTF8String(&utf8);
+            result.assign((const char*)utf8.c_str(), utf8.length());
+            return true;
+        }
+        case eVK_Real:
+        case eVK_Longint: {
+            char buf[32];
+            double number = (PA_GetVariableKind(value) == eVK_Real) ? PA_GetRealVariable(value)
+                                                                    : PA_GetLongintVariable(value);
+            snprintf(buf, sizeof(buf), "%.15g", number);
+            result = buf;
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+static std::string getOptionText(PA_ObjectRef options, const char* key) {
+    PA_Variable value = getOption(options, key);
+    std::string result;
+    if (PA_GetVariableKind(value) == eVK_Unistring) {
+        getVariableText(value, result);
+    }
+    PA_ClearVariable(&value);
+    return result;
+}
+
+// Text and number elements of a collection, in order; other elements are skipped.
+static std::vector<std::string> getCollectionTexts(PA_CollectionRef collection) {
+    std::vector<std::string> texts;
+    if (collection == nullptr) return texts;
+
+    PA_long32 count = PA_GetCollectionLength(collection);
+    for (PA_long32 i = 0; i < count; i++) {
+        PA_Variable elem = PA_GetCollectionElement(collection, i);
+        std::string text;
+        if (getVariableText(elem, text)) {
+            texts.push_back(text);
+        }
+        PA_ClearVariable(&elem);
+    }
+    return texts;
+}
+
+// "KEY=VALUE" for each text or number property; null and other values leave the variable unset.
+static std::vector<std::string> getEnvironmentEntries(PA_ObjectRef env) {
+    std::vector<std::string> entries;
+
+    PA_Variable param = PA_CreateVariable(eVK_Object);
+    PA_SetObjectVariable(&param, env);
+    PA_Variable keys = PA_ExecuteCommandByID(1719, &param, 1);     // OB Keys
+
+    if (PA_GetVariableKind(keys) == eVK_Collection) {
+        PA_CollectionRef names = PA_GetCollectionVariable(keys);
+        PA_long32 count = PA_GetCollectionLength(names);
+        for (PA_long32 i = 0; i < count; i++) {
+            PA_Variable name = PA_GetCollectionElement(names, i);
+            std::string key, text;
+            if (getVariableText(name, key) && !key.empty() && key.find('=') == std::string::npos) {
+                PA_Unistring keyStr = PA_GetStringVariable(name);
+                PA_Variable value = PA_GetObjectProperty(env, &keyStr);
+                if (getVariableText(value, text)) {
+                    entries.push_back(key + "=" + text);
+                }
+                PA_ClearVariable(&value);
+            }
+            PA_ClearVariable(&name);
+        }
+    }
+    PA_ClearVariable(&keys);
+    return entries;
+}
+
+// Applies the PTY Create options object to a session that has not been started yet.
+static void applyCreateOptions(PtySession* session, PA_ObjectRef options) {
+    if (options == nullptr) return;
+
+    std::string reader = getOptionText(options, "reader");
+    size_t bufferSize = (size_t)getOptionNumber(options, "bufferSize", PtySession::kDefaultRingSize);
+    if (reader == "thread") {
+        session->setReaderMode(PtySession::kReaderThread, bufferSize);
+    } else if (reader == "loop") {
+        PtyEventLoop* loop = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(g_mutex);
+            loop = sharedEventLoop();
+        }
+        session->setReaderMode(PtySession::kReaderLoop, bufferSize, loop);
+    }
+
+    if (getOptionText(options, "io") == "pipes") {
+        session->setIoMode(PtySession::kIoPipes);
+    }
+
+    if (getOptionNumber(options, "returnOnFirstData", 1) == 0) {
+        session->setReturnOnFirstData(false);
+    }
+
+    int coalesceMs = (int)getOptionNumber(options, "coalesceMs", 0);
+    if (coalesceMs > 0) {
+        session->setCoalescing(coalesceMs, (size_t)getOptionNumber(options, "coalesceBytes", PtySession::kDefaultCoalesceBytes));
+    }
+
+    if (getOptionNumber(options, "stripAnsi", 0) != 0) {
+        session->setStripAnsi(true);
+    }
+
+    if (getOptionNumber(options, "screen", 0) != 0) {
+        session->setScreen(true);
+    }
+
+    double scrollbackMB = getOptionNumber(options, "scrollback", 0);
+    if (scrollbackMB > 0) {
+        session->setScrollback((size_t)(scrollbackMB * 1024 * 1024));
+    }
+
+    if (getOptionNumber(options, "raw", 0) != 0) {
+        session->setRawMode(true, (int)getOptionNumber(options, "vmin", 1), (int)getOptionNumber(options, "vtime", 0));
+    }
+
+    std::string spawn = getOptionText(options, "spawn");
+    if (spawn == "fork") {
+        session->setSpawnMethod(PtySession::kSpawnFork);
+    } else if (spawn == "zygote") {
+        session->setSpawnMethod(PtySession::kSpawnZygote);
     }
-    return nullptr;
 }
 
 #pragma mark - Lifecycle
@@ -38,12 +279,23 @@ static void OnStart() {
 }
 
 static void OnExit() {
+    g_pool.stop();
+
+    // Sessions still referenced by an in-flight command are freed when it returns
+    for (PtySessionRef& session : g_sessions.removeAll()) {
+        session->close();
+    }
+    PtyZygote::shared().stop();
+
+    // Children still in their grace period are killed now rather than left behind
+    PtyReaper::shared().stop();
+
     std::lock_guard<std::mutex> lock(g_mutex);
-    for (auto& pair : g_sessions) {
-        pair.second->close();
-        delete pair.second;
+    if (g_eventLoop != nullptr) {
+        g_eventLoop->stop();
+        delete g_eventLoop;
+        g_eventLoop = nullptr;
     }
-    g_sessions.clear();
 }
 
 #pragma mark - PluginMain
@@ -88,13 +340,43 @@ void PluginMain( PA_long32 selector, PA_PluginParameters params )
 		case 8 :
 			PTY_List_sessions(params);
 			break;
+		case 9 :
+			PTY_Wait_any(params);
+			break;
+		case 10 :
+			PTY_Read_blob(params);
+			break;
+		case 11 :
+			PTY_Read_text(params);
+			break;
+		case 12 :
+			PTY_Set_pool_options(params);
+			break;
+		case 13 :
+			PTY_Get_pool_stats(params);
+			break;
+		case 14 :
+			PTY_Create_ex(params);
+			break;
+		case 15 :
+			PTY_Close_input(params);
+			break;
+		case 16 :
+			PTY_Get_screen(params);
+			break;
+		case 17 :
+			PTY_Get_screen_changes(params);
+			break;
+		case 18 :
+			PTY_Get_scrollback(params);
+			break;
 
 	}
 }
 
 #pragma mark - Commands
 
-// PTY Create(shellPath : Text ; cols : Longint ; rows : Longint) : Longint
+// PTY Create(shellPath : Text ; cols : Longint ; rows : Longint ; cwd : Text ; options : Object) : Longint
 void PTY_Create(PA_PluginParameters params) {
 
     PackagePtr pParams = (PackagePtr)params->fParameters;
@@ -110,6 +392,8 @@ void PTY_Create(PA_PluginParameters params) {
     C_TEXT cwdParam;
     cwdParam.fromParamAtIndex(pParams, 4);
 
+    PA_ObjectRef options = PA_GetObjectParameter(params, 5);
+
     // Convert shell path to UTF-8
     CUTF8String shellPathUTF8;
     shellPathParam.copyUTF8String(&shellPathUTF8);
@@ -128,15 +412,86 @@ void PTY_Create(PA_PluginParameters params) {
 
     C_LONGINT returnValue;
 
-    std::lock_guard<std::mutex> lock(g_mutex);
-    int sessionId = g_nextId++;
-    PtySession* session = new PtySession(sessionId);
+    // Sessions with default options can be taken from the pool: already started,
+    // only the window size is left to set.
+    PtySessionRef session = (options == nullptr) ? g_pool.acquire(shellPath, cwd) : nullptr;
+    if (session != nullptr) {
+        session->resize(cols, rows);
+        g_sessions.insert(session->id(), session);
+        returnValue.setIntValue(session->id());
+        returnValue.setReturn((sLONG_PTR*)params->fResult);
+        return;
+    }
+
+    int sessionId = g_sessions.nextId();
+    session = std::make_shared<PtySession>(sessionId);
+    applyCreateOptions(session.get(), options);
 
     if (session->start(shellPath.c_str(), cols, rows, cwd.empty() ? nullptr : cwd.c_str())) {
-        g_sessions[sessionId] = session;
+        g_sessions.insert(sessionId, session);
+        returnValue.setIntValue(sessionId);
+    } else {
+        returnValue.setIntValue(0);
+    }
+
+    returnValue.setReturn((sLONG_PTR*)params->fResult);
+}
+
+// PTY Create ex(path : Text ; argv : Collection ; env : Object ; cols : Longint ; rows : Longint ; cwd : Text ; options : Object) : Longint
+// Runs path itself rather than a shell: no shell startup, no command line to quote.
+void PTY_Create_ex(PA_PluginParameters params) {
+
+    PackagePtr pParams = (PackagePtr)params->fParameters;
+    C_TEXT pathParam;
+    pathParam.fromParamAtIndex(pParams, 1);
+
+    PA_CollectionRef argvParam = PA_GetCollectionParameter(params, 2);
+    PA_ObjectRef envParam = PA_GetObjectParameter(params, 3);
+
+    C_LONGINT colsParam;
+    colsParam.fromParamAtIndex(pParams, 4);
+
+    C_LONGINT rowsParam;
+    rowsParam.fromParamAtIndex(pParams, 5);
+
+    C_TEXT cwdParam;
+    cwdParam.fromParamAtIndex(pParams, 6);
+
+    PA_ObjectRef options = PA_GetObjectParameter(params, 7);
+
+    CUTF8String pathUTF8;
+    pathParam.copyUTF8String(&pathUTF8);
+    std::string path((const char*)pathUTF8.c_str(), pathUTF8.length());
+
+    CUTF8String cwdUTF8;
+    cwdParam.copyUTF8String(&cwdUTF8);
+    std::string cwd((const char*)cwdUTF8.c_str(), cwdUTF8.length());
+
+    int16_t cols = (int16_t)colsParam.getIntValue();
+    int16_t rows = (int16_t)rowsParam.getIntValue();
+
+    if (cols <= 0) cols = 80;
+    if (rows <= 0) rows = 24;
+
+    // No env object: the same environment as PTY Create
+    std::vector<std::string> argv = getCollectionTexts(argvParam);
+    std::vector<std::string> env;
+    if (envParam != nullptr) {
+        env = getEnvironmentEntries(envParam);
+    }
+
+    C_LONGINT returnValue;
+
+    int sessionId = g_sessions.nextId();
+    PtySessionRef session = std::make_shared<PtySession>(sessionId);
+    applyCreateOptions(session.get(), options);
+
+    if (!path.empty() &&
+        session->startProcess(path.c_str(), argv, envParam != nullptr ? &env : nullptr,
+                              cols, rows, cwd.empty() ? nullptr : cwd.c_str())) {
+        g_sessions.insert(sessionId, session);
         returnValue.setIntValue(sessionId);
     } else {
-        delete session;
         returnValue.setIntValue(0);
     }
 
@@ -151,8 +506,7 @@ void PTY_Write(PA_PluginParameters params) {
 
     C_LONGINT returnValue;
 
-    std::lock_guard<std::mutex> lock(g_mutex);
-    PtySession* session = getSession((int)sessionId);
+    PtySessionRef session = getSession((int)sessionId);
 
     if (session != nullptr && ustr != nullptr) {
         C_TEXT dataParam;
@@ -169,8 +523,11 @@ void PTY_Write(PA_PluginParameters params) {
     returnValue.setReturn((sLONG_PTR*)params->fResult);
 }
 
-// PTY Read(sessionId : Longint ; maxBytes : Longint ; timeoutMs : Longint) : Text
-void PTY_Read(PA_PluginParameters params) {
+// Shared by the PTY Read commands: (sessionId : Longint ; maxBytes : Longint ; timeoutMs : Longint {; stream : Longint})
+// wholeCodePoints selects PtySession::readText, which never splits a UTF-8 sequence.
+// The output is read into a per-thread buffer, valid until the next call on this
+// thread: no allocation, nor zero-filling of maxBytes, per command.
+static size_t readSessionOutput(PA_PluginParameters params, const char** data, bool wholeCodePoints = false) {
 
     C_LONGINT sessionIdParam;
     sessionIdParam.fromParamAtIndex((PackagePtr)params->fParameters, 1);
@@ -181,31 +538,96 @@ void PTY_Read(PA_PluginParameters params) {
     C_LONGINT timeoutMsParam;
     timeoutMsParam.fromParamAtIndex((PackagePtr)params->fParameters, 3);
 
+    // 2 reads stderr of an {io: "pipes"} session; anything else reads the output
+    C_LONGINT streamParam;
+    streamParam.fromParamAtIndex((PackagePtr)params->fParameters, 4);
+    PtySession::Stream stream = (streamParam.getIntValue() == PtySession::kStderr) ? PtySession::kStderr
+                                                                                  : PtySession::kStdout;
+
     int maxBytes = maxBytesParam.getIntValue();
     int timeoutMs = timeoutMsParam.getIntValue();
 
-    if (maxBytes <= 0) maxBytes = 65536;
+    if (maxBytes <= 0 || maxBytes > (int)PtySession::kMaxReadSize) maxBytes = PtySession::kMaxReadSize;
 
-    C_TEXT returnValue;
+    static thread_local std::vector<char> buffer(PtySession::kMaxReadSize + PtySession::kTextExtraMax);
+    *data = buffer.data();
 
-    PtySession* session = nullptr;
-    
-    // Lock only to safely retrieve the session pointer.
-    {
-        std::lock_guard<std::mutex> lock(g_mutex);
-        session = getSession(sessionIdParam.getIntValue());
+    PtySessionRef session = getSession(sessionIdParam.getIntValue());
+
+    if (session == nullptr) {
+        return 0;
     }
 
-    if (session != nullptr) {
-        // Perform the potentially blocking read WITHOUT holding the global plugin lock.
-        std::string data = session->read((size_t)maxBytes, timeoutMs);
-        if (!data.empty()) {
-            // Encode the raw terminal output (which may contain partial UTF-8 sequences
-            // or binary ANSI codes) to Base64 to prevent 4D's UTF-16 layer from corrupting it.
-            std::string encoded = base64_encode(data);
-            returnValue.setUTF8String((const uint8_t*)encoded.c_str(), (uint32_t)encoded.length());
+    // Perform the potentially blocking read WITHOUT holding the global plugin lock.
+    // Our reference keeps the session alive if PTY Close runs meanwhile: close()
+    // wakes this read up through the interrupt pipe.
+    return wholeCodePoints ? session->readText(buffer.data(), (size_t)maxBytes, timeoutMs, stream)
+                           : session->read(buffer.data(), (size_t)maxBytes, timeoutMs, stream);
+}
+
+// PTY Read(sessionId : Longint ; maxBytes : Longint ; timeoutMs : Longint {; stream : Longint}) : Text
+void PTY_Read(PA_PluginParameters params) {
+
+    const char* data;
+    size_t size = readSessionOutput(params, &data);
+
+    if (size > 0) {
+        // Encode the raw terminal output (which may contain partial UTF-8 sequences
+        // or binary ANSI codes) to Base64 to prevent 4D's UTF-16 layer from corrupting it.
+        // Base64 is pure ASCII, so it is written directly as UTF-16 code units
+        // into a per-thread buffer handed to 4D, without any transcoding pass.
+        static thread_local std::vector<PA_Unichar> encoded;
+        size_t needed = base64_encoded_length(size) + 1;
+        if (encoded.size() < needed) {
+            encoded.resize(needed);
         }
+        size_t len = base64_encode_utf16((const uint8_t*)data, size, (uint16_t*)encoded.data());
+        encoded[len] = 0;
+        PA_ReturnString(params, encoded.data());
+        return;
+    }
+
+    C_TEXT returnValue;
+    returnValue.setReturn((sLONG_PTR*)params->fResult);
+}
+
+// PTY Read blob(sessionId : Longint ; maxBytes : Longint ; timeoutMs : Longint {; stream : Longint}) : Blob
+void PTY_Read_blob(PA_PluginParameters params) {
+
+    const char* data;
+    size_t size = readSessionOutput(params, &data);
+
+    // Raw bytes, no Base64: the caller decodes (e.g. Convert to text) or forwards them as-is.
+    PA_ReturnBlob(params, (void*)data, (PA_long32)size);
+}
+
+// PTY Read text(sessionId : Longint ; maxBytes : Longint ; timeoutMs : Longint {; stream : Longint}) : Text
+void PTY_Read_text(PA_PluginParameters params) {
+
+    const char* data;
+    size_t size = readSessionOutput(params, &data, true);
+
+    // Whole code points only, so the output can be transcoded to UTF-16 right away.
+    // A UTF-8 byte never yields more than one UTF-16 code unit.
+    static thread_local std::vector<PA_Unichar> text;
+    if (text.size() < size + 1) {
+        text.resize(size + 1);
     }
+    size_t len = utf8_to_utf16((const uint8_t*)data, size, (uint16_t*)text.data());
+    text[len] = 0;
+    PA_ReturnString(params, text.data());
+}
+
+// PTY Close input(sessionId : Longint) : Longint
+void PTY_Close_input(PA_PluginParameters params) {
+
+    C_LONGINT sessionIdParam;
+    sessionIdParam.fromParamAtIndex((PackagePtr)params->fParameters, 1);
+
+    C_LONGINT returnValue;
+
+    PtySessionRef session = getSession(sessionIdParam.getIntValue());
+    returnValue.setIntValue((session != nullptr && session->closeInput()) ? 1 : 0);
 
     returnValue.setReturn((sLONG_PTR*)params->fResult);
 }
@@ -224,8 +646,7 @@ void PTY_Set_window_size(PA_PluginParameters params) {
 
     C_LONGINT returnValue;
 
-    std::lock_guard<std::mutex> lock(g_mutex);
-    PtySession* session = getSession(sessionIdParam.getIntValue());
+    PtySessionRef session = getSession(sessionIdParam.getIntValue());
 
     if (session != nullptr) {
         bool ok = session->resize((int16_t)colsParam.getIntValue(), (int16_t)rowsParam.getIntValue());
@@ -245,13 +666,11 @@ void PTY_Close(PA_PluginParameters params) {
 
     C_LONGINT returnValue;
 
-    std::lock_guard<std::mutex> lock(g_mutex);
-    PtySession* session = getSession(sessionIdParam.getIntValue());
+    PtySessionRef session = g_sessions.remove(sessionIdParam.getIntValue());
 
     if (session != nullptr) {
+        // Memory and fds go away with the last reference, possibly held by a PTY Read
         session->close();
-        delete session;
-        g_sessions.erase(sessionIdParam.getIntValue());
         returnValue.setIntValue(1);
     } else {
         returnValue.setIntValue(0);
@@ -266,8 +685,7 @@ void PTY_Get_status(PA_PluginParameters params) {
     C_LONGINT sessionIdParam;
     sessionIdParam.fromParamAtIndex((PackagePtr)params->fParameters, 1);
 
-    std::lock_guard<std::mutex> lock(g_mutex);
-    PtySession* session = getSession(sessionIdParam.getIntValue());
+    PtySessionRef session = getSession(sessionIdParam.getIntValue());
 
     if (session != nullptr) {
         session->checkRunning();
@@ -316,8 +734,7 @@ void PTY_Send_signal(PA_PluginParameters params) {
 
     C_LONGINT returnValue;
 
-    std::lock_guard<std::mutex> lock(g_mutex);
-    PtySession* session = getSession(sessionIdParam.getIntValue());
+    PtySessionRef session = getSession(sessionIdParam.getIntValue());
 
     if (session != nullptr) {
         bool ok = session->sendSignal(signalParam.getIntValue());
@@ -332,17 +749,281 @@ void PTY_Send_signal(PA_PluginParameters params) {
 // PTY List sessions : Collection
 void PTY_List_sessions(PA_PluginParameters params) {
 
-    std::lock_guard<std::mutex> lock(g_mutex);
+    PA_CollectionRef col = PA_CreateCollection();
+    PA_long32 index = 0;
+
+    for (int id : g_sessions.ids()) {
+        PA_Variable elem = PA_CreateVariable(eVK_Longint);
+        PA_SetLongintVariable(&elem, (PA_long32)id);
+        PA_SetCollectionElement(col, index++, elem);
+        PA_ClearVariable(&elem);
+    }
+
+    PA_ReturnCollection(params, col);
+}
+
+// PTY Wait any(sessionIds : Collection ; timeoutMs : Longint) : Collection
+void PTY_Wait_any(PA_PluginParameters params) {
+
+    PA_CollectionRef idsParam = PA_GetCollectionParameter(params, 1);
+
+    C_LONGINT timeoutMsParam;
+    timeoutMsParam.fromParamAtIndex((PackagePtr)params->fParameters, 2);
+
+    std::vector<int> ids;
+    if (idsParam != nullptr) {
+        PA_long32 count = PA_GetCollectionLength(idsParam);
+        for (PA_long32 i = 0; i < count; i++) {
+            PA_Variable elem = PA_GetCollectionElement(idsParam, i);
+            switch (PA_GetVariableKind(elem)) {
+                case eVK_Real:    ids.push_back((int)PA_GetRealVariable(elem)); break;
+                case eVK_Longint: ids.push_back((int)PA_GetLongintVariable(elem)); break;
+                default: break;
+            }
+            PA_ClearVariable(&elem);
+        }
+    }
+
+    // Started even if no session uses it yet, so that the call always waits for
+    // timeoutMs when nothing is ready rather than returning at once: a 4D loop
+    // around it must not spin.
+    PtyEventLoop* loop = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        loop = sharedEventLoop();
+    }
+
+    // Block WITHOUT the global plugin lock: one worker can wait on hundreds of sessions.
+    std::vector<int> ready;
+    int timeoutMs = timeoutMsParam.getIntValue();
+    if (loop != nullptr) {
+        loop->waitAny(ids, timeoutMs, ready);
+    } else if (timeoutMs > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+    }
 
     PA_CollectionRef col = PA_CreateCollection();
     PA_long32 index = 0;
 
-    for (auto& pair : g_sessions) {
+    for (int id : ready) {
         PA_Variable elem = PA_CreateVariable(eVK_Longint);
-        PA_SetLongintVariable(&elem, (PA_long32)pair.first);
+        PA_SetLongintVariable(&elem, (PA_long32)id);
         PA_SetCollectionElement(col, index++, elem);
         PA_ClearVariable(&elem);
     }
 
     PA_ReturnCollection(params, col);
 }
+
+// PTY Set pool options(options : Object)
+void PTY_Set_pool_options(PA_PluginParameters params) {
+
+    PA_ObjectRef options = PA_GetObjectParameter(params, 1);
+
+    size_t size = (size_t)getOptionNumber(options, "size", 0);
+    int idleTimeout = (int)getOptionNumber(options, "idleTimeout", PtyPool::kDefaultIdleTimeoutMs);
+    g_pool.configure(size, idleTimeout);
+
+    // prewarm: [{shell: "/bin/zsh"; cwd: "/Users/me"}; ...] starts those shells now
+    // instead of on the first PTY Create that misses.
+    PA_Variable prewarm = getOption(options, "prewarm");
+    if (PA_GetVariableKind(prewarm) == eVK_Collection) {
+        PA_CollectionRef col = PA_GetCollectionVariable(prewarm);
+        PA_long32 count = PA_GetCollectionLength(col);
+        for (PA_long32 i = 0; i < count; i++) {
+            PA_Variable elem = PA_GetCollectionElement(col, i);
+            if (PA_GetVariableKind(elem) == eVK_Object) {
+                PA_ObjectRef key = PA_GetObjectVariable(elem);
+                g_pool.prewarm(getOptionText(key, "shell"), getOptionText(key, "cwd"));
+            }
+            PA_ClearVariable(&elem);
+        }
+    }
+    PA_ClearVariable(&prewarm);
+}
+
+// PTY Get pool stats : Object
+void PTY_Get_pool_stats(PA_PluginParameters params) {
+
+    PtyPool::Stats stats = g_pool.stats();
+
+    PA_ObjectRef obj = PA_CreateObject();
+    setObjectNumber(obj, "size", (double)g_pool.size());
+    setObjectNumber(obj, "hits", (double)stats.hits);
+    setObjectNumber(obj, "misses", (double)stats.misses);
+    setObjectNumber(obj, "spawned", (double)stats.spawned);
+    setObjectNumber(obj, "evicted", (double)stats.evicted);
+    setObjectNumber(obj, "failures", (double)stats.failures);
+    setObjectNumber(obj, "idle", (double)stats.idle);
+    setObjectNumber(obj, "keys", (double)stats.keys);
+    setObjectNumber(obj, "failedKeys", (double)stats.failedKeys);
+
+    PA_ReturnObject(params, obj);
+}
+
+// What PTY Get screen and PTY Get screen changes return, copied under the screen lock so
+// that the 4D objects are built after releasing it.
+struct ScreenCopy {
+    uint64_t generation = 0;
+    int cols = 0, rows = 0, cursorColumn = 0, cursorRow = 0;
+    bool cursorVisible = false, alternate = false;
+    std::vector<int> changedRows;
+    std::vector<std::string> lines;     // the text of changedRows
+};
+
+// Rows changed since sinceGeneration: all of them for 0
+static bool copyScreen(PA_PluginParameters params, uint64_t sinceGeneration, ScreenCopy& copy) {
+
+    C_LONGINT sessionIdParam;
+    sessionIdParam.fromParamAtIndex((PackagePtr)params->fParameters, 1);
+
+    PtySessionRef session = getSession(sessionIdParam.getIntValue());
+
+    if (session == nullptr) {
+        return false;
+    }
+
+    return session->withScreen([&](const PtyScreen& screen) {
+        copy.generation = screen.generation();
+        copy.cols = screen.cols();
+        copy.rows = screen.rows();
+        copy.cursorColumn = screen.cursorX();
+        copy.cursorRow = screen.cursorY();
+        copy.cursorVisible = screen.cursorVisible();
+        copy.alternate = screen.alternateScreen();
+        for (int y = 0; y < copy.rows; y++) {
+            if (screen.rowChanged(y, sinceGeneration)) {
+                copy.changedRows.push_back(y);
+                copy.lines.push_back(screen.rowText(y));
+            }
+        }
+    });
+}
+
+static PA_ObjectRef createScreenObject(const ScreenCopy& copy) {
+    PA_ObjectRef obj = PA_CreateObject();
+    setObjectNumber(obj, "generation", (double)copy.generation);
+    setObjectNumber(obj, "columns", copy.cols);
+    setObjectNumber(obj, "rows", copy.rows);
+    setObjectNumber(obj, "cursorColumn", copy.cursorColumn);
+    setObjectNumber(obj, "cursorRow", copy.cursorRow);
+    setObjectBoolean(obj, "cursorVisible", copy.cursorVisible);
+    setObjectBoolean(obj, "alternateScreen", copy.alternate);
+    return obj;
+}
+
+// PTY Get screen(sessionId : Longint) : Object
+void PTY_Get_screen(PA_PluginParameters params) {
+
+    ScreenCopy copy;
+    if (!copyScreen(params, 0, copy)) {
+        return;
+    }
+
+    PA_ObjectRef obj = createScreenObject(copy);
+
+    PA_CollectionRef col = PA_CreateCollection();
+    for (size_t i = 0; i < copy.lines.size(); i++) {
+        PA_Variable line = createTextVariable(copy.lines[i]);
+        PA_SetCollectionElement(col, (PA_long32)i, line);
+        PA_ClearVariable(&line);
+    }
+    PA_Variable linesVar = PA_CreateVariable(eVK_Collection);
+    PA_SetCollectionVariable(&linesVar, col);
+    setObjectVariable(obj, "lines", linesVar);
+
+    PA_ReturnObject(params, obj);
+}
+
+// PTY Get screen changes(sessionId : Longint ; sinceGeneration : Real) : Object
+void PTY_Get_screen_changes(PA_PluginParameters params) {
+
+    double since = PA_GetDoubleParameter(params, 2);
+
+    ScreenCopy copy;
+    if (!copyScreen(params, since > 0 ? (uint64_t)since : 0, copy)) {
+        return;
+    }
+
+    PA_ObjectRef obj = createScreenObject(copy);
+
+    PA_CollectionRef col = PA_CreateCollection();
+    for (size_t i = 0; i < copy.lines.size(); i++) {
+        PA_ObjectRef change = PA_CreateObject();
+        setObjectNumber(change, "row", copy.changedRows[i]);
+        PA_Variable text = createTextVariable(copy.lines[i]);
+        setObjectVariable(change, "text", text);
+
+        PA_Variable elem = PA_CreateVariable(eVK_Object);
+        PA_SetObjectVariable(&elem, change);
+        PA_SetCollectionElement(col, (PA_long32)i, elem);
+        PA_ClearVariable(&elem);
+    }
+    PA_Variable changesVar = PA_CreateVariable(eVK_Collection);
+    PA_SetCollectionVariable(&changesVar, col);
+    setObjectVariable(obj, "changes", changesVar);
+
+    PA_ReturnObject(params, obj);
+}
+
+// PTY Get scrollback(sessionId : Longint ; fromLine : Real ; count : Longint) : Object
+void PTY_Get_scrollback(PA_PluginParameters params) {
+
+    C_LONGINT sessionIdParam;
+    sessionIdParam.fromParamAtIndex((PackagePtr)params->fParameters, 1);
+    double fromLine = PA_GetDoubleParameter(params, 2);
+    C_LONGINT countParam;
+    countParam.fromParamAtIndex((PackagePtr)params->fParameters, 3);
+
+    PtySessionRef session = getSession(sessionIdParam.getIntValue());
+
+    if (session == nullptr) {
+        return;
+    }
+
+    // Copy under the scrollback lock, build the 4D object after releasing it
+    uint64_t firstLine = 0, lineCount = 0, from = 0;
+    size_t memory = 0;
+    std::vector<std::string> lines;
+
+    bool hasScrollback = session->withScrollback([&](PtyScrollback& scrollback) {
+        firstLine = scrollback.firstLine();
+        lineCount = scrollback.lineCount();
+        memory = scrollback.memoryUsage();
+
+        // Negative: from the end
+        double start = (fromLine < 0) ? (double)lineCount + fromLine : fromLine;
+        from = std::max(firstLine, (uint64_t)std::max(start, 0.0));
+        uint64_t end = std::min(lineCount, from + (uint64_t)std::max(countParam.getIntValue(), 0));
+
+        for (uint64_t n = from; n < end; n++) {
+            lines.emplace_back();
+            if (!scrollback.line(n, lines.back())) {
+                lines.pop_back();
+                break;
+            }
+        }
+    });
+
+    if (!hasScrollback) {
+        return;
+    }
+
+    PA_ObjectRef obj = PA_CreateObject();
+    setObjectNumber(obj, "firstLine", (double)firstLine);
+    setObjectNumber(obj, "lineCount", (double)lineCount);
+    setObjectNumber(obj, "memory", (double)memory);
+    setObjectNumber(obj, "from", (double)from);
+
+    PA_CollectionRef col = PA_CreateCollection();
+    for (size_t i = 0; i < lines.size(); i++) {
+        PA_Variable line = createTextVariable(lines[i]);
+        PA_SetCollectionElement(col, (PA_long32)i, line);
+        PA_ClearVariable(&line);
+    }
+    PA_Variable linesVar = PA_CreateVariable(eVK_Collection);
+    PA_SetCollectionVariable(&linesVar, col);
+    setObjectVariable(obj, "lines", linesVar);
+
+    PA_ReturnObject(params, obj);
+}
@@ -28,3 +28,13 @@ void PTY_Close(PA_PluginParameters params);
 void PTY_Get_status(PA_PluginParameters params);
 void PTY_Send_signal(PA_PluginParameters params);
 void PTY_List_sessions(PA_PluginParameters params);
+void PTY_Wait_any(PA_PluginParameters params);
+void PTY_Read_blob(PA_PluginParameters params);
+void PTY_Read_text(PA_PluginParameters params);
+void PTY_Set_pool_options(PA_PluginParameters params);
+void PTY_Get_pool_stats(PA_PluginParameters params);
+void PTY_Create_ex(PA_PluginParameters params);
+void PTY_Close_input(PA_PluginParameters params);
+void PTY_Get_screen(PA_PluginParameters params);
+void PTY_Get_screen_changes(PA_PluginParameters params);
+void PTY_Get_scrollback(PA_PluginParameters params);
@@ -1,20 +1,268 @@
 #include "base64.h"
 
-static const std::string b = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BASE64_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define BASE64_NEON 1
+#endif
+
+static const char b[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+#pragma mark - Scalar
+
+// Every encoder is written once for 8-bit output (char) and once for UTF-16 code
+// units (uint16_t): base64 is pure ASCII, so 4D text can be produced directly.
+
+template <typename Char>
+static size_t encode_scalar(const uint8_t *in, size_t len, Char *out) {
+    Char *o = out;
+    size_t i = 0;
+
+    for (; i + 3 <= len; i += 3) {
+        uint32_t v = ((uint32_t)in[i] << 16) | ((uint32_t)in[i + 1] << 8) | in[i + 2];
+        o[0] = b[(v >> 18) & 0x3F];
+        o[1] = b[(v >> 12) & 0x3F];
+        o[2] = b[(v >> 6) & 0x3F];
+        o[3] = b[v & 0x3F];
+        o += 4;
+    }
+
+    size_t rest = len - i;
+    if (rest == 1) {
+        uint32_t v = (uint32_t)in[i] << 16;
+        o[0] = b[(v >> 18) & 0x3F];
+        o[1] = b[(v >> 12) & 0x3F];
+        o[2] = '=';
+        o[3] = '=';
+        o += 4;
+    } else if (rest == 2) {
+        uint32_t v = ((uint32_t)in[i] << 16) | ((uint32_t)in[i + 1] << 8);
+        o[0] = b[(v >> 18) & 0x3F];
+        o[1] = b[(v >> 12) & 0x3F];
+        o[2] = b[(v >> 6) & 0x3F];
+        o[3] = '=';
+        o += 4;
+    }
+
+    return (size_t)(o - out);
+}
+
+size_t base64_encode_scalar(const uint8_t *in, size_t len, char *out) {
+    return encode_scalar(in, len, out);
+}
+
+#pragma mark - x86 (SSSE3 / AVX2)
+
+// Vector layout follows Wojciech Muła's pshufb/multiply encoder: each 32-bit lane
+// receives 3 input bytes, is split into four 6-bit indices, which a 16-entry
+// shuffle table turns into ASCII offsets.
+
+#if defined(BASE64_X86)
+
+__attribute__((target("ssse3")))
+static inline void store16(char *o, __m128i chars) {
+    _mm_storeu_si128((__m128i *)o, chars);
+}
+
+__attribute__((target("ssse3")))
+static inline void store16(uint16_t *o, __m128i chars) {
+    const __m128i zero = _mm_setzero_si128();
+    _mm_storeu_si128((__m128i *)o, _mm_unpacklo_epi8(chars, zero));
+    _mm_storeu_si128((__m128i *)(o + 8), _mm_unpackhi_epi8(chars, zero));
+}
+
+__attribute__((target("avx2")))
+static inline void store32(char *o, __m256i chars) {
+    _mm256_storeu_si256((__m256i *)o, chars);
+}
+
+__attribute__((target("avx2")))
+static inline void store32(uint16_t *o, __m256i chars) {
+    _mm256_storeu_si256((__m256i *)o, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(chars)));
+    _mm256_storeu_si256((__m256i *)(o + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(chars, 1)));
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i enc_reshuffle_ssse3(__m128i in) {
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i enc_translate_ssse3(__m128i indices) {
+    __m128i result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+    const __m128i shift = _mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+        '/' - 63, 'A', 0, 0);
+    result = _mm_shuffle_epi8(shift, result);
+    return _mm_add_epi8(result, indices);
+}
+
+template <typename Char>
+__attribute__((target("ssse3")))
+static size_t encode_ssse3(const uint8_t *in, size_t len, Char *out) {
+    Char *o = out;
+    size_t i = 0;
+
+    // 12 bytes in, 16 chars out; the 16-byte load needs 4 bytes of slack
+    for (; i + 16 <= len; i += 12) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        store16(o, enc_translate_ssse3(enc_reshuffle_ssse3(v)));
+        o += 16;
+    }
+
+    return (size_t)(o - out) + encode_scalar(in + i, len - i, o);
+}
+
+template <typename Char>
+__attribute__((target("avx2")))
+static size_t encode_avx2(const uint8_t *in, size_t len, Char *out) {
+    Char *o = out;
+    size_t i = 0;
+
+    const __m256i shuffle = _mm256_set_epi8(
+        10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+        10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m256i shift = _mm256_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+        '/' - 63, 'A', 0, 0,
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+        '/' - 63, 'A', 0, 0);
+
+    // 24 bytes in (12 per 128-bit lane), 32 chars out
+    for (; i + 28 <= len; i += 24) {
+        __m128i lo = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i hi = _mm_loadu_si128((const __m128i *)(in + i + 12));
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+        v = _mm256_shuffle_epi8(v, shuffle);
+        const __m256i t0 = _mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00));
+        const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        const __m256i t2 = _mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0));
+        const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        const __m256i indices = _mm256_or_si256(t1, t3);
+
+        __m256i result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+        result = _mm256_or_si256(result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+        result = _mm256_add_epi8(_mm256_shuffle_epi8(shift, result), indices);
+
+        store32(o, result);
+        o += 32;
+    }
+
+    // Avoid the AVX-to-SSE transition penalty before running legacy-encoded SSSE3 code
+    _mm256_zeroupper();
+    return (size_t)(o - out) + encode_ssse3(in + i, len - i, o);
+}
+
+#endif
+
+#pragma mark - ARM (NEON)
+
+#if defined(BASE64_NEON)
+
+static inline void store64(char *o, const uint8x16x4_t &chars) {
+    vst4q_u8((uint8_t *)o, chars);
+}
+
+static inline void store64(uint16_t *o, const uint8x16x4_t &chars) {
+    // vst4 interleaves, so widening each vector's halves keeps the character order
+    uint16x8x4_t lo, hi;
+    for (int k = 0; k < 4; k++) {
+        lo.val[k] = vmovl_u8(vget_low_u8(chars.val[k]));
+        hi.val[k] = vmovl_u8(vget_high_u8(chars.val[k]));
+    }
+    vst4q_u16(o, lo);
+    vst4q_u16(o + 32, hi);
+}
+
+template <typename Char>
+static size_t encode_neon(const uint8_t *in, size_t len, Char *out) {
+    Char *o = out;
+    size_t i = 0;
+
+    const uint8x16x4_t table = vld1q_u8_x4((const uint8_t *)b);
+    const uint8x16_t mask6 = vdupq_n_u8(0x3F);
+
+    // 48 bytes in, de-interleaved into three vectors; 64 chars out, re-interleaved
+    for (; i + 48 <= len; i += 48) {
+        uint8x16x3_t src = vld3q_u8(in + i);
+        uint8x16x4_t idx;
+        idx.val[0] = vshrq_n_u8(src.val[0], 2);
+        idx.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(src.val[0], 4), vshrq_n_u8(src.val[1], 4)), mask6);
+        idx.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(src.val[1], 2), vshrq_n_u8(src.val[2], 6)), mask6);
+        idx.val[3] = vandq_u8(src.val[2], mask6);
+
+        uint8x16x4_t dst;
+        dst.val[0] = vqtbl4q_u8(table, idx.val[0]);
+        dst.val[1] = vqtbl4q_u8(table, idx.val[1]);
+        dst.val[2] = vqtbl4q_u8(table, idx.val[2]);
+        dst.val[3] = vqtbl4q_u8(table, idx.val[3]);
+        store64(o, dst);
+        o += 64;
+    }
+
+    return (size_t)(o - out) + encode_scalar(in + i, len - i, o);
+}
+
+#endif
+
+#pragma mark - Dispatch
+
+typedef size_t (*base64_encoder)(const uint8_t *, size_t, char *);
+typedef size_t (*base64_encoder_utf16)(const uint8_t *, size_t, uint16_t *);
+
+struct base64_dispatch {
+    base64_encoder encode;
+    base64_encoder_utf16 encodeUTF16;
+    const char *name;
+};
+
+static base64_dispatch base64_select() {
+#if defined(BASE64_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return { encode_avx2<char>, encode_avx2<uint16_t>, "avx2" };
+    if (__builtin_cpu_supports("ssse3")) return { encode_ssse3<char>, encode_ssse3<uint16_t>, "ssse3" };
+#elif defined(BASE64_NEON)
+    return { encode_neon<char>, encode_neon<uint16_t>, "neon" };
+#endif
+    return { encode_scalar<char>, encode_scalar<uint16_t>, "scalar" };
+}
+
+static const base64_dispatch &base64_active() {
+    static const base64_dispatch dispatch = base64_select();
+    return dispatch;
+}
+
+size_t base64_encode(const uint8_t *in, size_t len, char *out) {
+    return base64_active().encode(in, len, out);
+}
+
+size_t base64_encode_utf16(const uint8_t *in, size_t len, uint16_t *out) {
+    return base64_active().encodeUTF16(in, len, out);
+}
+
+const char *base64_implementation() {
+    return base64_active().name;
+}
 
 std::string base64_encode(const std::string &in) {
     std::string out;
-
-    int val=0, valb=-6;
-    for (unsigned char c : in) {
-        val = (val<<8) + c;
-        valb += 8;
-        while (valb>=0) {
-            out.push_back(b[(val>>valb)&0x3F]);
-            valb-=6;
-        }
+    out.resize(base64_encoded_length(in.size()));
+    if (!out.empty()) {
+        base64_encode((const uint8_t *)in.data(), in.size(), &out[0]);
     }
-    if (valb>-6) out.push_back(b[((val<<8)>>(valb+8))&0x3F]);
-    while (out.size()%4) out.push_back('=');
     return out;
 }
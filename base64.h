@@ -1,8 +1,25 @@
 #ifndef BASE64_H
 #define BASE64_H
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 
 std::string base64_encode(const std::string &in);
 
+// Encodes len bytes into out, which must hold base64_encoded_length(len) chars.
+// Returns the number of chars written. No terminating NUL is added.
+size_t base64_encode(const uint8_t *in, size_t len, char *out);
+
+// Same, but writes UTF-16 code units (e.g. straight into a PA_Unichar buffer).
+size_t base64_encode_utf16(const uint8_t *in, size_t len, uint16_t *out);
+
+// Portable 3-bytes-per-step encoder; the SIMD paths fall back to it for the tail.
+size_t base64_encode_scalar(const uint8_t *in, size_t len, char *out);
+
+inline size_t base64_encoded_length(size_t len) { return (len + 2) / 3 * 4; }
+
+// Name of the encoder picked at runtime: "avx2", "ssse3", "neon" or "scalar".
+const char *base64_implementation();
+
 #endif // BASE64_H
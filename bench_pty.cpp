@@ -0,0 +1,681 @@
+/* --------------------------------------------------------------------------------
+ #
+ #  bench_pty.cpp
+ #  Standalone micro-benchmarks for the PTY plugin internals
+ #
+ #  Build & run:
+ #    cd /Users/eric/Downloads/4d-plugin-pty/4d-plugin-pty
+ #    c++ -std=c++17 -O2 -o bench_pty bench_pty.cpp pty_session.cpp pty_poller.cpp pty_ring_buffer.cpp \
+ #        pty_event_loop.cpp pty_pool.cpp pty_reaper.cpp pty_registry.cpp \
+ #        pty_zygote.cpp pty_vt_parser.cpp pty_ansi_stripper.cpp pty_screen.cpp \
+ #        pty_scrollback.cpp lz4_block.cpp base64.cpp utf8.cpp
+ #    ./bench_pty            (all benchmarks)
+ #    ./bench_pty poller     (a single benchmark)
+ #
+ # --------------------------------------------------------------------------------*/
+
+#include "pty_session.h"
+#include "pty_poller.h"
+#include "pty_ring_buffer.h"
+#include "pty_zygote.h"
+#include "pty_vt_parser.h"
+#include "pty_screen.h"
+#include "pty_scrollback.h"
+#include "base64.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+
+// ---- helpers ----------------------------------------------------------------
+
+typedef std::chrono::steady_clock Clock;
+
+static double elapsedNs(Clock::time_point start) {
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+static void raiseFdLimit(rlim_t wanted) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0) return;
+    if (rl.rlim_cur >= wanted) return;
+    rl.rlim_cur = (rl.rlim_max < wanted) ? rl.rlim_max : wanted;
+    setrlimit(RLIMIT_NOFILE, &rl);
+}
+
+// A bare PTY pair plus interrupt pipe: the same descriptors a PtySession waits on,
+// without a child process, so thousands of them are cheap to set up.
+struct PtyPair {
+    int master;
+    int slave;
+    int pipe[2];
+};
+
+static bool openPair(PtyPair& p) {
+    p.master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (p.master < 0) return false;
+    if (grantpt(p.master) != 0 || unlockpt(p.master) != 0) {
+        close(p.master);
+        return false;
+    }
+    p.slave = open(ptsname(p.master), O_RDWR | O_NOCTTY);
+    if (p.slave < 0) {
+        close(p.master);
+        return false;
+    }
+    if (pipe(p.pipe) != 0) {
+        close(p.master);
+        close(p.slave);
+        return false;
+    }
+    return true;
+}
+
+static void closePair(PtyPair& p) {
+    close(p.master);
+    close(p.slave);
+    close(p.pipe[0]);
+    close(p.pipe[1]);
+}
+
+// ---- poller -----------------------------------------------------------------
+
+static void bench_poller() {
+    printf("\n--- poller: per-call wait overhead ---\n");
+    printf("  %-8s %-8s %14s %14s\n", "backend", "sessions", "per-session ns", "shared ns");
+
+    raiseFdLimit(8192);
+
+    const PtyPoller::Backend backends[] = {
+        PtyPoller::kBackendSelect, PtyPoller::kBackendPoll, PtyPoller::kBackendEpoll
+    };
+    const int counts[] = { 1, 100, 1000 };
+    const int iterations = 20000;
+
+    for (int n : counts) {
+        std::vector<PtyPair> pairs;
+        for (int i = 0; i < n; i++) {
+            PtyPair p;
+            if (!openPair(p)) break;
+            pairs.push_back(p);
+        }
+        if ((int)pairs.size() < n) {
+            printf("  could only open %zu of %d pty pairs, skipping\n", pairs.size(), n);
+            for (PtyPair& p : pairs) closePair(p);
+            continue;
+        }
+
+        for (PtyPoller::Backend backend : backends) {
+            PtyPoller* probe = PtyPoller::create(backend);
+            if (probe == nullptr) continue;
+            delete probe;
+
+            // One poller per session watching {master, interrupt pipe}, as PtySession::read does
+            std::vector<PtyPoller*> pollers;
+            for (PtyPair& p : pairs) {
+                PtyPoller* poller = PtyPoller::create(backend);
+                poller->add(p.pipe[0]);
+                poller->add(p.master);
+                pollers.push_back(poller);
+            }
+
+            // One poller watching every master, as a shared event loop would
+            PtyPoller* shared = PtyPoller::create(backend);
+            for (PtyPair& p : pairs) shared->add(p.master);
+            std::vector<PtyPoller::Event> events(n);
+
+            double perSessionNs = 0;
+            double sharedNs = 0;
+            char c = 'x';
+
+            for (int it = 0; it < iterations; it++) {
+                PtyPair& p = pairs[it % n];
+
+                ::write(p.slave, &c, 1);
+                Clock::time_point t0 = Clock::now();
+                pollers[it % n]->wait(events.data(), 2, -1);
+                perSessionNs += elapsedNs(t0);
+                ::read(p.master, &c, 1);
+
+                ::write(p.slave, &c, 1);
+                t0 = Clock::now();
+                shared->wait(events.data(), n, -1);
+                sharedNs += elapsedNs(t0);
+                ::read(p.master, &c, 1);
+            }
+
+            printf("  %-8s %-8d %14.0f %14.0f\n", PtyPoller::backendName(backend), n,
+                   perSessionNs / iterations, sharedNs / iterations);
+
+            delete shared;
+            for (PtyPoller* poller : pollers) delete poller;
+        }
+
+        for (PtyPair& p : pairs) closePair(p);
+    }
+}
+
+// ---- reader -----------------------------------------------------------------
+
+// Streams `bytes` of output through a session and returns MB/s as seen by the consumer.
+// consumerDelayUs simulates the per-chunk work on the 4D side (encoding, CALL FORM...).
+static double streamThroughput(PtySession::ReaderMode mode, size_t bytes, int consumerDelayUs) {
+    PtySession pty(1);
+    pty.setReaderMode(mode, 1024 * 1024);
+    if (!pty.start("/bin/sh", 80, 24)) return 0;
+
+    usleep(100000);
+    while (!pty.read(65536, 50).empty()) {}
+
+    char cmd[128];
+    snprintf(cmd, sizeof(cmd), "head -c %zu /dev/zero\n", bytes);
+
+    Clock::time_point t0 = Clock::now();
+    pty.write(cmd, strlen(cmd));
+
+    size_t total = 0;
+    while (total < bytes) {
+        std::string chunk = pty.read(65536, 2000);
+        if (chunk.empty()) break;
+        total += chunk.size();
+        if (consumerDelayUs > 0) usleep(consumerDelayUs);
+    }
+    double seconds = elapsedNs(t0) / 1e9;
+    pty.close();
+
+    return (double)total / (1024.0 * 1024.0) / seconds;
+}
+
+static void bench_reader() {
+    printf("\n--- reader: synchronous read vs background reader thread ---\n");
+    printf("  %-16s %12s %12s\n", "consumer delay", "sync MB/s", "thread MB/s");
+
+    const size_t bytes = 32 * 1024 * 1024;
+    const int delays[] = { 0, 100, 500 };
+
+    for (int delay : delays) {
+        double sync = streamThroughput(PtySession::kReaderSync, bytes, delay);
+        double thread = streamThroughput(PtySession::kReaderThread, bytes, delay);
+        char label[32];
+        snprintf(label, sizeof(label), "%d us/chunk", delay);
+        printf("  %-16s %12.1f %12.1f\n", label, sync, thread);
+    }
+}
+
+// ---- io ---------------------------------------------------------------------
+
+// MB/s of `head -c bytes source` run directly, through a terminal or through pipes.
+static double commandThroughput(PtySession::IoMode mode, size_t bytes, bool raw = false,
+                                const char* source = "/dev/zero") {
+    PtySession pty(1);
+    pty.setIoMode(mode);
+    pty.setRawMode(raw);
+    std::vector<std::string> argv = { "head", "-c", std::to_string(bytes), source };
+
+    Clock::time_point t0 = Clock::now();
+    if (!pty.startProcess("head", argv, nullptr, 80, 24)) return 0;
+
+    // Counted until the program ends: ONLCR makes cooked output longer than bytes
+    size_t received = 0;
+    for (;;) {
+        std::string chunk = pty.read(65536, 1000);
+        if (chunk.empty()) break;
+        received += chunk.size();
+    }
+    if (received > bytes) received = bytes;
+    double ns = elapsedNs(t0);
+    pty.close();
+    return (received / (1024.0 * 1024.0)) / (ns / 1e9);
+}
+
+static void bench_io() {
+    printf("\n--- io: batch command output, terminal vs pipes ---\n");
+    printf("  %-10s %14s %14s\n", "output", "terminal MB/s", "pipes MB/s");
+
+    const size_t sizesMB[] = { 1, 16, 64 };
+    for (size_t mb : sizesMB) {
+        double terminal = 0, pipes = 0;
+        for (int r = 0; r < 3; r++) {
+            terminal += commandThroughput(PtySession::kIoTerminal, mb * 1024 * 1024);
+            pipes += commandThroughput(PtySession::kIoPipes, mb * 1024 * 1024);
+        }
+        char label[32];
+        snprintf(label, sizeof(label), "%zu MB", mb);
+        printf("  %-10s %14.0f %14.0f\n", label, terminal / 3, pipes / 3);
+    }
+}
+
+static void bench_termios() {
+    printf("\n--- termios: binary output through the terminal, cooked vs raw ---\n");
+    printf("  %-22s %14s %14s\n", "output", "cooked MB/s", "raw MB/s");
+
+    // Text-like data: a newline every 16 bytes, each one rewritten to CR LF when cooked
+    char lines[] = "/tmp/bench_pty_lines.XXXXXX";
+    int fd = mkstemp(lines);
+    if (fd >= 0) {
+        std::string block;
+        for (int i = 0; i < 4096; i++) block += "0123456789abcde\n";
+        for (int i = 0; i < 64 * 1024 * 1024 / (int)block.size(); i++) {
+            if (::write(fd, block.data(), block.size()) < 0) break;
+        }
+        ::close(fd);
+    }
+
+    struct { const char* label; const char* source; } inputs[] = {
+        { "64 MB without newline", "/dev/zero" },
+        { "64 MB of 16-byte lines", lines },
+    };
+    for (auto& input : inputs) {
+        double cooked = 0, raw = 0;
+        for (int r = 0; r < 3; r++) {
+            cooked += commandThroughput(PtySession::kIoTerminal, 64 * 1024 * 1024, false, input.source);
+            raw += commandThroughput(PtySession::kIoTerminal, 64 * 1024 * 1024, true, input.source);
+        }
+        printf("  %-22s %14.0f %14.0f\n", input.label, cooked / 3, raw / 3);
+    }
+    unlink(lines);
+}
+
+// Read calls and MB/s to consume 64 MB of command output, by read style.
+static void bench_gather() {
+    printf("\n--- gather: 64 MB of output, read calls per style ---\n");
+    printf("  %-22s %12s %12s\n", "read", "calls", "MB/s");
+
+    const size_t bytes = 64 * 1024 * 1024;
+    for (int gather = 0; gather < 2; gather++) {
+        PtySession pty(1);
+        pty.setIoMode(PtySession::kIoPipes);
+        pty.setReturnOnFirstData(gather == 0);
+        std::vector<std::string> argv = { "head", "-c", std::to_string(bytes), "/dev/zero" };
+
+        Clock::time_point t0 = Clock::now();
+        if (!pty.startProcess("head", argv, nullptr, 80, 24)) continue;
+        size_t received = 0;
+        int calls = 0;
+        for (;;) {
+            std::string chunk = pty.read(65536, 1000);
+            calls++;
+            if (chunk.empty()) break;
+            received += chunk.size();
+        }
+        double ns = elapsedNs(t0);
+        pty.close();
+        printf("  %-22s %12d %12.0f\n", gather ? "until maxBytes/timeout" : "return on first data",
+               calls, (received / (1024.0 * 1024.0)) / (ns / 1e9));
+    }
+}
+
+// Cost of the read result itself: small chunks out of a ring, the fast path of the
+// buffered readers, returned the way PtySession::read used to, then without allocation.
+static void bench_readbuf() {
+    printf("\n--- readbuf: 16-byte reads with maxBytes = 65536 ---\n");
+    printf("  %-30s %12s\n", "result", "ns / read");
+
+    const int rounds = 200000;
+    const size_t maxBytes = 65536;
+    PtyRingBuffer ring(1024 * 1024);
+    const char chunk[] = "\x1b[2;5Hprompt$ ";
+    size_t sink = 0;
+
+    Clock::time_point t0 = Clock::now();
+    for (int i = 0; i < rounds; i++) {
+        ring.write(chunk, 16);
+        std::string result;
+        result.resize(maxBytes);
+        result.resize(ring.read(&result[0], maxBytes));
+        sink += result.size();
+    }
+    printf("  %-30s %12.1f\n", "string sized to maxBytes", elapsedNs(t0) / rounds);
+
+    std::vector<char> buffer(maxBytes);
+    t0 = Clock::now();
+    for (int i = 0; i < rounds; i++) {
+        ring.write(chunk, 16);
+        std::string result(buffer.data(), ring.read(buffer.data(), maxBytes));
+        sink += result.size();
+    }
+    printf("  %-30s %12.1f\n", "reused buffer, string copy", elapsedNs(t0) / rounds);
+
+    t0 = Clock::now();
+    for (int i = 0; i < rounds; i++) {
+        ring.write(chunk, 16);
+        sink += ring.read(buffer.data(), maxBytes);
+    }
+    printf("  %-30s %12.1f\n", "reused buffer only", elapsedNs(t0) / rounds);
+
+    if (sink == 0) printf("  (no data)\n");
+}
+
+// ---- spawn ------------------------------------------------------------------
+
+// Time from start() to the first byte of shell output (its prompt), averaged.
+static double createToFirstByteUs(PtySession::SpawnMethod method, int rounds) {
+    double totalUs = 0;
+    int done = 0;
+    for (int r = 0; r < rounds; r++) {
+        PtySession pty(1);
+        pty.setSpawnMethod(method);
+        Clock::time_point t0 = Clock::now();
+        if (!pty.start("/bin/sh", 80, 24)) continue;
+        std::string first = pty.read(4096, 2000);
+        double us = elapsedNs(t0) / 1000.0;
+        pty.close();
+        if (first.empty()) continue;
+        totalUs += us;
+        done++;
+    }
+    return done > 0 ? totalUs / done : 0;
+}
+
+static void bench_spawn() {
+    printf("\n--- spawn: create-to-first-byte latency vs parent RSS ---\n");
+    printf("  %-10s %14s %14s %14s\n", "parent RSS", "spawn us", "fork us", "zygote us");
+
+    // Started up front, so that the first round does not count it
+    PtyZygote::shared().start();
+
+    const size_t sizesMB[] = { 0, 256, 1024, 2048 };
+    const int rounds = 20;
+    std::vector<char*> blocks;
+
+    size_t allocatedMB = 0;
+    for (size_t mb : sizesMB) {
+        // Grow the resident set: every page touched, as in a long-running 4D server
+        while (allocatedMB < mb) {
+            char* block = (char*)malloc(64 * 1024 * 1024);
+            if (block == nullptr) break;
+            memset(block, 1, 64 * 1024 * 1024);
+            blocks.push_back(block);
+            allocatedMB += 64;
+        }
+        if (allocatedMB < mb) {
+            printf("  could not allocate %zu MB, stopping\n", mb);
+            break;
+        }
+
+        double spawnUs = createToFirstByteUs(PtySession::kSpawnDefault, rounds);
+        double forkUs = createToFirstByteUs(PtySession::kSpawnFork, rounds);
+        double zygoteUs = createToFirstByteUs(PtySession::kSpawnZygote, rounds);
+        char label[32];
+        snprintf(label, sizeof(label), "%zu MB", mb);
+        printf("  %-10s %14.0f %14.0f %14.0f\n", label, spawnUs, forkUs, zygoteUs);
+    }
+
+    for (char* block : blocks) free(block);
+    PtyZygote::shared().stop();
+}
+
+// ---- base64 -----------------------------------------------------------------
+
+// The original bit-at-a-time encoder, for comparison
+static std::string legacyBase64(const std::string &in) {
+    static const std::string b = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    int val=0, valb=-6;
+    for (unsigned char c : in) {
+        val = (val<<8) + c;
+        valb += 8;
+        while (valb>=0) {
+            out.push_back(b[(val>>valb)&0x3F]);
+            valb-=6;
+        }
+    }
+    if (valb>-6) out.push_back(b[((val<<8)>>(valb+8))&0x3F]);
+    while (out.size()%4) out.push_back('=');
+    return out;
+}
+
+static void bench_base64() {
+    printf("\n--- base64: encoder throughput (input MB/s, dispatch = %s) ---\n", base64_implementation());
+    printf("  %-8s %10s %10s %10s %10s %10s\n", "size", "legacy", "scalar", "dispatch", "string", "utf16");
+
+    const size_t sizes[] = { 64, 4096, 65536, 1024 * 1024 };
+    const size_t totalBytes = 256 * 1024 * 1024;
+
+    for (size_t size : sizes) {
+        std::string in(size, '\0');
+        for (size_t i = 0; i < size; i++) in[i] = (char)(rand() & 0xFF);
+        std::vector<char> out(base64_encoded_length(size));
+        std::vector<uint16_t> wide(base64_encoded_length(size));
+        size_t rounds = totalBytes / size;
+        size_t sink = 0;
+
+        Clock::time_point t0 = Clock::now();
+        for (size_t r = 0; r < rounds / 8; r++) sink += legacyBase64(in).size();
+        double legacy = (double)(rounds / 8) * size / (elapsedNs(t0) / 1e9) / (1024.0 * 1024.0);
+
+        t0 = Clock::now();
+        for (size_t r = 0; r < rounds; r++) sink += base64_encode_scalar((const uint8_t*)in.data(), size, out.data());
+        double scalar = (double)rounds * size / (elapsedNs(t0) / 1e9) / (1024.0 * 1024.0);
+
+        t0 = Clock::now();
+        for (size_t r = 0; r < rounds; r++) sink += base64_encode((const uint8_t*)in.data(), size, out.data());
+        double dispatch = (double)rounds * size / (elapsedNs(t0) / 1e9) / (1024.0 * 1024.0);
+
+        t0 = Clock::now();
+        for (size_t r = 0; r < rounds; r++) sink += base64_encode(in).size();
+        double string = (double)rounds * size / (elapsedNs(t0) / 1e9) / (1024.0 * 1024.0);
+
+        t0 = Clock::now();
+        for (size_t r = 0; r < rounds; r++) sink += base64_encode_utf16((const uint8_t*)in.data(), size, wide.data());
+        double utf16 = (double)rounds * size / (elapsedNs(t0) / 1e9) / (1024.0 * 1024.0);
+
+        printf("  %-8zu %10.0f %10.0f %10.0f %10.0f %10.0f\n", size, legacy, scalar, dispatch, string, utf16);
+        if (sink == 0) printf("  (sink)\n");
+    }
+}
+
+// ---- vtparse ----------------------------------------------------------------
+
+struct VtCounter : PtyVtParser::Handler {
+    size_t printed = 0, controls = 0, sequences = 0;
+    void print(const char* text, size_t len) override { printed += len; }
+    void execute(unsigned char c) override { controls++; }
+    void csiDispatch(const PtyVtParser& p, char final) override { sequences += p.paramCount(); }
+    void escDispatch(const PtyVtParser& p, char final) override { sequences++; }
+    void oscDispatch(const char* data, size_t len) override { sequences++; }
+};
+
+// ~4 MB of output in the style of a build log, `ls --color` and a full-screen TUI
+static std::string vtWorkload(int kind) {
+    std::string out;
+    int i = 0;
+    while (out.size() < 4 * 1024 * 1024) {
+        char line[256];
+        if (kind == 0) {
+            snprintf(line, sizeof(line), "[%5d/9999] Building CXX object src/CMakeFiles/core.dir/module_%d.cpp.o\r\n", i, i);
+        } else if (kind == 1) {
+            snprintf(line, sizeof(line), "\x1b[0m\x1b[01;34mdir_%d\x1b[0m  \x1b[01;32mrun_%d.sh\x1b[0m  f\xC3\xA9_%d.txt\r\n", i, i, i);
+        } else {
+            snprintf(line, sizeof(line), "\x1b[%d;%dH\x1b[38;5;%dm\x1b[48;2;10;20;%dm%c\x1b[0m\x1b[?25l\x1b]0;top - %d\x07",
+                     i % 24 + 1, i % 80 + 1, i % 256, i % 256, 'a' + i % 26, i);
+        }
+        out += line;
+        i++;
+    }
+    return out;
+}
+
+static void bench_vtparse() {
+    printf("\n--- vtparse: PtyVtParser throughput, 4 KB chunks ---\n");
+    printf("  %-12s %10s\n", "workload", "MB/s");
+
+    const char* names[] = { "build log", "ls --color", "TUI" };
+    for (int kind = 0; kind < 3; kind++) {
+        std::string input = vtWorkload(kind);
+        VtCounter counter;
+        PtyVtParser parser(&counter);
+
+        const int rounds = 10;
+        Clock::time_point t0 = Clock::now();
+        for (int r = 0; r < rounds; r++) {
+            for (size_t i = 0; i < input.size(); i += 4096) {
+                parser.feed(input.data() + i, std::min<size_t>(4096, input.size() - i));
+            }
+        }
+        double mbps = (double)rounds * input.size() / (elapsedNs(t0) / 1e9) / (1024.0 * 1024.0);
+        printf("  %-12s %10.0f\n", names[kind], mbps);
+        if (counter.printed + counter.controls + counter.sequences == 0) printf("  (no events)\n");
+    }
+}
+
+// ---- screen -----------------------------------------------------------------
+
+static void bench_screen() {
+    printf("\n--- screen: PtyScreen updates, 4 KB chunks ---\n");
+    printf("  %-12s %-9s %14s %10s\n", "workload", "size", "Mcells/s", "MB/s");
+
+    const char* names[] = { "build log", "ls --color", "TUI" };
+    const int sizes[][2] = { { 80, 24 }, { 300, 100 } };
+
+    for (int kind = 0; kind < 3; kind++) {
+        std::string input = vtWorkload(kind);
+
+        // Cells written = characters printed
+        VtCounter counter;
+        PtyVtParser parser(&counter);
+        parser.feed(input.data(), input.size());
+
+        for (const auto& size : sizes) {
+            PtyScreen screen(size[0], size[1]);
+            const int rounds = 10;
+            Clock::time_point t0 = Clock::now();
+            for (int r = 0; r < rounds; r++) {
+                for (size_t i = 0; i < input.size(); i += 4096) {
+                    screen.feed(input.data() + i, std::min<size_t>(4096, input.size() - i));
+                }
+            }
+            double seconds = elapsedNs(t0) / 1e9;
+            char dims[16];
+            snprintf(dims, sizeof(dims), "%dx%d", size[0], size[1]);
+            printf("  %-12s %-9s %14.1f %10.0f\n", names[kind], dims,
+                   (double)rounds * counter.printed / seconds / 1e6,
+                   (double)rounds * input.size() / seconds / (1024.0 * 1024.0));
+            if (screen.rowText(0).empty() && kind == 2) printf("  (blank)\n");
+        }
+    }
+}
+
+// ---- scrollback ---------------------------------------------------------------
+
+// One million lines: 0 = build log, 1 = commit hashes and subjects (compresses less)
+static std::string scrollbackWorkload(int kind) {
+    std::string out;
+    uint32_t seed = 42;
+    char line[160];
+    for (int i = 0; i < 1000000; i++) {
+        seed = seed * 1103515245u + 12345u;
+        if (kind == 0) {
+            snprintf(line, sizeof(line), "[%3d%%] Building CXX object src/module%u/CMakeFiles/module.dir/file%u.cpp.o\n",
+                     i / 10000, (seed >> 8) % 40, (seed >> 16) % 500);
+        } else {
+            uint32_t a = seed;
+            seed = seed * 1103515245u + 12345u;
+            snprintf(line, sizeof(line), "%08x%08x%08x Fix issue #%u in the %s path\n",
+                     a, seed, a ^ seed, (seed >> 12) % 9000, (a & 1) ? "read" : "write");
+        }
+        out += line;
+    }
+    return out;
+}
+
+static void bench_scrollback() {
+    printf("\n--- scrollback: 1M lines appended in 4 KB chunks, then read back ---\n");
+    printf("  %-10s %8s %8s %10s %10s %12s %12s\n",
+           "workload", "raw MB", "kept MB", "MB/s", "Mlines/s", "random us", "seq ns/line");
+
+    const char* names[] = { "build log", "git log" };
+
+    for (int kind = 0; kind < 2; kind++) {
+        std::string input = scrollbackWorkload(kind);
+        PtyScrollback scrollback((size_t)1 << 40);     // no limit: everything kept
+
+        Clock::time_point t0 = Clock::now();
+        for (size_t i = 0; i < input.size(); i += 4096) {
+            scrollback.append(input.data() + i, std::min<size_t>(4096, input.size() - i));
+        }
+        double appendSeconds = elapsedNs(t0) / 1e9;
+        uint64_t lines = scrollback.lineCount();
+
+        // Random lines: one page decompressed per line read
+        std::string text;
+        uint32_t seed = 7;
+        const int randomReads = 20000;
+        t0 = Clock::now();
+        for (int i = 0; i < randomReads; i++) {
+            seed = seed * 1103515245u + 12345u;
+            scrollback.line(seed % lines, text);
+        }
+        double randomUs = elapsedNs(t0) / 1e3 / randomReads;
+
+        t0 = Clock::now();
+        for (uint64_t n = 0; n < lines; n++) {
+            scrollback.line(n, text);
+        }
+        double sequentialNs = elapsedNs(t0) / (double)lines;
+
+        printf("  %-10s %8.1f %8.1f %10.0f %10.1f %12.1f %12.1f\n", names[kind],
+               input.size() / (1024.0 * 1024.0), scrollback.memoryUsage() / (1024.0 * 1024.0),
+               input.size() / appendSeconds / (1024.0 * 1024.0), lines / appendSeconds / 1e6,
+               randomUs, sequentialNs);
+    }
+
+    // With a budget, the oldest pages are dropped instead
+    std::string input = scrollbackWorkload(0);
+    PtyScrollback bounded(8 * 1024 * 1024);
+    bounded.append(input.data(), input.size());
+    printf("  8 MB budget, build log: lines %llu-%llu kept (%.1f MB)\n",
+           (unsigned long long)bounded.firstLine(), (unsigned long long)bounded.lineCount() - 1,
+           bounded.memoryUsage() / (1024.0 * 1024.0));
+}
+
+// ---- main -------------------------------------------------------------------
+
+struct Benchmark {
+    const char* name;
+    void (*run)();
+};
+
+static const Benchmark g_benchmarks[] = {
+    { "poller", bench_poller },
+    { "reader", bench_reader },
+    { "base64", bench_base64 },
+    { "spawn",  bench_spawn },
+    { "io",     bench_io },
+    { "termios", bench_termios },
+    { "gather", bench_gather },
+    { "readbuf", bench_readbuf },
+    { "vtparse", bench_vtparse },
+    { "screen", bench_screen },
+    { "scrollback", bench_scrollback },
+};
+
+int main(int argc, char** argv) {
+    // This binary is also the zygote helper of its sessions
+    if (argc > 1 && strcmp(argv[1], PtyZygote::kHelperArgument) == 0) {
+        return PtyZygote::helperMain();
+    }
+    char self[PATH_MAX];
+    if (realpath(argv[0], self) != nullptr) {
+        PtyZygote::shared().setHelperPath(self);
+    }
+
+    printf("=== PTY plugin benchmarks ===\n");
+
+    for (const Benchmark& b : g_benchmarks) {
+        if (argc > 1 && strcmp(argv[1], b.name) != 0) continue;
+        b.run();
+    }
+
+    printf("\n=============================\n");
+    return 0;
+}
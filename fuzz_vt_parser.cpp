@@ -0,0 +1,164 @@
+/* --------------------------------------------------------------------------------
+ #
+ #  fuzz_vt_parser.cpp
+ #  Fuzz target for PtyVtParser
+ #
+ #  libFuzzer:
+ #    clang++ -std=c++17 -g -O1 -fsanitize=fuzzer,address,undefined -o fuzz_vt_parser \
+ #        fuzz_vt_parser.cpp pty_vt_parser.cpp utf8.cpp
+ #    ./fuzz_vt_parser -max_len=4096
+ #
+ #  Without libFuzzer (random inputs, or replays the files given as arguments):
+ #    c++ -std=c++17 -g -O1 -fsanitize=address,undefined -DVT_FUZZ_STANDALONE -o fuzz_vt_parser \
+ #        fuzz_vt_parser.cpp pty_vt_parser.cpp utf8.cpp
+ #    ./fuzz_vt_parser [iterations | file...]
+ #
+ # --------------------------------------------------------------------------------*/
+
+#include "pty_vt_parser.h"
+#include "utf8.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Serialises the callbacks, merging adjacent print() and dcsPut() runs: the result must
+// not depend on how the input is chunked. Also checks the per-callback guarantees.
+class Recorder : public PtyVtParser::Handler {
+public:
+    std::string log;
+    char last = 0;
+
+    void event(char kind, const char* data, size_t len) {
+        if (!(kind == last && (kind == 'P' || kind == 'd'))) {
+            log += '\n';
+            log += kind;
+        }
+        log.append(data, len);
+        last = kind;
+    }
+    void sequence(char kind, const PtyVtParser& p, char final) {
+        if (p.paramCount() > PtyVtParser::kMaxParams || p.intermediateCount() > PtyVtParser::kMaxIntermediates) abort();
+        std::string s(p.intermediates(), (size_t)p.intermediateCount());
+        for (int i = 0; i < p.paramCount(); i++) {
+            int value = p.param(i, -1);
+            if (value > 65535) abort();
+            s += (p.isSubparam(i) ? ':' : ';') + std::to_string(value);
+        }
+        s += final;
+        event(kind, s.data(), s.size());
+    }
+
+    void print(const char* text, size_t len) override {
+        if (len == 0) abort();
+        for (size_t i = 0; i < len; i++) {
+            if ((unsigned char)text[i] < 0x20 || text[i] == 0x7F) abort();
+        }
+        event('P', text, len);
+    }
+    void execute(unsigned char c) override {
+        if (c >= 0x20) abort();
+        event('X', (const char*)&c, 1);
+    }
+    void csiDispatch(const PtyVtParser& p, char final) override { sequence('C', p, final); }
+    void escDispatch(const PtyVtParser& p, char final) override { sequence('E', p, final); }
+    void oscDispatch(const char* data, size_t len) override {
+        if (len > PtyVtParser::kMaxOscLength) abort();
+        event('O', data, len);
+    }
+    void dcsHook(const PtyVtParser& p, char final) override { sequence('H', p, final); }
+    void dcsPut(const char* data, size_t len) override { event('d', data, len); }
+    void dcsUnhook() override { event('U', "", 0); }
+};
+
+// The first byte picks the chunk size used for the second pass (1-16, 0 = random)
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    if (size == 0) return 0;
+    size_t mode = data[0] % 17;
+    const char* input = (const char*)data + 1;
+    size_t len = size - 1;
+
+    Recorder whole;
+    PtyVtParser parser(&whole);
+    parser.feed(input, len);
+
+    Recorder split;
+    PtyVtParser chunked(&split);
+    uint32_t seed = (uint32_t)size * 2654435761u;
+    for (size_t i = 0; i < len; ) {
+        size_t chunk = mode;
+        if (chunk == 0) {
+            seed = seed * 1103515245u + 12345u;
+            chunk = 1 + (seed >> 16) % 64;
+        }
+        if (chunk > len - i) chunk = len - i;
+        chunked.feed(input + i, chunk);
+        i += chunk;
+    }
+
+    if (whole.log != split.log || parser.state() != chunked.state()) {
+        fprintf(stderr, "chunking changed the result\n");
+        abort();
+    }
+
+    parser.reset();
+    if (parser.state() != PtyVtParser::kGround) abort();
+    return 0;
+}
+
+#ifdef VT_FUZZ_STANDALONE
+
+// Inputs biased towards what the parser branches on
+static std::vector<uint8_t> randomInput(uint32_t& seed) {
+    static const char* pieces[] = {
+        "\x1b", "[", "]", "P", "_", "^", "X", "(", "#", "?", ">", ";", ":", "\\", "\x07",
+        "\x18", "\x1a", "\x7f", "\r\n", "0", "12", "65536", "m", "H", "q", " ", "$",
+        "\xC3", "\xA9", "\xE2\x82\xAC", "\xF0\x9F\x98\x80", "\xFF", "abc"
+    };
+    const size_t count = sizeof(pieces) / sizeof(pieces[0]);
+
+    std::vector<uint8_t> out;
+    seed = seed * 1103515245u + 12345u;
+    size_t n = (seed >> 16) % 200;
+    for (size_t i = 0; i < n; i++) {
+        seed = seed * 1103515245u + 12345u;
+        uint32_t r = seed >> 8;
+        if (r % 8 == 0) {
+            out.push_back((uint8_t)(r >> 8));
+        } else {
+            const char* p = pieces[(r >> 3) % count];
+            out.insert(out.end(), p, p + strlen(p));
+        }
+    }
+    return out;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && atoi(argv[1]) == 0) {
+        for (int i = 1; i < argc; i++) {
+            FILE* f = fopen(argv[i], "rb");
+            if (!f) { perror(argv[i]); return 1; }
+            std::vector<uint8_t> data;
+            int c;
+            while ((c = fgetc(f)) != EOF) data.push_back((uint8_t)c);
+            fclose(f);
+            LLVMFuzzerTestOneInput(data.data(), data.size());
+        }
+        printf("%d input(s) replayed\n", argc - 1);
+        return 0;
+    }
+
+    int iterations = argc > 1 ? atoi(argv[1]) : 100000;
+    uint32_t seed = 1;
+    for (int i = 0; i < iterations; i++) {
+        std::vector<uint8_t> data = randomInput(seed);
+        LLVMFuzzerTestOneInput(data.data(), data.size());
+    }
+    printf("%d random inputs\n", iterations);
+    return 0;
+}
+
+#endif
@@ -5,13 +5,15 @@
  #
  #  Build & run:
  #    cd /Users/eric/Downloads/4d-plugin-pty/4d-plugin-pty
- #    c++ -std=c++17 -o interactive_pty interactive_pty.cpp pty_session.cpp
+ #    c++ -std=c++17 -o interactive_pty interactive_pty.cpp pty_session.cpp pty_poller.cpp pty_ring_buffer.cpp \
+ #        pty_event_loop.cpp pty_reaper.cpp pty_zygote.cpp pty_vt_parser.cpp pty_ansi_stripper.cpp pty_screen.cpp \
+ #        pty_scrollback.cpp lz4_block.cpp utf8.cpp
  #    ./interactive_pty
  #
  #  Type commands at the prompt. The program shows:
  #    - what was written (bytes sent)
  #    - what was read back (raw from the PTY)
- #    - a clean version (ANSI stripped)
+ #    - a clean version (ANSI stripped by PtyAnsiStripper)
  #
  #  Special commands:
  #    :quit     — exit
@@ -21,6 +23,7 @@
  # --------------------------------------------------------------------------------*/
 
 #include "pty_session.h"
+#include "pty_ansi_stripper.h"
 
 #include <cstdio>
 #include <cstring>
@@ -28,44 +31,6 @@
 #include <unistd.h>
 #include <termios.h>
 
-// --- ANSI stripping (same as test_pty.cpp) -----------------------------------
-
-static std::string stripAnsi(const std::string& s) {
-    std::string out;
-    size_t i = 0;
-    while (i < s.size()) {
-        if (s[i] == '\x1b') {
-            i++;
-            if (i >= s.size()) break;
-            if (s[i] == '[') {
-                i++;
-                while (i < s.size() && s[i] < 0x40) i++;
-                if (i < s.size()) i++;
-            } else if (s[i] == ']') {
-                i++;
-                while (i < s.size()) {
-                    if (s[i] == '\x07') { i++; break; }
-                    if (s[i] == '\x1b' && i + 1 < s.size() && s[i + 1] == '\\') { i += 2; break; }
-                    i++;
-                }
-            } else if (s[i] == '(' || s[i] == ')') {
-                i += 2;
-            } else {
-                i++;
-            }
-        } else if (s[i] == '\x08') {
-            if (!out.empty()) out.pop_back();
-            i++;
-        } else if ((unsigned char)s[i] < 0x20 && s[i] != '\n' && s[i] != '\t') {
-            i++;
-        } else {
-            out += s[i];
-            i++;
-        }
-    }
-    return out;
-}
-
 // --- colors ------------------------------------------------------------------
 
 #define C_RESET   "\033[0m"
@@ -95,11 +60,14 @@ int main(int argc, char* argv[]) {
 
     printf(C_DIM "Session started (pid %d)" C_RESET "\n", (int)pty.pid());
 
+    // Keeps its state between reads, so a sequence cut by a read is still removed
+    PtyAnsiStripper stripper;
+
     // Read initial shell output (prompt, motd, etc.)
     std::string initial = pty.read(8192, 1000);
     if (!initial.empty()) {
         printf(C_DIM "--- initial output (%zu bytes) ---" C_RESET "\n", initial.size());
-        std::string clean = stripAnsi(initial);
+        std::string clean = stripper.strip(initial);
         printf("%s\n", clean.c_str());
         printf(C_DIM "--- end initial ---" C_RESET "\n");
     }
@@ -171,7 +139,7 @@ int main(int argc, char* argv[]) {
             printf(C_DIM "  --- raw ---" C_RESET "\n");
             fwrite(output.c_str(), 1, output.size(), stdout);
             printf("\n" C_DIM "  --- clean ---" C_RESET "\n");
-            std::string clean = stripAnsi(output);
+            std::string clean = stripper.strip(output);
             printf("%s\n", clean.c_str());
             printf(C_DIM "  --- end ---" C_RESET "\n");
         }
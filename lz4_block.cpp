@@ -0,0 +1,165 @@
+#include "lz4_block.h"
+
+#include <cstdint>
+#include <cstring>
+
+static const int kHashLog = 12;                 // 16 KB table, on the stack
+static const size_t kMinMatch = 4;
+static const size_t kLastLiterals = 5;          // a block ends with at least 5 literals
+static const size_t kMatchFindLimit = 12;       // and no match starts in its last 12 bytes
+static const size_t kMaxOffset = 65535;
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint32_t hash4(uint32_t v) {
+    return (v * 2654435761u) >> (32 - kHashLog);
+}
+
+// The part of a length beyond the 15 held by the token: 255-valued bytes, then the rest
+static uint8_t *writeLength(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+// matchLen 0: the last sequence, literals only
+static uint8_t *writeSequence(uint8_t *op, const uint8_t *literals, size_t literalLen,
+                              size_t offset, size_t matchLen) {
+    uint8_t *token = op++;
+    uint8_t t;
+
+    if (literalLen >= 15) {
+        t = 15 << 4;
+        op = writeLength(op, literalLen - 15);
+    } else {
+        t = (uint8_t)(literalLen << 4);
+    }
+    memcpy(op, literals, literalLen);
+    op += literalLen;
+
+    if (matchLen > 0) {
+        *op++ = (uint8_t)(offset & 0xFF);
+        *op++ = (uint8_t)(offset >> 8);
+        size_t extra = matchLen - kMinMatch;
+        if (extra >= 15) {
+            t |= 15;
+            op = writeLength(op, extra - 15);
+        } else {
+            t |= (uint8_t)extra;
+        }
+    }
+    *token = t;
+    return op;
+}
+
+size_t lz4_compress(const char *in, size_t len, char *out) {
+    const uint8_t *src = (const uint8_t *)in;
+    uint8_t *op = (uint8_t *)out;
+    size_t anchor = 0;      // start of the literals not written yet
+
+    if (len > kMatchFindLimit) {
+        uint32_t table[1 << kHashLog];      // position + 1 of the last 4 bytes with that hash, 0 if none
+        memset(table, 0, sizeof(table));
+
+        const size_t limit = len - kMatchFindLimit;
+        const size_t matchLimit = len - kLastLiterals;
+        size_t ip = 0;
+        size_t misses = 0;      // steps grow over incompressible data
+
+        while (ip < limit) {
+            uint32_t sequence = read32(src + ip);
+            uint32_t h = hash4(sequence);
+            size_t ref = table[h];
+            table[h] = (uint32_t)(ip + 1);
+
+            if (ref == 0 || ip + 1 - ref > kMaxOffset || read32(src + ref - 1) != sequence) {
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+            ref--;
+            misses = 0;
+
+            // Extend backwards over the pending literals, then forwards
+            while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+                ip--;
+                ref--;
+            }
+            size_t matchLen = kMinMatch;
+            while (ip + matchLen < matchLimit && src[ip + matchLen] == src[ref + matchLen]) {
+                matchLen++;
+            }
+
+            op = writeSequence(op, src + anchor, ip - anchor, ip - ref, matchLen);
+            ip += matchLen;
+            anchor = ip;
+
+            // A position inside the match, so that a repeat right after it is found
+            if (ip - 2 < limit) {
+                table[hash4(read32(src + ip - 2))] = (uint32_t)(ip - 1);
+            }
+        }
+    }
+
+    op = writeSequence(op, src + anchor, len - anchor, 0, 0);
+    return (size_t)(op - (uint8_t *)out);
+}
+
+static bool readLength(const uint8_t *&ip, const uint8_t *end, size_t &len) {
+    uint8_t b;
+    do {
+        if (ip >= end) return false;
+        b = *ip++;
+        len += b;
+    } while (b == 255);
+    return true;
+}
+
+bool lz4_decompress(const char *in, size_t len, char *out, size_t outLen) {
+    const uint8_t *ip = (const uint8_t *)in;
+    const uint8_t *end = ip + len;
+    uint8_t *op = (uint8_t *)out;
+    uint8_t *const oend = op + outLen;
+
+    for (;;) {
+        if (ip >= end) return false;
+        uint8_t token = *ip++;
+
+        size_t literalLen = token >> 4;
+        if (literalLen == 15 && !readLength(ip, end, literalLen)) return false;
+        if (literalLen > (size_t)(end - ip) || literalLen > (size_t)(oend - op)) return false;
+        memcpy(op, ip, literalLen);
+        ip += literalLen;
+        op += literalLen;
+
+        if (ip == end) {
+            return op == oend;      // the last sequence has no match
+        }
+
+        if (end - ip < 2) return false;
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - (uint8_t *)out)) return false;
+
+        size_t matchLen = token & 15;
+        if (matchLen == 15 && !readLength(ip, end, matchLen)) return false;
+        matchLen += kMinMatch;
+        if (matchLen > (size_t)(oend - op)) return false;
+
+        const uint8_t *match = op - offset;
+        if (offset >= matchLen) {
+            memcpy(op, match, matchLen);
+        } else {
+            for (size_t i = 0; i < matchLen; i++) {     // overlapping: repeats the last offset bytes
+                op[i] = match[i];
+            }
+        }
+        op += matchLen;
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef LZ4_BLOCK_H
+#define LZ4_BLOCK_H
+
+#include <cstddef>
+
+// LZ4 block format (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md),
+// greedy single-pass compressor: fast rather than small, for pages of terminal output.
+// Blocks are interchangeable with LZ4_compress_default / LZ4_decompress_safe.
+
+inline size_t lz4_compress_bound(size_t len) { return len + len / 255 + 16; }
+
+// Compresses len bytes into out, which must hold lz4_compress_bound(len) bytes.
+// Returns the compressed size.
+size_t lz4_compress(const char *in, size_t len, char *out);
+
+// Decompresses a block into out, which must be exactly the original size. Returns
+// false, without reading or writing out of bounds, if the block is malformed or
+// does not produce exactly outLen bytes.
+bool lz4_decompress(const char *in, size_t len, char *out, size_t outLen);
+
+#endif // LZ4_BLOCK_H
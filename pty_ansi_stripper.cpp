@@ -0,0 +1,90 @@
+/* --------------------------------------------------------------------------------
+ #
+ #  pty_ansi_stripper.cpp
+ #  4d-plugin-pty
+ #
+ #  Incremental removal of escape sequences, for plain-text capture of terminal output
+ #
+ # --------------------------------------------------------------------------------*/
+
+#include "pty_ansi_stripper.h"
+
+#include <cstring>
+
+const size_t PtyAnsiStripper::kMaxCarry;
+
+PtyAnsiStripper::PtyAnsiStripper()
+    : m_parser(this)
+    , m_out(nullptr)
+    , m_length(0)
+    , m_heldLength(0)
+{
+}
+
+void PtyAnsiStripper::reset()
+{
+    m_parser.reset();
+    m_heldLength = 0;
+}
+
+size_t PtyAnsiStripper::strip(const char* data, size_t len, char* out)
+{
+    // The held character goes first, where a backspace can still reach it
+    memcpy(out, m_held, m_heldLength);
+    m_out = out;
+    m_length = m_heldLength;
+    m_heldLength = 0;
+    m_parser.feed(data, len);
+    m_out = nullptr;
+
+    if (m_length > 0 && out[m_length - 1] != '\n') {
+        size_t start = m_length - 1;
+        while (start > 0 && m_length - start < sizeof(m_held) && ((unsigned char)out[start] & 0xC0) == 0x80) {
+            start--;
+        }
+        m_heldLength = m_length - start;
+        memcpy(m_held, out + start, m_heldLength);
+        m_length = start;
+    }
+    return m_length;
+}
+
+size_t PtyAnsiStripper::flush(char* out)
+{
+    size_t len = m_heldLength;
+    memcpy(out, m_held, len);
+    m_heldLength = 0;
+    return len;
+}
+
+std::string PtyAnsiStripper::flush()
+{
+    std::string out(m_held, m_heldLength);
+    m_heldLength = 0;
+    return out;
+}
+
+std::string PtyAnsiStripper::strip(const std::string& data)
+{
+    std::string out(data.size() + kMaxCarry, '\0');
+    out.resize(strip(data.data(), data.size(), &out[0]));
+    return out;
+}
+
+void PtyAnsiStripper::print(const char* text, size_t len)
+{
+    memcpy(m_out + m_length, text, len);
+    m_length += len;
+}
+
+void PtyAnsiStripper::execute(unsigned char control)
+{
+    if (control == '\n' || control == '\t') {
+        m_out[m_length++] = (char)control;
+    } else if (control == '\b' && m_length > 0) {
+        // The whole previous code point, not just its last byte
+        do {
+            m_length--;
+        } while (m_length > 0 && ((unsigned char)m_out[m_length] & 0xC0) == 0x80);
+    }
+}
@@ -0,0 +1,55 @@
+/* --------------------------------------------------------------------------------
+ #
+ #  pty_ansi_stripper.h
+ #  4d-plugin-pty
+ #
+ #  Incremental removal of escape sequences, for plain-text capture of terminal output
+ #
+ # --------------------------------------------------------------------------------*/
+
+#ifndef PTY_ANSI_STRIPPER_H
+#define PTY_ANSI_STRIPPER_H
+
+#include "pty_vt_parser.h"
+
+#include <string>
+
+// Keeps the text, newlines and tabs. Drops CSI, OSC, DCS and other escape sequences,
+// CR and the other C0 controls. A backspace erases the previous character. Chunks can
+// be cut anywhere: an unfinished sequence or code point is completed by the next call,
+// and the last character of an unfinished line is held back until the next call or
+// flush(), so that a backspace at the start of the next chunk still erases it.
+class PtyAnsiStripper : private PtyVtParser::Handler {
+
+private:
+    PtyVtParser m_parser;
+    char* m_out;
+    size_t m_length;
+    char m_held[4];                 // last code point of an unfinished line
+    size_t m_heldLength;
+
+    void print(const char* text, size_t len) override;
+    void execute(unsigned char control) override;
+
+public:
+    // The output can exceed the input by the character held back by the previous call,
+    // and the bytes of a code point begun in the previous chunk.
+    static const size_t kMaxCarry = 4 + 3;
+
+    PtyAnsiStripper();
+
+    // Writes the text in data to out, which must hold len + kMaxCarry bytes, and returns
+    // its length. A backspace reaches back to the start of the line, or to the last
+    // character returned by an earlier call.
+    size_t strip(const char* data, size_t len, char* out);
+    std::string strip(const std::string& data);
+
+    // Writes the character held back, if any (at most 4 bytes), and returns its length.
+    // Once returned, it can no longer be erased.
+    size_t flush(char* out);
+    std::string flush();
+
+    void reset();
+};
+
+#endif /* PTY_ANSI_STRIPPER_H */
@@ -0,0 +1,244 @@
+/* --------------------------------------------------------------------------------
+ #
+ #  pty_event_loop.cpp
+ #  4d-plugin-pty
+ #
+ #  One I/O thread servicing the master fd of every attached PtySession
+ #
+ # --------------------------------------------------------------------------------*/
+
+#include "pty_event_loop.h"
+#include "pty_poller.h"
+#include "pty_session.h"
+
+#include <cerrno>
+#include <chrono>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+PtyEventLoop::PtyEventLoop()
+    : m_poller(PtyPoller::create())
+    , m_stop(false)
+    , m_opsQueued(0)
+    , m_opsApplied(0)
+{
+    m_wakePipe[0] = -1;
+    m_wakePipe[1] = -1;
+}
+
+PtyEventLoop::~PtyEventLoop()
+{
+    stop();
+}
+
+bool PtyEventLoop::start()
+{
+    if (m_thread.joinable()) {
+        return true;
+    }
+
+    if (pipe(m_wakePipe) == -1) {
+        return false;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(m_wakePipe[i], F_SETFL, O_NONBLOCK);
+        fcntl(m_wakePipe[i], F_SETFD, FD_CLOEXEC);
+    }
+    m_poller->add(m_wakePipe[0]);
+
+    m_stop = false;
+    m_thread = std::thread(&PtyEventLoop::run, this);
+    return true;
+}
+
+void PtyEventLoop::stop()
+{
+    if (m_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        wake();
+        m_thread.join();
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (m_wakePipe[i] >= 0) {
+            ::close(m_wakePipe[i]);
+            m_wakePipe[i] = -1;
+        }
+    }
+}
+
+void PtyEventLoop::wake()
+{
+    char dummy = 'w';
+    ::write(m_wakePipe[1], &dummy, 1);
+}
+
+// Poller changes are only ever applied on the loop thread: poll() and select()
+// backends cannot be modified while another thread is waiting on them.
+unsigned long PtyEventLoop::queueOp(Op::Kind kind, int fd)
+{
+    Op op;
+    op.kind = kind;
+    op.fd = fd;
+    m_pendingOps.push_back(op);
+    return ++m_opsQueued;
+}
+
+void PtyEventLoop::attach(PtySession* session, int masterFd)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_byFd[masterFd] = session;
+    m_byId[session->id()] = session;
+    queueOp(Op::kAdd, masterFd);
+    wake();
+}
+
+void PtyEventLoop::detach(PtySession* session, int masterFd)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    auto it = m_byFd.find(masterFd);
+    if (it == m_byFd.end() || it->second != session) {
+        return;
+    }
+    m_byFd.erase(it);
+    m_byId.erase(session->id());
+
+    // The caller closes masterFd right after we return, so wait until the loop
+    // has dropped it from the poller (the fd number could otherwise be reused).
+    unsigned long ticket = queueOp(Op::kRemove, masterFd);
+    wake();
+    m_opsCond.wait(lock, [this, ticket] { return m_opsApplied >= ticket || m_stop; });
+}
+
+void PtyEventLoop::resume(PtySession* session, int masterFd)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_byFd.find(masterFd);
+    if (it != m_byFd.end() && it->second == session) {
+        queueOp(Op::kAdd, masterFd);
+        wake();
+    }
+}
+
+bool PtyEventLoop::waitAny(const std::vector<int>& ids, int timeoutMs, std::vector<int>& ready)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    auto collect = [this, &ids, &ready] {
+        ready.clear();
+        for (int id : ids) {
+            auto it = m_byId.find(id);
+            if (it != m_byId.end() && it->second->hasBufferedOutput()) {
+                ready.push_back(id);
+            }
+        }
+        return !ready.empty() || m_stop;
+    };
+
+    if (timeoutMs < 0) {
+        m_readyCond.wait(lock, collect);
+    } else {
+        m_readyCond.wait_for(lock, std::chrono::milliseconds(timeoutMs), collect);
+    }
+
+    return !ready.empty();
+}
+
+void PtyEventLoop::run()
+{
+    std::vector<PtyPoller::Event> events(64);
+    std::vector<std::pair<int, PtySession*>> ready;
+
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_stop) break;
+
+            for (const Op& op : m_pendingOps) {
+                if (op.kind == Op::kAdd) {
+                    m_poller->add(op.fd);
+                } else {
+                    m_poller->remove(op.fd);
+                }
+            }
+            m_pendingOps.clear();
+            if (m_opsApplied != m_opsQueued) {
+                m_opsApplied = m_opsQueued;
+                m_opsCond.notify_all();
+            }
+        }
+
+        int rc = m_poller->wait(events.data(), (int)events.size(), -1);
+        if (rc < 0) {
+            if (errno == EINTR || errno == EBADF) continue;
+            break;
+        }
+
+        // Sessions are looked up under the lock but pumped without it, so that a slow
+        // read does not hold up attach(), detach() or waitAny() for the others. A session
+        // detached meanwhile is still valid: detach() returns only once the next pass
+        // applied its removal.
+        ready.clear();
+        bool woken = false;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (int i = 0; i < rc; i++) {
+                if (events[i].fd == m_wakePipe[0]) {
+                    woken = true;
+                    continue;
+                }
+                auto it = m_byFd.find(events[i].fd);
+                if (it != m_byFd.end()) {
+                    ready.push_back(*it);
+                }
+                // else detached while we were waiting; removal is pending
+            }
+        }
+
+        if (woken) {
+            char buf[64];
+            while (::read(m_wakePipe[0], buf, sizeof(buf)) > 0) {}
+        }
+
+        bool produced = false;
+
+        for (const auto& entry : ready) {
+            switch (entry.second->pump()) {
+                case PtySession::kPumpData:
+                    produced = true;
+                    break;
+                case PtySession::kPumpFull:
+                    // Stop watching until the consumer drains the ring and calls resume()
+                    m_poller->remove(entry.first);
+                    break;
+                case PtySession::kPumpClosed:
+                    m_poller->remove(entry.first);
+                    produced = true;
+                    break;
+                case PtySession::kPumpIdle:
+                    break;
+            }
+        }
+
+        if (produced) {
+            // Under the lock: a waitAny() between checking the sessions and blocking
+            // would otherwise miss the notification
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_readyCond.notify_all();
+        }
+
+        if (rc == (int)events.size()) {
+            events.resize(events.size() * 2);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_opsApplied = m_opsQueued;
+    m_opsCond.notify_all();
+    m_readyCond.notify_all();
+}
@@ -0,0 +1,69 @@
+/* --------------------------------------------------------------------------------
+ #
+ #  pty_event_loop.h
+ #  4d-plugin-pty
+ #
+ #  One I/O thread servicing the master fd of every attached PtySession
+ #
+ # --------------------------------------------------------------------------------*/
+
+#ifndef PTY_EVENT_LOOP_H
+#define PTY_EVENT_LOOP_H
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class PtyPoller;
+class PtySession;
+
+class PtyEventLoop {
+
+private:
+    struct Op {
+        enum Kind { kAdd, kRemove } kind;
+        int fd;
+    };
+
+    std::unique_ptr<PtyPoller> m_poller;
+    std::thread m_thread;
+    int m_wakePipe[2];
+    bool m_stop;
+
+    std::mutex m_mutex;
+    std::condition_variable m_readyCond;    // output arrived or a session ended
+    std::condition_variable m_opsCond;      // pending poller changes were applied
+    std::map<int, PtySession*> m_byFd;
+    std::map<int, PtySession*> m_byId;
+    std::vector<Op> m_pendingOps;
+    unsigned long m_opsQueued;
+    unsigned long m_opsApplied;
+
+    void run();
+    void wake();
+    unsigned long queueOp(Op::Kind kind, int fd);
+
+public:
+    PtyEventLoop();
+    ~PtyEventLoop();
+
+    bool start();
+    void stop();
+
+    // Called by PtySession::start()/close() for sessions in kReaderLoop mode.
+    // detach() returns only once the loop thread no longer references the session.
+    void attach(PtySession* session, int masterFd);
+    void detach(PtySession* session, int masterFd);
+
+    // Called by the consumer after it made room in a session's ring that had paused reading.
+    void resume(PtySession* session, int masterFd);
+
+    // Waits until at least one of the given sessions has buffered output (or has ended),
+    // then stores their ids in ready. Returns false on timeout. timeoutMs < 0 waits forever.
+    bool waitAny(const std::vector<int>& ids, int timeoutMs, std::vector<int>& ready);
+};
+
+#endif /* PTY_EVENT_LOOP_H */
@@ -0,0 +1,285 @@
+/* --------------------------------------------------------------------------------
+ #
+ #  pty_poller.cpp
+ #  4d-plugin-pty
+ #
+ #  Readiness backends (poll, select, epoll) used to wait on PTY file descriptors
+ #
+ # --------------------------------------------------------------------------------*/
+
+#if defined(__APPLE__)
+// Lift the FD_SETSIZE cap on select(); we size the fd sets ourselves.
+#define _DARWIN_UNLIMITED_SELECT 1
+#endif
+
+#include "pty_poller.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/select.h>
+#include <sys/time.h>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#endif
+
+#ifndef PTY_POLLER_BACKEND
+#if defined(__linux__)
+#define PTY_POLLER_BACKEND PtyPoller::kBackendEpoll
+#elif defined(__APPLE__)
+// poll() does not report readiness on tty devices on older macOS releases.
+#define PTY_POLLER_BACKEND PtyPoller::kBackendSelect
+#else
+#define PTY_POLLER_BACKEND PtyPoller::kBackendPoll
+#endif
+#endif
+
+static std::atomic<int> s_defaultBackend(PTY_POLLER_BACKEND);
+
+// wait() may run on several threads at once for the same poller (two 4D processes
+// reading one session): what the kernel writes into goes to per-thread scratch
+// buffers, never to members. add() and remove() must not overlap with a wait().
+
+#pragma mark - poll()
+
+class PollPoller : public PtyPoller {
+
+private:
+    std::vector<struct pollfd> m_fds;
+
+public:
+    bool add(int fd) override {
+        for (const struct pollfd& p : m_fds) {
+            if (p.fd == fd) return true;
+        }
+        struct pollfd p;
+        p.fd = fd;
+        p.events = POLLIN;
+        p.revents = 0;
+        m_fds.push_back(p);
+        return true;
+    }
+
+    bool remove(int fd) override {
+        for (size_t i = 0; i < m_fds.size(); i++) {
+            if (m_fds[i].fd == fd) {
+                m_fds.erase(m_fds.begin() + i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    int wait(Event* events, int maxEvents, int timeoutMs) override {
+        static thread_local std::vector<struct pollfd> fds;
+        fds.assign(m_fds.begin(), m_fds.end());
+
+        int rc = ::poll(fds.data(), (nfds_t)fds.size(), timeoutMs < 0 ? -1 : timeoutMs);
+        if (rc <= 0) return rc;
+
+        int count = 0;
+        for (size_t i = 0; i < fds.size() && count < maxEvents; i++) {
+            short revents = fds[i].revents;
+            if (revents == 0) continue;
+            events[count].fd = fds[i].fd;
+            events[count].hangup = (revents & (POLLHUP | POLLERR | POLLNVAL)) != 0;
+            events[count].readable = (revents & POLLIN) != 0 || events[count].hangup;
+            count++;
+        }
+        return count;
+    }
+
+    Backend backend() const override { return kBackendPoll; }
+};
+
+#pragma mark - select()
+
+class SelectPoller : public PtyPoller {
+
+private:
+    std::vector<int> m_fds;
+
+    static void setBit(std::vector<fd_mask>& set, int fd) {
+        set[fd / NFDBITS] |= ((fd_mask)1 << (fd % NFDBITS));
+    }
+
+    static bool isSet(const std::vector<fd_mask>& set, int fd) {
+        return (set[fd / NFDBITS] & ((fd_mask)1 << (fd % NFDBITS))) != 0;
+    }
+
+public:
+    bool add(int fd) override {
+        if (fd < 0) return false;
+        if (std::find(m_fds.begin(), m_fds.end(), fd) == m_fds.end()) {
+            m_fds.push_back(fd);
+        }
+        return true;
+    }
+
+    bool remove(int fd) override {
+        auto it = std::find(m_fds.begin(), m_fds.end(), fd);
+        if (it == m_fds.end()) return false;
+        m_fds.erase(it);
+        return true;
+    }
+
+    int wait(Event* events, int maxEvents, int timeoutMs) override {
+        int maxFd = -1;
+        for (int fd : m_fds) {
+            if (fd > maxFd) maxFd = fd;
+        }
+
+        // Size the sets for the highest fd rather than FD_SETSIZE, so fds above 1024 stay valid.
+        size_t words = (maxFd + 1 + NFDBITS - 1) / NFDBITS;
+        if (words == 0) words = 1;
+        static thread_local std::vector<fd_mask> readSet;
+        static thread_local std::vector<fd_mask> errorSet;
+        readSet.assign(words, 0);
+        errorSet.assign(words, 0);
+        for (int fd : m_fds) {
+            setBit(readSet, fd);
+            setBit(errorSet, fd);
+        }
+
+        struct timeval tv;
+        struct timeval* pTv = nullptr;
+        if (timeoutMs >= 0) {
+            tv.tv_sec  = timeoutMs / 1000;
+            tv.tv_usec = (timeoutMs % 1000) * 1000;
+            pTv = &tv;
+        }
+
+        int rc = ::select(maxFd + 1, (fd_set*)readSet.data(), nullptr, (fd_set*)errorSet.data(), pTv);
+        if (rc <= 0) return rc;
+
+        int count = 0;
+        for (size_t i = 0; i < m_fds.size() && count < maxEvents; i++) {
+            int fd = m_fds[i];
+            bool readable = isSet(readSet, fd);
+            bool error = isSet(errorSet, fd);
+            if (!readable && !error) continue;
+            events[count].fd = fd;
+            events[count].readable = true;
+            events[count].hangup = error;
+            count++;
+        }
+        return count;
+    }
+
+    Backend backend() const override { return kBackendSelect; }
+};
+
+#pragma mark - epoll()
+
+#if defined(__linux__)
+
+class EpollPoller : public PtyPoller {
+
+private:
+    int m_epollFd;
+
+public:
+    EpollPoller() : m_epollFd(epoll_create1(EPOLL_CLOEXEC)) {}
+
+    ~EpollPoller() override {
+        if (m_epollFd >= 0) {
+            ::close(m_epollFd);
+        }
+    }
+
+    bool isValid() const { return m_epollFd >= 0; }
+
+    bool add(int fd) override {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &ev) == 0) return true;
+        return errno == EEXIST;
+    }
+
+    bool remove(int fd) override {
+        struct epoll_event ev;  // non-null for kernels older than 2.6.9
+        return epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, &ev) == 0;
+    }
+
+    int wait(Event* events, int maxEvents, int timeoutMs) override {
+        if (maxEvents <= 0) return 0;
+        static thread_local std::vector<struct epoll_event> ready;
+        if ((int)ready.size() < maxEvents) {
+            ready.resize(maxEvents);
+        }
+
+        int rc = epoll_wait(m_epollFd, ready.data(), maxEvents, timeoutMs < 0 ? -1 : timeoutMs);
+        if (rc <= 0) return rc;
+
+        for (int i = 0; i < rc; i++) {
+            uint32_t flags = ready[i].events;
+            events[i].fd = ready[i].data.fd;
+            events[i].hangup = (flags & (EPOLLHUP | EPOLLERR)) != 0;
+            events[i].readable = (flags & EPOLLIN) != 0 || events[i].hangup;
+        }
+        return rc;
+    }
+
+    Backend backend() const override { return kBackendEpoll; }
+};
+
+#endif
+
+#pragma mark - Factory
+
+PtyPoller* PtyPoller::create(Backend backend)
+{
+    if (backend == kBackendDefault) {
+        backend = defaultBackend();
+    }
+
+    switch (backend) {
+        case kBackendPoll:
+            return new PollPoller();
+        case kBackendSelect:
+            return new SelectPoller();
+#if defined(__linux__)
+        case kBackendEpoll: {
+            EpollPoller* poller = new EpollPoller();
+            if (!poller->isValid()) {
+                delete poller;
+                return new PollPoller();
+            }
+            return poller;
+        }
+#endif
+        default:
+            return nullptr;
+    }
+}
+
+PtyPoller::Backend PtyPoller::defaultBackend()
+{
+    return (Backend)s_defaultBackend.load();
+}
+
+void PtyPoller::setDefaultBackend(Backend backend)
+{
+    if (backend == kBackendDefault) {
+        backend = PTY_POLLER_BACKEND;
+    }
+#if !defined(__linux__)
+    if (backend == kBackendEpoll) return;
+#endif
+    s_defaultBackend.store(backend);
+}
+
+const char* PtyPoller::backendName(Backend backend)
+{
+    switch (backend) {
+        case kBackendPoll:   return "poll";
+        case kBackendSelect: return "select";
+        case kBackendEpoll:  return "epoll";
+        default:             return "default";
+    }
+}
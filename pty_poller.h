@@ -0,0 +1,52 @@
+/* --------------------------------------------------------------------------------
+ #
+ #  pty_poller.h
+ #  4d-plugin-pty
+ #
+ #  Readiness backends (poll, select, epoll) used to wait on PTY file descriptors
+ #
+ # --------------------------------------------------------------------------------*/
+
+#ifndef PTY_POLLER_H
+#define PTY_POLLER_H
+
+#include <vector>
+
+class PtyPoller {
+
+public:
+    enum Backend {
+        kBackendDefault = 0,
+        kBackendPoll,
+        kBackendSelect,     // heap-allocated fd sets, not limited by FD_SETSIZE
+        kBackendEpoll       // Linux only
+    };
+
+    struct Event {
+        int fd;
+        bool readable;      // data available, or hangup (the next read() reports EOF/EIO)
+        bool hangup;
+    };
+
+    // Returns nullptr if the backend is not available on this platform.
+    static PtyPoller* create(Backend backend = kBackendDefault);
+
+    // Build-time default (PTY_POLLER_BACKEND), can be overridden at runtime.
+    static Backend defaultBackend();
+    static void setDefaultBackend(Backend backend);
+    static const char* backendName(Backend backend);
+
+    virtual ~PtyPoller() {}
+
+    virtual bool add(int fd) = 0;
+    virtual bool remove(int fd) = 0;
+
+    // Waits up to timeoutMs (-1 = forever) for one of the registered fds to become readable.
+    // Returns the number of events stored, 0 on timeout, -1 on error (errno is preserved).
+    // Safe to call from several threads at once; not concurrently with add() or remove().
+    virtual int wait(Event* events, int maxEvents, int timeoutMs) = 0;
+
+    virtual Backend backend() const = 0;
+};
+
+#endif /* PTY_POLLER_H */
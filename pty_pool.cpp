@@ -0,0 +1,291 @@
+/* --------------------------------------------------------------------------------
+ #
+ #  pty_pool.cpp
+ #  4d-plugin-pty
+ #
+ #  Pre-spawned shells, keyed by (shell, cwd), handed out by PTY Create
+ #
+ # --------------------------------------------------------------------------------*/
+
+#include "pty_pool.h"
+#include "pty_session.h"
+
+#include <vector>
+
+const int PtyPool::kDefaultIdleTimeoutMs;
+const int PtyPool::kRetryDelayMs;
+const unsigned PtyPool::kMaxFailures;
+const int16_t PtyPool::kPoolCols;
+const int16_t PtyPool::kPoolRows;
+
+PtyPool::PtyPool(IdAllocator nextId)
+    : m_nextId(nextId)
+    , m_stop(false)
+    , m_size(0)
+    , m_idleTimeoutMs(kDefaultIdleTimeoutMs)
+{
+    m_stats = Stats();
+}
+
+PtyPool::~PtyPool()
+{
+    stop();
+}
+
+// Called with m_mutex held.
+void PtyPool::ensureThread()
+{
+    if (!m_thread.joinable() && m_size > 0) {
+        m_stop = false;
+        m_thread = std::thread(&PtyPool::run, this);
+    }
+}
+
+// Called with m_mutex held.
+PtyPool::Entry& PtyPool::entryFor(const Key& key)
+{
+    auto it = m_entries.find(key);
+    if (it == m_entries.end()) {
+        Entry entry;
+        entry.lastUsed = Clock::now();
+        entry.retryAt = entry.lastUsed;
+        entry.failures = 0;
+        it = m_entries.insert(std::make_pair(key, entry)).first;
+    }
+    return it->second;
+}
+
+// Called with m_mutex held.
+void PtyPool::countFailure(Entry& entry)
+{
+    m_stats.failures++;
+    if (entry.failures < kMaxFailures) {
+        entry.failures++;
+        entry.retryAt = Clock::now() + std::chrono::milliseconds(kRetryDelayMs << (entry.failures - 1));
+    }
+}
+
+void PtyPool::configure(size_t size, int idleTimeoutMs)
+{
+    std::vector<PtySessionRef> closing;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_size = size;
+        m_idleTimeoutMs = (idleTimeoutMs > 0) ? idleTimeoutMs : kDefaultIdleTimeoutMs;
+
+        // Shrink right away; growing is left to the thread
+        for (auto& pair : m_entries) {
+            std::deque<PtySessionRef>& idle = pair.second.idle;
+            while (idle.size() > m_size) {
+                closing.push_back(idle.back());
+                idle.pop_back();
+                m_stats.evicted++;
+            }
+        }
+        if (m_size == 0) {
+            m_entries.clear();
+        }
+        ensureThread();
+    }
+    m_cond.notify_all();
+
+    for (PtySessionRef& session : closing) {
+        session->close();
+    }
+}
+
+void PtyPool::prewarm(const std::string& shell, const std::string& cwd)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_size == 0) return;
+        Entry& entry = entryFor(Key(shell, cwd));
+        entry.lastUsed = Clock::now();
+        entry.retryAt = entry.lastUsed;
+        entry.failures = 0;             // asked for again: try at once
+    }
+    m_cond.notify_all();
+}
+
+PtySessionRef PtyPool::acquire(const std::string& shell, const std::string& cwd)
+{
+    PtySessionRef session;
+    std::vector<PtySessionRef> dead;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_size == 0) {
+            return nullptr;
+        }
+
+        // A key given up is not kept alive by misses, so that it is retried once expired
+        Entry& entry = entryFor(Key(shell, cwd));
+        if (entry.failures < kMaxFailures) {
+            entry.lastUsed = Clock::now();
+        }
+
+        while (!entry.idle.empty() && session == nullptr) {
+            PtySessionRef candidate = entry.idle.front();
+            entry.idle.pop_front();
+            if (candidate->checkRunning()) {
+                session = candidate;
+            } else {
+                dead.push_back(candidate);     // e.g. the shell exited on its own
+                m_stats.evicted++;
+                countFailure(entry);
+            }
+        }
+
+        if (session != nullptr) {
+            entry.failures = 0;
+            m_stats.hits++;
+        } else {
+            m_stats.misses++;
+        }
+    }
+
+    // Replenish in the background
+    m_cond.notify_all();
+
+    for (PtySessionRef& d : dead) {
+        d->close();
+    }
+    return session;
+}
+
+PtyPool::Stats PtyPool::stats()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Stats stats = m_stats;
+    stats.idle = 0;
+    stats.failedKeys = 0;
+    for (auto& pair : m_entries) {
+        stats.idle += pair.second.idle.size();
+        if (pair.second.failures >= kMaxFailures) {
+            stats.failedKeys++;
+        }
+    }
+    stats.keys = m_entries.size();
+    return stats;
+}
+
+size_t PtyPool::size()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_size;
+}
+
+void PtyPool::stop()
+{
+    std::vector<PtySessionRef> closing;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+        for (auto& pair : m_entries) {
+            for (PtySessionRef& session : pair.second.idle) {
+                closing.push_back(session);
+            }
+        }
+        m_entries.clear();
+    }
+    m_cond.notify_all();
+
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    for (PtySessionRef& session : closing) {
+        session->close();
+    }
+}
+
+void PtyPool::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (!m_stop) {
+        Clock::time_point now = Clock::now();
+        std::vector<PtySessionRef> closing;
+        Key missing;
+        bool spawn = false;
+        Clock::time_point nextWake = Clock::time_point::max();     // an eviction or a retry
+
+        for (auto it = m_entries.begin(); it != m_entries.end(); ) {
+            Entry& entry = it->second;
+            Clock::time_point expiry = entry.lastUsed + std::chrono::milliseconds(m_idleTimeoutMs);
+
+            if (now >= expiry) {
+                for (PtySessionRef& session : entry.idle) {
+                    closing.push_back(session);
+                    m_stats.evicted++;
+                }
+                it = m_entries.erase(it);
+                continue;
+            }
+
+            // A shell that exited unused, e.g. one that could not be executed
+            for (auto s = entry.idle.begin(); s != entry.idle.end(); ) {
+                if ((*s)->checkRunning()) {
+                    ++s;
+                    continue;
+                }
+                closing.push_back(*s);
+                s = entry.idle.erase(s);
+                m_stats.evicted++;
+                countFailure(entry);
+            }
+
+            if (expiry < nextWake) {
+                nextWake = expiry;
+            }
+            if (!spawn && entry.failures < kMaxFailures && entry.idle.size() < m_size) {
+                if (now >= entry.retryAt) {
+                    missing = it->first;
+                    spawn = true;
+                } else if (entry.retryAt < nextWake) {
+                    nextWake = entry.retryAt;
+                }
+            }
+            ++it;
+        }
+
+        if (!closing.empty() || spawn) {
+            // Slow work happens without the lock, so acquire() never waits on a spawn
+            lock.unlock();
+            for (PtySessionRef& session : closing) {
+                session->close();
+            }
+
+            PtySessionRef session;
+            bool started = false;
+            if (spawn) {
+                session = std::make_shared<PtySession>(m_nextId());
+                started = session->start(missing.first.c_str(), kPoolCols, kPoolRows,
+                                         missing.second.empty() ? nullptr : missing.second.c_str());
+            }
+            lock.lock();
+
+            if (spawn) {
+                auto it = m_entries.find(missing);
+                if (started && it != m_entries.end() && !m_stop && it->second.idle.size() < m_size) {
+                    it->second.idle.push_back(session);
+                    m_stats.spawned++;
+                    session = nullptr;
+                } else if (!started && it != m_entries.end()) {
+                    countFailure(it->second);
+                }
+                if (session != nullptr) {
+                    // Key evicted or pool shrunk meanwhile
+                    lock.unlock();
+                    session->close();
+                    lock.lock();
+                }
+            }
+            continue;
+        }
+
+        if (nextWake == Clock::time_point::max()) {
+            m_cond.wait(lock);
+        } else {
+            m_cond.wait_until(lock, nextWake);
+        }
+    }
+}
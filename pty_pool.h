@@ -0,0 +1,100 @@
+/* --------------------------------------------------------------------------------
+ #
+ #  pty_pool.h
+ #  4d-plugin-pty
+ #
+ #  Pre-spawned shells, keyed by (shell, cwd), handed out by PTY Create
+ #
+ # --------------------------------------------------------------------------------*/
+
+#ifndef PTY_POOL_H
+#define PTY_POOL_H
+
+#include "pty_registry.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+// A background thread keeps `size` started sessions per key. A key is added by
+// prewarm() or by the first acquire() that misses; keys not acquired for
+// idleTimeoutMs are evicted together with their shells. A key whose shells fail to
+// start, or exit before being handed out, is retried after kRetryDelayMs, doubled on
+// each failure, and given up after kMaxFailures in a row: it is then left to expire,
+// and only a prewarm() tries it again before that.
+class PtyPool {
+
+public:
+    typedef std::function<int()> IdAllocator;
+
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t spawned;
+        uint64_t evicted;       // pooled shells closed unused (idle key or dead shell)
+        uint64_t failures;      // shells that did not start, or exited before being handed out
+        size_t idle;            // shells ready to be handed out
+        size_t keys;
+        size_t failedKeys;      // keys given up after kMaxFailures
+    };
+
+    static const int kDefaultIdleTimeoutMs = 10 * 60 * 1000;
+    static const int kRetryDelayMs = 250;
+    static const unsigned kMaxFailures = 5;
+
+    // Pooled shells start at this size; acquire() callers resize them.
+    static const int16_t kPoolCols = 80;
+    static const int16_t kPoolRows = 24;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    typedef std::pair<std::string, std::string> Key;    // shell, cwd
+
+    struct Entry {
+        std::deque<PtySessionRef> idle;
+        Clock::time_point lastUsed;
+        Clock::time_point retryAt;      // no spawn before, after a failure
+        unsigned failures;              // in a row; kMaxFailures: given up
+    };
+
+    IdAllocator m_nextId;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::map<Key, Entry> m_entries;
+    std::thread m_thread;
+    bool m_stop;
+    size_t m_size;
+    int m_idleTimeoutMs;
+    Stats m_stats;
+
+    void run();
+    void ensureThread();
+    Entry& entryFor(const Key& key);
+    void countFailure(Entry& entry);
+
+public:
+    explicit PtyPool(IdAllocator nextId);
+    ~PtyPool();
+
+    // size 0 disables the pool and closes every pooled shell.
+    void configure(size_t size, int idleTimeoutMs = kDefaultIdleTimeoutMs);
+    void prewarm(const std::string& shell, const std::string& cwd);
+
+    // A started session for (shell, cwd), or nullptr on a miss.
+    PtySessionRef acquire(const std::string& shell, const std::string& cwd);
+
+    Stats stats();
+    size_t size();
+
+    // Closes every pooled shell and stops the thread (plugin exit).
+    void stop();
+};
+
+#endif /* PTY_POOL_H */
@@ -0,0 +1,314 @@
+/* --------------------------------------------------------------------------------
+ #
+ #  pty_reaper.cpp
+ #  4d-plugin-pty
+ #
+ #  Background thread terminating and reaping the children of closed sessions
+ #
+ # --------------------------------------------------------------------------------*/
+
+#include "pty_reaper.h"
+#include "pty_poller.h"
+
+#include <cerrno>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#if defined(__APPLE__)
+#include <sys/event.h>
+#elif defined(__linux__)
+#include <sys/syscall.h>
+#if !defined(SYS_pidfd_open)
+#define SYS_pidfd_open 434
+#endif
+#endif
+
+const int PtyReaper::kHangupGraceMs;
+const int PtyReaper::kTerminateGraceMs;
+
+// Children whose exit cannot be notified (no pidfd / kqueue) are checked this often
+static const int kPollIntervalMs = 10;
+
+PtyReaper::PtyReaper()
+    : m_stop(false)
+    , m_kqueue(-1)
+{
+    m_wakePipe[0] = -1;
+    m_wakePipe[1] = -1;
+
+    if (pipe(m_wakePipe) == 0) {
+        for (int i = 0; i < 2; i++) {
+            fcntl(m_wakePipe[i], F_SETFL, O_NONBLOCK);
+            fcntl(m_wakePipe[i], F_SETFD, FD_CLOEXEC);
+        }
+    }
+
+#if defined(__APPLE__)
+    m_kqueue = kqueue();
+    if (m_kqueue >= 0) {
+        fcntl(m_kqueue, F_SETFD, FD_CLOEXEC);
+        struct kevent ev;
+        EV_SET(&ev, m_wakePipe[0], EVFILT_READ, EV_ADD, 0, 0, nullptr);
+        kevent(m_kqueue, &ev, 1, nullptr, 0, nullptr);
+    }
+#else
+    m_poller.reset(PtyPoller::create());
+    m_poller->add(m_wakePipe[0]);
+#endif
+}
+
+PtyReaper::~PtyReaper()
+{
+    stop();
+
+    if (m_kqueue >= 0) {
+        ::close(m_kqueue);
+    }
+    for (int i = 0; i < 2; i++) {
+        if (m_wakePipe[i] >= 0) {
+            ::close(m_wakePipe[i]);
+        }
+    }
+}
+
+PtyReaper& PtyReaper::shared()
+{
+    static PtyReaper reaper;
+    return reaper;
+}
+
+void PtyReaper::reap(pid_t pid, Callback callback)
+{
+    if (pid <= 0) {
+        return;
+    }
+
+    ::kill(pid, SIGHUP);
+
+    Child child;
+    child.pid = pid;
+    child.stage = 0;
+    child.deadline = Clock::now() + std::chrono::milliseconds(kHangupGraceMs);
+    child.watched = false;
+    child.pidfd = -1;
+    child.callback = callback;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    watchExit(child);
+    m_children.push_back(child);
+
+    if (!m_thread.joinable()) {
+        m_stop = false;
+        m_thread = std::thread(&PtyReaper::run, this);
+    } else {
+        wake();
+    }
+}
+
+size_t PtyReaper::pending()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_children.size();
+}
+
+void PtyReaper::stop()
+{
+    if (m_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        wake();
+        m_thread.join();
+    }
+
+    // Nobody is left to wait for the ladder: finish the remaining children now
+    std::vector<Child> children;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        children.swap(m_children);
+    }
+    for (Child& child : children) {
+        ::kill(child.pid, SIGKILL);
+        int status = 0;
+        pid_t result;
+        do {
+            result = waitpid(child.pid, &status, 0);
+        } while (result < 0 && errno == EINTR);
+
+        unwatchExit(child);
+        if (child.callback) {
+            int exitCode = -1;
+            if (result == child.pid) {
+                exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : -WTERMSIG(status);
+            }
+            child.callback(child.pid, exitCode);
+        }
+    }
+}
+
+void PtyReaper::wake()
+{
+    char dummy = 'w';
+    ::write(m_wakePipe[1], &dummy, 1);
+}
+
+#pragma mark - Exit notification
+
+// Called with m_mutex held.
+bool PtyReaper::watchExit(Child& child)
+{
+#if defined(__APPLE__)
+    if (m_kqueue >= 0) {
+        struct kevent ev;
+        EV_SET(&ev, child.pid, EVFILT_PROC, EV_ADD | EV_ONESHOT, NOTE_EXIT, 0, nullptr);
+        child.watched = (kevent(m_kqueue, &ev, 1, nullptr, 0, nullptr) == 0);
+    }
+#elif defined(__linux__)
+    // pidfd_open (Linux 5.3+): the fd becomes readable when the child exits
+    int fd = (int)syscall(SYS_pidfd_open, child.pid, 0);
+    if (fd >= 0) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        child.pidfd = fd;
+        child.watched = m_poller->add(fd);
+    }
+#endif
+    return child.watched;
+}
+
+void PtyReaper::unwatchExit(Child& child)
+{
+#if defined(__APPLE__)
+    if (child.watched && m_kqueue >= 0) {
+        // Usually already gone: NOTE_EXIT fired and the knote was one-shot
+        struct kevent ev;
+        EV_SET(&ev, child.pid, EVFILT_PROC, EV_DELETE, 0, 0, nullptr);
+        kevent(m_kqueue, &ev, 1, nullptr, 0, nullptr);
+    }
+#endif
+    if (child.pidfd >= 0) {
+        m_poller->remove(child.pidfd);
+        ::close(child.pidfd);
+        child.pidfd = -1;
+    }
+    child.watched = false;
+}
+
+// Blocks until a child exits, a new child is queued, or timeoutMs elapses (< 0: forever).
+int PtyReaper::waitForEvents(int timeoutMs)
+{
+    int rc;
+
+#if defined(__APPLE__)
+    struct kevent events[16];
+    struct timespec ts;
+    struct timespec* tsp = nullptr;
+    if (timeoutMs >= 0) {
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = (long)(timeoutMs % 1000) * 1000000L;
+        tsp = &ts;
+    }
+    rc = kevent(m_kqueue, nullptr, 0, events, 16, tsp);
+#else
+    PtyPoller::Event events[16];
+    rc = m_poller->wait(events, 16, timeoutMs);
+#endif
+
+    // Only the wake pipe needs draining; exited children are collected by the caller
+    char buf[64];
+    while (::read(m_wakePipe[0], buf, sizeof(buf)) > 0) {}
+    return rc;
+}
+
+#pragma mark - Thread
+
+// Called with m_mutex held.
+bool PtyReaper::collect(Child& child, int* exitCode)
+{
+    int status = 0;
+    pid_t result = waitpid(child.pid, &status, WNOHANG);
+
+    if (result == 0 || (result < 0 && errno == EINTR)) {
+        return false;
+    }
+
+    if (result == child.pid) {
+        if (WIFEXITED(status)) {
+            *exitCode = WEXITSTATUS(status);
+        } else if (WIFSIGNALED(status)) {
+            *exitCode = -WTERMSIG(status);
+        } else {
+            *exitCode = -1;
+        }
+    } else {
+        *exitCode = -1;     // ECHILD: already reaped elsewhere
+    }
+    return true;
+}
+
+void PtyReaper::run()
+{
+    for (;;) {
+        std::vector<std::pair<Child, int> > reaped;
+        int timeoutMs = -1;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_stop) break;
+
+            Clock::time_point now = Clock::now();
+
+            for (size_t i = 0; i < m_children.size(); ) {
+                Child& child = m_children[i];
+
+                int exitCode;
+                if (collect(child, &exitCode)) {
+                    unwatchExit(child);
+                    reaped.push_back(std::make_pair(child, exitCode));
+                    m_children.erase(m_children.begin() + i);
+                    continue;
+                }
+
+                // Escalate once the grace period is over
+                if (child.stage < 2 && now >= child.deadline) {
+                    if (child.stage == 0) {
+                        ::kill(child.pid, SIGTERM);
+                        child.deadline = now + std::chrono::milliseconds(kTerminateGraceMs);
+                    } else {
+                        ::kill(child.pid, SIGKILL);
+                    }
+                    child.stage++;
+                }
+
+                int childMs = -1;
+                if (child.stage < 2) {
+                    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(child.deadline - now).count();
+                    childMs = (left > 0) ? (int)left + 1 : 0;
+                }
+                if (!child.watched && (childMs < 0 || childMs > kPollIntervalMs)) {
+                    childMs = kPollIntervalMs;
+                }
+                if (childMs >= 0 && (timeoutMs < 0 || childMs < timeoutMs)) {
+                    timeoutMs = childMs;
+                }
+                i++;
+            }
+        }
+
+        // Callbacks run without the lock, so they may queue more work
+        for (auto& entry : reaped) {
+            if (entry.first.callback) {
+                entry.first.callback(entry.first.pid, entry.second);
+            }
+        }
+
+        if (!reaped.empty()) {
+            continue;   // the list changed: recompute the timeout
+        }
+
+        waitForEvents(timeoutMs);
+    }
+}
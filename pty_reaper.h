@@ -0,0 +1,81 @@
+/* --------------------------------------------------------------------------------
+ #
+ #  pty_reaper.h
+ #  4d-plugin-pty
+ #
+ #  Background thread terminating and reaping the children of closed sessions
+ #
+ # --------------------------------------------------------------------------------*/
+
+#ifndef PTY_REAPER_H
+#define PTY_REAPER_H
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+
+class PtyPoller;
+
+// Runs the SIGHUP -> SIGTERM -> SIGKILL ladder off the caller's thread. Child exits
+// are waited on with a pidfd (Linux) or kqueue EVFILT_PROC (macOS); children for
+// which neither is available are checked with waitpid(WNOHANG) every few ms.
+class PtyReaper {
+
+public:
+    // Called on the reaper thread once the child is reaped. exitCode follows
+    // PtySession::exitCode(): the exit status, or -signal if it was killed.
+    typedef std::function<void(pid_t pid, int exitCode)> Callback;
+
+    static const int kHangupGraceMs = 100;      // after SIGHUP, before SIGTERM
+    static const int kTerminateGraceMs = 100;   // after SIGTERM, before SIGKILL
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Child {
+        pid_t pid;
+        int stage;                  // 0: SIGHUP sent, 1: SIGTERM sent, 2: SIGKILL sent
+        Clock::time_point deadline;
+        bool watched;               // exit is notified through the pidfd or kqueue
+        int pidfd;                  // Linux only
+        Callback callback;
+    };
+
+    std::mutex m_mutex;
+    std::vector<Child> m_children;
+    std::thread m_thread;
+    bool m_stop;
+    int m_wakePipe[2];
+    int m_kqueue;                   // macOS
+    std::unique_ptr<PtyPoller> m_poller;    // elsewhere: wake pipe and pidfds
+
+    void run();
+    void wake();
+    bool watchExit(Child& child);
+    void unwatchExit(Child& child);
+    int waitForEvents(int timeoutMs);
+    bool collect(Child& child, int* exitCode);
+
+public:
+    PtyReaper();
+    ~PtyReaper();
+
+    // Process-wide instance used by PtySession::close(). The thread starts on first use.
+    static PtyReaper& shared();
+
+    // Sends SIGHUP to pid and returns immediately; escalation and waitpid happen
+    // on the reaper thread.
+    void reap(pid_t pid, Callback callback = nullptr);
+
+    // Children not reaped yet.
+    size_t pending();
+
+    // Kills every remaining child, waits for them and stops the thread (plugin exit).
+    void stop();
+};
+
+#endif /* PTY_REAPER_H */
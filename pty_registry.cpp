@@ -0,0 +1,79 @@
+/* --------------------------------------------------------------------------------
+ #
+ #  pty_registry.cpp
+ #  4d-plugin-pty
+ #
+ #  Session table sharded by id, so lookups on different sessions never contend
+ #
+ # --------------------------------------------------------------------------------*/
+
+#include "pty_registry.h"
+
+#include <algorithm>
+
+PtyRegistry::PtyRegistry()
+    : m_nextId(1)
+{
+}
+
+int PtyRegistry::nextId()
+{
+    return m_nextId.fetch_add(1);
+}
+
+void PtyRegistry::insert(int id, const PtySessionRef& session)
+{
+    Shard& shard = shardFor(id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.sessions[id] = session;
+}
+
+PtySessionRef PtyRegistry::find(int id)
+{
+    Shard& shard = shardFor(id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.sessions.find(id);
+    if (it != shard.sessions.end()) {
+        return it->second;
+    }
+    return nullptr;
+}
+
+PtySessionRef PtyRegistry::remove(int id)
+{
+    Shard& shard = shardFor(id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.sessions.find(id);
+    if (it == shard.sessions.end()) {
+        return nullptr;
+    }
+    PtySessionRef session = it->second;
+    shard.sessions.erase(it);
+    return session;
+}
+
+std::vector<int> PtyRegistry::ids()
+{
+    std::vector<int> result;
+    for (Shard& shard : m_shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto& pair : shard.sessions) {
+            result.push_back(pair.first);
+        }
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+std::vector<PtySessionRef> PtyRegistry::removeAll()
+{
+    std::vector<PtySessionRef> result;
+    for (Shard& shard : m_shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto& pair : shard.sessions) {
+            result.push_back(pair.second);
+        }
+        shard.sessions.clear();
+    }
+    return result;
+}
@@ -0,0 +1,58 @@
+/* --------------------------------------------------------------------------------
+ #
+ #  pty_registry.h
+ #  4d-plugin-pty
+ #
+ #  Session table sharded by id, so lookups on different sessions never contend
+ #
+ # --------------------------------------------------------------------------------*/
+
+#ifndef PTY_REGISTRY_H
+#define PTY_REGISTRY_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+class PtySession;
+
+// Commands hold their own reference while they use a session, so PTY Close can
+// run concurrently: the last reference released frees the session and its fds.
+typedef std::shared_ptr<PtySession> PtySessionRef;
+
+class PtyRegistry {
+
+public:
+    static const int kShardCount = 16;     // power of two
+
+private:
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<int, PtySessionRef> sessions;
+    };
+
+    Shard m_shards[kShardCount];
+    std::atomic<int> m_nextId;
+
+    Shard& shardFor(int id) { return m_shards[(unsigned)id & (kShardCount - 1)]; }
+
+public:
+    PtyRegistry();
+
+    // Ids start at 1 and are never reused.
+    int nextId();
+
+    void insert(int id, const PtySessionRef& session);
+    PtySessionRef find(int id);
+    // Removes the session and hands back the registry's reference (nullptr if unknown).
+    PtySessionRef remove(int id);
+
+    // Ids of all registered sessions, in ascending order.
+    std::vector<int> ids();
+    // Empties the registry, e.g. on plugin exit.
+    std::vector<PtySessionRef> removeAll();
+};
+
+#endif /* PTY_REGISTRY_H */
@@ -0,0 +1,90 @@
+/* --------------------------------------------------------------------------------
+ #
+ #  pty_ring_buffer.cpp
+ #  4d-plugin-pty
+ #
+ #  Bounded single-producer / single-consumer byte ring for buffered PTY output
+ #
+ # --------------------------------------------------------------------------------*/
+
+#include "pty_ring_buffer.h"
+
+#include <cstring>
+
+static size_t roundUpPowerOfTwo(size_t n)
+{
+    size_t p = 4096;
+    while (p < n) p <<= 1;
+    return p;
+}
+
+PtyRingBuffer::PtyRingBuffer(size_t capacity)
+    : m_data(roundUpPowerOfTwo(capacity))
+    , m_mask(m_data.size() - 1)
+    , m_head(0)
+    , m_tail(0)
+{
+}
+
+size_t PtyRingBuffer::size() const
+{
+    return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+}
+
+size_t PtyRingBuffer::space() const
+{
+    return capacity() - size();
+}
+
+char* PtyRingBuffer::writeSpan(size_t* len)
+{
+    size_t head = m_head.load(std::memory_order_relaxed);
+    size_t tail = m_tail.load(std::memory_order_acquire);
+    size_t free = capacity() - (head - tail);
+    size_t offset = head & m_mask;
+    size_t contiguous = capacity() - offset;
+
+    *len = (free < contiguous) ? free : contiguous;
+    return &m_data[offset];
+}
+
+void PtyRingBuffer::commit(size_t len)
+{
+    // seq_cst so a waiting consumer's "waiting" flag and our head update cannot both be missed
+    m_head.fetch_add(len, std::memory_order_seq_cst);
+}
+
+size_t PtyRingBuffer::write(const char* data, size_t len)
+{
+    size_t written = 0;
+    while (written < len) {
+        size_t span;
+        char* dst = writeSpan(&span);
+        if (span == 0) break;
+        size_t n = (len - written < span) ? len - written : span;
+        memcpy(dst, data + written, n);
+        commit(n);
+        written += n;
+    }
+    return written;
+}
+
+size_t PtyRingBuffer::read(char* out, size_t maxBytes)
+{
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    size_t head = m_head.load(std::memory_order_acquire);
+    size_t available = head - tail;
+    size_t n = (available < maxBytes) ? available : maxBytes;
+    if (n == 0) return 0;
+
+    size_t offset = tail & m_mask;
+    size_t first = capacity() - offset;
+    if (first > n) first = n;
+    memcpy(out, &m_data[offset], first);
+    if (n > first) {
+        memcpy(out + first, &m_data[0], n - first);
+    }
+
+    m_tail.fetch_add(n, std::memory_order_seq_cst);
+    return n;
+}
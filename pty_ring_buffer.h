@@ -0,0 +1,45 @@
+/* --------------------------------------------------------------------------------
+ #
+ #  pty_ring_buffer.h
+ #  4d-plugin-pty
+ #
+ #  Bounded single-producer / single-consumer byte ring for buffered PTY output
+ #
+ # --------------------------------------------------------------------------------*/
+
+#ifndef PTY_RING_BUFFER_H
+#define PTY_RING_BUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Lock-free as long as exactly one thread produces and one thread consumes.
+// Positions grow monotonically; the index into the storage is (position & mask).
+class PtyRingBuffer {
+
+private:
+    std::vector<char> m_data;
+    size_t m_mask;
+    std::atomic<size_t> m_head;     // next byte to write (owned by the producer)
+    std::atomic<size_t> m_tail;     // next byte to read (owned by the consumer)
+
+public:
+    // capacity is rounded up to a power of two
+    explicit PtyRingBuffer(size_t capacity);
+
+    size_t capacity() const { return m_mask + 1; }
+    size_t size() const;            // bytes ready to be read
+    size_t space() const;           // bytes that can be written
+    bool empty() const { return size() == 0; }
+
+    // Producer side: contiguous free region, filled in place (e.g. by ::read) then committed.
+    char* writeSpan(size_t* len);
+    void commit(size_t len);
+    size_t write(const char* data, size_t len);
+
+    // Consumer side: copies out up to maxBytes, returns the number of bytes copied.
+    size_t read(char* out, size_t maxBytes);
+};
+
+#endif /* PTY_RING_BUFFER_H */
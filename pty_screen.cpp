@@ -0,0 +1,764 @@
+/* --------------------------------------------------------------------------------
+ #
+ #  pty_screen.cpp
+ #  4d-plugin-pty
+ #
+ #  Headless terminal screen: the cell grid a terminal would display for the output
+ #
+ # --------------------------------------------------------------------------------*/
+
+#include "pty_screen.h"
+#include "utf8.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+const uint32_t PtyScreen::kDefaultColor;
+const uint32_t PtyScreen::kColorMask;
+const int PtyScreen::kBackgroundShift;
+const uint32_t PtyScreen::kDefaultAttrs;
+
+#pragma mark - Characters
+
+// Columns taken by a code point: 0 for combining marks and zero-width characters
+// (dropped), 2 for East Asian wide and fullwidth forms and most emoji.
+static int charWidth(uint32_t cp)
+{
+    if (cp < 0x0300) return 1;
+
+    if ((cp >= 0x0300 && cp <= 0x036F) || (cp >= 0x1AB0 && cp <= 0x1AFF) ||
+        (cp >= 0x1DC0 && cp <= 0x1DFF) || (cp >= 0x200B && cp <= 0x200F) ||
+        (cp >= 0x20D0 && cp <= 0x20FF) || (cp >= 0xFE00 && cp <= 0xFE0F) ||
+        (cp >= 0xFE20 && cp <= 0xFE2F)) {
+        return 0;
+    }
+
+    if ((cp >= 0x1100 && cp <= 0x115F) || (cp >= 0x2E80 && cp <= 0x303E) ||
+        (cp >= 0x3041 && cp <= 0x33FF) || (cp >= 0x3400 && cp <= 0x4DBF) ||
+        (cp >= 0x4E00 && cp <= 0x9FFF) || (cp >= 0xA000 && cp <= 0xA4CF) ||
+        (cp >= 0xAC00 && cp <= 0xD7A3) || (cp >= 0xF900 && cp <= 0xFAFF) ||
+        (cp >= 0xFE30 && cp <= 0xFE4F) || (cp >= 0xFF00 && cp <= 0xFF60) ||
+        (cp >= 0xFFE0 && cp <= 0xFFE6) || (cp >= 0x1F300 && cp <= 0x1F64F) ||
+        (cp >= 0x1F900 && cp <= 0x1F9FF) || (cp >= 0x20000 && cp <= 0x3FFFD)) {
+        return 2;
+    }
+
+    return 1;
+}
+
+// DEC Special Graphics, selected by ESC ( 0: what curses draws boxes and menus with
+static const uint16_t kLineDrawing[32] = {
+    0x00A0, 0x25C6, 0x2592, 0x2409, 0x240C, 0x240D, 0x240A, 0x00B0,     // _ ` a b c d e f
+    0x00B1, 0x2424, 0x240B, 0x2518, 0x2510, 0x250C, 0x2514, 0x253C,     // g h i j k l m n
+    0x23BA, 0x23BB, 0x2500, 0x23BC, 0x23BD, 0x251C, 0x2524, 0x2534,     // o p q r s t u v
+    0x252C, 0x2502, 0x2264, 0x2265, 0x03C0, 0x2260, 0x00A3, 0x00B7      // w x y z { | } ~
+};
+
+// Nearest entry of the xterm 6x6x6 color cube
+static int rgbToPalette(int r, int g, int b)
+{
+    auto level = [](int v) {
+        v = std::min(std::max(v, 0), 255);
+        return v < 48 ? 0 : v < 115 ? 1 : (v - 35) / 40;
+    };
+    return 16 + 36 * level(r) + 6 * level(g) + level(b);
+}
+
+#pragma mark - Screen
+
+PtyScreen::PtyScreen(int cols, int rows)
+    : m_parser(this)
+    , m_cols(std::max(cols, 1))
+    , m_rows(std::max(rows, 1))
+    , m_cells((size_t)m_cols * m_rows)
+    , m_lines(m_rows)
+    , m_altCells((size_t)m_cols * m_rows)
+    , m_altLines(m_rows)
+    , m_alternate(false)
+    , m_generation(1)
+    , m_rowGenerations(m_rows, 1)
+{
+    resetState();
+}
+
+void PtyScreen::feed(const char* data, size_t len)
+{
+    m_generation++;
+    m_parser.feed(data, len);
+}
+
+void PtyScreen::reset()
+{
+    m_generation++;
+    m_parser.reset();
+    resetState();
+}
+
+void PtyScreen::touchRows(int from, int to)
+{
+    std::fill(m_rowGenerations.begin() + from, m_rowGenerations.begin() + to + 1, m_generation);
+}
+
+void PtyScreen::resetState()
+{
+    if (m_alternate) {
+        m_cells.swap(m_altCells);
+        m_lines.swap(m_altLines);
+        m_alternate = false;
+    }
+
+    m_cursor.x = 0;
+    m_cursor.y = 0;
+    m_cursor.attrs = kDefaultAttrs;
+    m_cursor.wrapPending = false;
+    m_cursor.originMode = false;
+    m_cursor.charsets[0] = 'B';
+    m_cursor.charsets[1] = 'B';
+    m_cursor.shift = 0;
+    m_saved = m_cursor;
+    m_savedMain = m_cursor;
+
+    m_top = 0;
+    m_bottom = m_rows - 1;
+    m_autowrap = true;
+    m_cursorVisible = true;
+    m_lastPrinted = ' ';
+
+    Cell empty = { ' ', kDefaultAttrs };
+    std::fill(m_cells.begin(), m_cells.end(), empty);
+    std::fill(m_altCells.begin(), m_altCells.end(), empty);
+    std::iota(m_lines.begin(), m_lines.end(), 0);
+    std::iota(m_altLines.begin(), m_altLines.end(), 0);
+    touchRows(0, m_rows - 1);
+}
+
+void PtyScreen::resize(int cols, int rows)
+{
+    cols = std::max(cols, 1);
+    rows = std::max(rows, 1);
+    if (cols == m_cols && rows == m_rows) {
+        return;
+    }
+    m_generation++;
+
+    // Lines pushed off the top of the displayed screen to keep the cursor on it
+    int shift = std::max(m_cursor.y - rows + 1, 0);
+
+    // Rebuilt with the rows in order
+    auto remap = [this, cols, rows](std::vector<Cell>& cells, std::vector<int>& lines, int firstRow) {
+        Cell empty = { ' ', kDefaultAttrs };
+        std::vector<Cell> resized((size_t)cols * rows, empty);
+        int width = std::min(cols, m_cols);
+        for (int y = 0; y < rows && y + firstRow < m_rows; y++) {
+            Cell* dst = &resized[(size_t)y * cols];
+            std::copy_n(&cells[(size_t)lines[y + firstRow] * m_cols], width, dst);
+            if (dst[width - 1].attrs & kAttrWide) {
+                dst[width - 1] = { ' ', dst[width - 1].attrs & ~kAttrWide };     // its right half was cut off
+            }
+        }
+        cells.swap(resized);
+        lines.resize(rows);
+        std::iota(lines.begin(), lines.end(), 0);
+    };
+    remap(m_cells, m_lines, shift);
+    remap(m_altCells, m_altLines, 0);
+
+    m_cols = cols;
+    m_rows = rows;
+    m_top = 0;
+    m_bottom = rows - 1;
+    m_rowGenerations.assign(rows, m_generation);
+
+    m_cursor.y -= shift;
+    for (Cursor* c : { &m_cursor, &m_saved, &m_savedMain }) {
+        c->x = std::min(c->x, cols - 1);
+        c->y = std::min(c->y, rows - 1);
+        c->wrapPending = false;
+    }
+}
+
+std::string PtyScreen::rowText(int y) const
+{
+    std::string text;
+    size_t used = 0;    // up to the last non-blank character
+    const Cell* r = row(y);
+
+    for (int x = 0; x < m_cols; x++) {
+        uint32_t cp = r[x].codepoint;
+        if (cp == 0) continue;      // right half of a wide character
+        char buf[4];
+        text.append(buf, utf8_encode(cp, buf));
+        if (cp != ' ') used = text.size();
+    }
+    text.resize(used);
+    return text;
+}
+
+// Erased cells take the current background color, as in xterm
+PtyScreen::Cell PtyScreen::blank() const
+{
+    Cell cell = { ' ', kDefaultColor | (m_cursor.attrs & (kColorMask << kBackgroundShift)) };
+    return cell;
+}
+
+// About to overwrite cell x: do not leave half of a wide character behind
+void PtyScreen::splitWide(int y, int x)
+{
+    Cell* r = rowCells(y);
+    if (r[x].codepoint == 0 && x > 0) {
+        r[x - 1] = { ' ', r[x - 1].attrs & ~kAttrWide };
+        r[x] = { ' ', r[x].attrs };
+    }
+    if ((r[x].attrs & kAttrWide) && x + 1 < m_cols) {
+        r[x + 1] = { ' ', r[x].attrs & ~kAttrWide };
+        r[x].attrs &= ~kAttrWide;
+    }
+}
+
+void PtyScreen::eraseCells(int y, int from, int to)
+{
+    from = std::max(from, 0);
+    to = std::min(to, m_cols);
+    if (from >= to) return;
+
+    splitWide(y, from);
+    splitWide(y, to - 1);
+    std::fill(rowCells(y) + from, rowCells(y) + to, blank());
+}
+
+// The rows leaving the region are recycled as the blank ones entering it
+void PtyScreen::scrollUp(int top, int bottom, int count)
+{
+    count = std::min(count, bottom - top + 1);
+    if (count <= 0) return;
+
+    std::rotate(m_lines.begin() + top, m_lines.begin() + top + count, m_lines.begin() + bottom + 1);
+    touchRows(top, bottom);
+    for (int y = bottom - count + 1; y <= bottom; y++) {
+        std::fill(rowCells(y), rowCells(y) + m_cols, blank());
+    }
+}
+
+void PtyScreen::scrollDown(int top, int bottom, int count)
+{
+    count = std::min(count, bottom - top + 1);
+    if (count <= 0) return;
+
+    std::rotate(m_lines.begin() + top, m_lines.begin() + bottom + 1 - count, m_lines.begin() + bottom + 1);
+    touchRows(top, bottom);
+    for (int y = top; y < top + count; y++) {
+        std::fill(rowCells(y), rowCells(y) + m_cols, blank());
+    }
+}
+
+void PtyScreen::insertCells(int count)
+{
+    int x = m_cursor.x;
+    count = std::min(count, m_cols - x);
+    Cell* r = rowCells(m_cursor.y);
+
+    splitWide(m_cursor.y, x);
+    memmove(r + x + count, r + x, (size_t)(m_cols - x - count) * sizeof(Cell));
+    std::fill(r + x, r + x + count, blank());
+    if (r[m_cols - 1].attrs & kAttrWide) {
+        r[m_cols - 1] = blank();    // its right half was pushed off the line
+    }
+}
+
+void PtyScreen::deleteCells(int count)
+{
+    int x = m_cursor.x;
+    count = std::min(count, m_cols - x);
+    Cell* r = rowCells(m_cursor.y);
+
+    splitWide(m_cursor.y, x);
+    splitWide(m_cursor.y, x + count - 1);
+    memmove(r + x, r + x + count, (size_t)(m_cols - x - count) * sizeof(Cell));
+    std::fill(r + m_cols - count, r + m_cols, blank());
+}
+
+void PtyScreen::lineFeed()
+{
+    m_cursor.wrapPending = false;
+    if (m_cursor.y == m_bottom) {
+        scrollUp(m_top, m_bottom, 1);
+    } else if (m_cursor.y < m_rows - 1) {
+        m_cursor.y++;
+    }
+}
+
+void PtyScreen::reverseIndex()
+{
+    m_cursor.wrapPending = false;
+    if (m_cursor.y == m_top) {
+        scrollDown(m_top, m_bottom, 1);
+    } else if (m_cursor.y > 0) {
+        m_cursor.y--;
+    }
+}
+
+void PtyScreen::moveTo(int x, int y)
+{
+    int minY = 0, maxY = m_rows - 1;
+    if (m_cursor.originMode) {
+        y += m_top;
+        minY = m_top;
+        maxY = m_bottom;
+    }
+    m_cursor.x = std::min(std::max(x, 0), m_cols - 1);
+    m_cursor.y = std::min(std::max(y, minY), maxY);
+    m_cursor.wrapPending = false;
+}
+
+void PtyScreen::switchScreen(bool alternate, bool saveCursor)
+{
+    if (alternate == m_alternate) return;
+
+    if (alternate && saveCursor) {
+        m_savedMain = m_cursor;
+    }
+    m_cells.swap(m_altCells);
+    m_lines.swap(m_altLines);
+    m_alternate = alternate;
+    touchRows(0, m_rows - 1);
+
+    if (alternate) {
+        std::fill(m_cells.begin(), m_cells.end(), blank());
+    } else if (saveCursor) {
+        m_cursor = m_savedMain;
+    }
+}
+
+#pragma mark - Output
+
+void PtyScreen::putAscii(const char* text, size_t len)
+{
+    while (len > 0) {
+        if (m_cursor.wrapPending) {
+            m_cursor.x = 0;
+            lineFeed();
+        }
+
+        int x = m_cursor.x;
+        size_t n = std::min(len, (size_t)(m_cols - x));
+        Cell* r = rowCells(m_cursor.y);
+
+        splitWide(m_cursor.y, x);
+        splitWide(m_cursor.y, x + (int)n - 1);
+        uint32_t attrs = m_cursor.attrs;
+        for (size_t k = 0; k < n; k++) {
+            r[x + k].codepoint = (uint8_t)text[k];
+            r[x + k].attrs = attrs;
+        }
+        m_lastPrinted = (uint8_t)text[n - 1];
+        text += n;
+        len -= n;
+
+        x += (int)n;
+        if (x >= m_cols) {
+            // Without autowrap, the rest of the line keeps overwriting the last column
+            x = m_cols - 1;
+            m_cursor.wrapPending = m_autowrap;
+        }
+        m_cursor.x = x;
+    }
+}
+
+void PtyScreen::putChar(uint32_t cp)
+{
+    char charset = m_cursor.charsets[m_cursor.shift];
+    if (charset == '0' && cp >= 0x5F && cp <= 0x7E) {
+        cp = kLineDrawing[cp - 0x5F];
+    }
+
+    int width = charWidth(cp);
+    if (width == 0) return;
+    if (width == 2 && m_cols < 2) width = 1;
+
+    if (m_cursor.wrapPending) {
+        m_cursor.x = 0;
+        lineFeed();
+    }
+
+    if (width == 2 && m_cursor.x == m_cols - 1) {
+        if (!m_autowrap) return;
+        // Does not fit: leave the last column blank and continue on the next line
+        eraseCells(m_cursor.y, m_cursor.x, m_cols);
+        m_cursor.x = 0;
+        lineFeed();
+    }
+
+    int x = m_cursor.x;
+    Cell* r = rowCells(m_cursor.y);
+    splitWide(m_cursor.y, x);
+    if (width == 2) {
+        splitWide(m_cursor.y, x + 1);
+        r[x] = { cp, m_cursor.attrs | kAttrWide };
+        r[x + 1] = { 0, m_cursor.attrs };
+    } else {
+        r[x] = { cp, m_cursor.attrs };
+    }
+    m_lastPrinted = cp;
+
+    x += width;
+    if (x >= m_cols) {
+        x = m_cols - 1;
+        m_cursor.wrapPending = m_autowrap;
+    }
+    m_cursor.x = x;
+}
+
+void PtyScreen::print(const char* text, size_t len)
+{
+    const uint8_t* p = (const uint8_t*)text;
+    const uint8_t* end = p + len;
+
+    while (p < end) {
+        if (*p < 0x80 && m_cursor.charsets[m_cursor.shift] == 'B') {
+            const uint8_t* q = p + 1;
+            while (q < end && *q < 0x80) q++;
+            putAscii((const char*)p, (size_t)(q - p));
+            p = q;
+            continue;
+        }
+
+        size_t used;
+        uint32_t cp = utf8_decode(p, (size_t)(end - p), &used);
+        putChar(cp);
+        p += used;
+    }
+}
+
+void PtyScreen::execute(unsigned char control)
+{
+    switch (control) {
+        case '\b':
+            if (m_cursor.x > 0) m_cursor.x--;
+            m_cursor.wrapPending = false;
+            break;
+        case '\t':
+            m_cursor.x = std::min((m_cursor.x / 8 + 1) * 8, m_cols - 1);
+            m_cursor.wrapPending = false;
+            break;
+        case '\n':
+        case '\v':
+        case '\f':
+            lineFeed();
+            break;
+        case '\r':
+            m_cursor.x = 0;
+            m_cursor.wrapPending = false;
+            break;
+        case 0x0E:      // SO
+            m_cursor.shift = 1;
+            break;
+        case 0x0F:      // SI
+            m_cursor.shift = 0;
+            break;
+    }
+}
+
+void PtyScreen::escDispatch(const PtyVtParser& parser, char final)
+{
+    char leader = parser.leader();
+
+    if (leader == '(' || leader == ')') {
+        m_cursor.charsets[leader == '(' ? 0 : 1] = (final == '0') ? '0' : 'B';
+        return;
+    }
+    if (leader == '#') {
+        if (final == '8') {     // DECALN: screen filled with 'E'
+            Cell e = { 'E', kDefaultAttrs };
+            std::fill(m_cells.begin(), m_cells.end(), e);
+            touchRows(0, m_rows - 1);
+        }
+        return;
+    }
+    if (leader != 0) return;
+
+    switch (final) {
+        case '7':
+            m_saved = m_cursor;
+            break;
+        case '8':
+            m_cursor = m_saved;
+            break;
+        case 'D':
+            lineFeed();
+            break;
+        case 'E':
+            m_cursor.x = 0;
+            lineFeed();
+            break;
+        case 'M':
+            reverseIndex();
+            break;
+        case 'c':
+            resetState();
+            break;
+    }
+}
+
+#pragma mark - Control sequences
+
+void PtyScreen::setMode(const PtyVtParser& parser, bool enable)
+{
+    for (int i = 0; i < parser.paramCount(); i++) {
+        switch (parser.param(i)) {
+            case 6:
+                m_cursor.originMode = enable;
+                moveTo(0, 0);
+                break;
+            case 7:
+                m_autowrap = enable;
+                if (!enable) m_cursor.wrapPending = false;
+                break;
+            case 25:
+                m_cursorVisible = enable;
+                break;
+            case 47:
+            case 1047:
+                switchScreen(enable, false);
+                break;
+            case 1049:
+                switchScreen(enable, true);
+                break;
+        }
+    }
+}
+
+void PtyScreen::selectGraphicRendition(const PtyVtParser& parser)
+{
+    uint32_t& attrs = m_cursor.attrs;
+    int count = parser.paramCount();
+    if (count == 0) {
+        attrs = kDefaultAttrs;
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        int p = parser.param(i);
+        int next = i + 1;
+
+        if (p == 38 || p == 48) {
+            int color = -1;
+            if (parser.isSubparam(next)) {
+                // 38:5:n, 38:2:r:g:b or 38:2:colorspace:r:g:b
+                int group[6] = { 0 };
+                int n = 0;
+                while (parser.isSubparam(next)) {
+                    if (n < 6) group[n++] = parser.param(next);
+                    next++;
+                }
+                if (group[0] == 5 && n >= 2) color = group[1];
+                if (group[0] == 2 && n >= 5) color = rgbToPalette(group[2], group[3], group[4]);
+                else if (group[0] == 2 && n == 4) color = rgbToPalette(group[1], group[2], group[3]);
+            } else if (parser.param(next) == 5) {
+                color = parser.param(next + 1);
+                next += 2;
+            } else if (parser.param(next) == 2) {
+                color = rgbToPalette(parser.param(next + 1), parser.param(next + 2), parser.param(next + 3));
+                next += 4;
+            }
+            if (color >= 0 && color < 256) {
+                if (p == 38) attrs = (attrs & ~kColorMask) | (uint32_t)color;
+                else attrs = (attrs & ~(kColorMask << kBackgroundShift)) | ((uint32_t)color << kBackgroundShift);
+            }
+            i = next - 1;
+            continue;
+        }
+
+        switch (p) {
+            case 0:  attrs = kDefaultAttrs; break;
+            case 1:  attrs |= kAttrBold; break;
+            case 2:  attrs |= kAttrDim; break;
+            case 3:  attrs |= kAttrItalic; break;
+            case 4:
+                // 4:0 turns underline off, 4:1-4:5 are underline styles
+                if (parser.isSubparam(next) && parser.param(next) == 0) attrs &= ~kAttrUnderline;
+                else attrs |= kAttrUnderline;
+                break;
+            case 5:
+            case 6:  attrs |= kAttrBlink; break;
+            case 7:  attrs |= kAttrInverse; break;
+            case 8:  attrs |= kAttrHidden; break;
+            case 9:  attrs |= kAttrStrike; break;
+            case 21: attrs |= kAttrUnderline; break;
+            case 22: attrs &= ~(kAttrBold | kAttrDim); break;
+            case 23: attrs &= ~kAttrItalic; break;
+            case 24: attrs &= ~kAttrUnderline; break;
+            case 25: attrs &= ~kAttrBlink; break;
+            case 27: attrs &= ~kAttrInverse; break;
+            case 28: attrs &= ~kAttrHidden; break;
+            case 29: attrs &= ~kAttrStrike; break;
+            case 39: attrs = (attrs & ~kColorMask) | kDefaultColor; break;
+            case 49: attrs = (attrs & ~(kColorMask << kBackgroundShift)) | (kDefaultColor << kBackgroundShift); break;
+            default:
+                if (p >= 30 && p <= 37) attrs = (attrs & ~kColorMask) | (uint32_t)(p - 30);
+                else if (p >= 90 && p <= 97) attrs = (attrs & ~kColorMask) | (uint32_t)(p - 90 + 8);
+                else if (p >= 40 && p <= 47) attrs = (attrs & ~(kColorMask << kBackgroundShift)) | ((uint32_t)(p - 40) << kBackgroundShift);
+                else if (p >= 100 && p <= 107) attrs = (attrs & ~(kColorMask << kBackgroundShift)) | ((uint32_t)(p - 100 + 8) << kBackgroundShift);
+                break;
+        }
+
+        while (parser.isSubparam(i + 1)) i++;
+    }
+}
+
+void PtyScreen::csiDispatch(const PtyVtParser& parser, char final)
+{
+    char leader = parser.leader();
+
+    if (parser.intermediateCount() > 0) {
+        if (leader == '?' && parser.intermediateCount() == 1 && (final == 'h' || final == 'l')) {
+            setMode(parser, final == 'h');
+        } else if (leader == '!' && final == 'p') {
+            // DECSTR: soft reset, the content stays
+            m_autowrap = true;
+            m_cursorVisible = true;
+            m_cursor.originMode = false;
+            m_cursor.attrs = kDefaultAttrs;
+            m_cursor.charsets[0] = m_cursor.charsets[1] = 'B';
+            m_cursor.shift = 0;
+            m_top = 0;
+            m_bottom = m_rows - 1;
+            m_saved = m_cursor;
+        }
+        return;     // other private sequences (DA, cursor style, keyboard modes...) change nothing on screen
+    }
+
+    // Most sequences treat a missing or zero count as 1
+    int n = std::max(parser.param(0, 1), 1);
+    int& x = m_cursor.x;
+    int& y = m_cursor.y;
+
+    switch (final) {
+        case '@':
+            insertCells(n);
+            m_cursor.wrapPending = false;
+            break;
+        case 'A':
+            y = std::max(y - n, y >= m_top ? m_top : 0);
+            m_cursor.wrapPending = false;
+            break;
+        case 'B':
+        case 'e':
+            y = std::min(y + n, y <= m_bottom ? m_bottom : m_rows - 1);
+            m_cursor.wrapPending = false;
+            break;
+        case 'C':
+        case 'a':
+            x = std::min(x + n, m_cols - 1);
+            m_cursor.wrapPending = false;
+            break;
+        case 'D':
+            x = std::max(x - n, 0);
+            m_cursor.wrapPending = false;
+            break;
+        case 'E':
+            y = std::min(y + n, y <= m_bottom ? m_bottom : m_rows - 1);
+            x = 0;
+            m_cursor.wrapPending = false;
+            break;
+        case 'F':
+            y = std::max(y - n, y >= m_top ? m_top : 0);
+            x = 0;
+            m_cursor.wrapPending = false;
+            break;
+        case 'G':
+        case '`':
+            x = std::min(n, m_cols) - 1;
+            m_cursor.wrapPending = false;
+            break;
+        case 'H':
+        case 'f':
+            moveTo(std::max(parser.param(1, 1), 1) - 1, n - 1);
+            break;
+        case 'd':
+            moveTo(x, n - 1);
+            break;
+        case 'I':
+            for (int i = 0; i < n && x < m_cols - 1; i++) x = std::min((x / 8 + 1) * 8, m_cols - 1);
+            m_cursor.wrapPending = false;
+            break;
+        case 'Z':
+            for (int i = 0; i < n && x > 0; i++) x = (x - 1) / 8 * 8;
+            m_cursor.wrapPending = false;
+            break;
+        case 'J':
+            switch (parser.param(0)) {
+                case 0:
+                    eraseCells(y, x, m_cols);
+                    for (int r = y + 1; r < m_rows; r++) eraseCells(r, 0, m_cols);
+                    break;
+                case 1:
+                    for (int r = 0; r < y; r++) eraseCells(r, 0, m_cols);
+                    eraseCells(y, 0, x + 1);
+                    break;
+                case 2:
+                    for (int r = 0; r < m_rows; r++) eraseCells(r, 0, m_cols);
+                    break;
+            }
+            break;
+        case 'K':
+            switch (parser.param(0)) {
+                case 0: eraseCells(y, x, m_cols); break;
+                case 1: eraseCells(y, 0, x + 1); break;
+                case 2: eraseCells(y, 0, m_cols); break;
+            }
+            break;
+        case 'L':
+            if (y >= m_top && y <= m_bottom) {
+                scrollDown(y, m_bottom, n);
+                x = 0;
+                m_cursor.wrapPending = false;
+            }
+            break;
+        case 'M':
+            if (y >= m_top && y <= m_bottom) {
+                scrollUp(y, m_bottom, n);
+                x = 0;
+                m_cursor.wrapPending = false;
+            }
+            break;
+        case 'P':
+            deleteCells(n);
+            m_cursor.wrapPending = false;
+            break;
+        case 'X':
+            eraseCells(y, x, x + n);
+            m_cursor.wrapPending = false;
+            break;
+        case 'S':
+            scrollUp(m_top, m_bottom, n);
+            break;
+        case 'T':
+            if (parser.paramCount() <= 1) scrollDown(m_top, m_bottom, n);   // 5 parameters: mouse tracking
+            break;
+        case 'b':
+            for (int i = 0, count = std::min(n, m_cols * m_rows); i < count; i++) putChar(m_lastPrinted);
+            break;
+        case 'm':
+            selectGraphicRendition(parser);
+            break;
+        case 'r': {
+            int top = std::max(parser.param(0, 1), 1) - 1;
+            int bottom = parser.param(1);
+            if (bottom <= 0 || bottom > m_rows) bottom = m_rows;
+            bottom--;
+            if (top < bottom) {
+                m_top = top;
+                m_bottom = bottom;
+                moveTo(0, 0);
+            }
+            break;
+        }
+        case 's':
+            m_saved = m_cursor;
+            break;
+        case 'u':
+            m_cursor = m_saved;
+            break;
+    }
+}
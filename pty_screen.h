@@ -0,0 +1,146 @@
+/* --------------------------------------------------------------------------------
+ #
+ #  pty_screen.h
+ #  4d-plugin-pty
+ #
+ #  Headless terminal screen: the cell grid a terminal would display for the output
+ #
+ # --------------------------------------------------------------------------------*/
+
+#ifndef PTY_SCREEN_H
+#define PTY_SCREEN_H
+
+#include "pty_vt_parser.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Interprets the output through PtyVtParser the way xterm would for what matters to read
+// a screen back: cursor movement, erase, insert/delete, scroll regions, SGR attributes,
+// autowrap, the alternate screen and DEC line drawing. Replies (DSR, DA) and mouse modes
+// are not implemented. Not thread-safe: PtySession serialises feed() and the readers.
+class PtyScreen : private PtyVtParser::Handler {
+
+public:
+    // 8 bytes per cell, in a single array. Rows are reached through a table of row
+    // indexes, so scrolling rotates the table instead of moving cells.
+    struct Cell {
+        uint32_t codepoint;     // ' ' when blank; 0 for the right half of a wide character
+        uint32_t attrs;
+    };
+
+    // attrs: foreground (bits 0-8) and background (bits 9-17) palette indexes, 256 meaning
+    // the default color; 24-bit colors are mapped to the nearest entry of the 256-color
+    // palette. The flags take the bits above.
+    static const uint32_t kDefaultColor = 256;
+    static const uint32_t kColorMask = 0x1FF;
+    static const int kBackgroundShift = 9;
+    static const uint32_t kAttrBold      = 1u << 18;
+    static const uint32_t kAttrDim       = 1u << 19;
+    static const uint32_t kAttrItalic    = 1u << 20;
+    static const uint32_t kAttrUnderline = 1u << 21;
+    static const uint32_t kAttrBlink     = 1u << 22;
+    static const uint32_t kAttrInverse   = 1u << 23;
+    static const uint32_t kAttrHidden    = 1u << 24;
+    static const uint32_t kAttrStrike    = 1u << 25;
+    static const uint32_t kAttrWide      = 1u << 26;    // left half of a double-width character
+    static const uint32_t kDefaultAttrs = kDefaultColor | (kDefaultColor << kBackgroundShift);
+
+    static uint32_t foreground(uint32_t attrs) { return attrs & kColorMask; }
+    static uint32_t background(uint32_t attrs) { return (attrs >> kBackgroundShift) & kColorMask; }
+
+private:
+    struct Cursor {
+        int x;
+        int y;
+        uint32_t attrs;
+        bool wrapPending;       // at the last column after printing there: wrap on the next character
+        bool originMode;
+        char charsets[2];       // G0, G1: 'B' (ASCII) or '0' (DEC line drawing)
+        int shift;              // 0: G0 selected (SI), 1: G1 (SO)
+    };
+
+    PtyVtParser m_parser;
+    int m_cols;
+    int m_rows;
+    std::vector<Cell> m_cells;
+    std::vector<int> m_lines;           // row y is at m_cells[m_lines[y] * m_cols]
+    std::vector<Cell> m_altCells;       // the other screen: alternate while on the main one and conversely
+    std::vector<int> m_altLines;
+    bool m_alternate;
+
+    // Change tracking: each displayed row keeps the generation it was last written in
+    uint64_t m_generation;
+    std::vector<uint64_t> m_rowGenerations;
+
+    Cursor m_cursor;
+    Cursor m_saved;                     // DECSC / DECRC
+    Cursor m_savedMain;                 // mode 1049
+    int m_top;                          // scroll region, inclusive
+    int m_bottom;
+    bool m_autowrap;
+    bool m_cursorVisible;
+    uint32_t m_lastPrinted;             // for REP
+
+    // PtyVtParser::Handler
+    void print(const char* text, size_t len) override;
+    void execute(unsigned char control) override;
+    void csiDispatch(const PtyVtParser& parser, char final) override;
+    void escDispatch(const PtyVtParser& parser, char final) override;
+
+    // For writing: marks the row as changed
+    Cell* rowCells(int y) {
+        m_rowGenerations[y] = m_generation;
+        return &m_cells[(size_t)m_lines[y] * m_cols];
+    }
+    void touchRows(int from, int to);           // [from, to]
+    Cell blank() const;
+    void putChar(uint32_t codepoint);
+    void putAscii(const char* text, size_t len);
+    void lineFeed();
+    void reverseIndex();
+    void moveTo(int x, int y);                  // y relative to the scroll region in origin mode
+    void eraseCells(int y, int from, int to);   // [from, to)
+    void splitWide(int y, int x);
+    void scrollUp(int top, int bottom, int count);
+    void scrollDown(int top, int bottom, int count);
+    void insertCells(int count);
+    void deleteCells(int count);
+    void setMode(const PtyVtParser& parser, bool enable);
+    void selectGraphicRendition(const PtyVtParser& parser);
+    void switchScreen(bool alternate, bool saveCursor);
+    void resetState();
+
+public:
+    PtyScreen(int cols, int rows);
+
+    void feed(const char* data, size_t len);
+
+    // Keeps the content at the top left. When rows shrink below the cursor, the top
+    // lines are dropped instead so that the cursor line stays on screen.
+    void resize(int cols, int rows);
+    // RIS: blank screen, default modes.
+    void reset();
+
+    int cols() const { return m_cols; }
+    int rows() const { return m_rows; }
+    int cursorX() const { return m_cursor.x; }
+    int cursorY() const { return m_cursor.y; }
+    bool cursorVisible() const { return m_cursorVisible; }
+    bool alternateScreen() const { return m_alternate; }
+
+    // Increases with each feed(), resize() and reset(), so that rowChanged() tells
+    // what to redraw since an earlier call. Starts at 1.
+    uint64_t generation() const { return m_generation; }
+    // Row y was written after generation() returned sinceGeneration (0: always true).
+    // Scrolling counts as a change for every row of the region.
+    bool rowChanged(int y, uint64_t sinceGeneration) const { return m_rowGenerations[y] > sinceGeneration; }
+
+    // The m_cols cells of row y
+    const Cell* row(int y) const { return &m_cells[(size_t)m_lines[y] * m_cols]; }
+    // The characters of row y in UTF-8, trailing blanks removed.
+    std::string rowText(int y) const;
+};
+
+#endif /* PTY_SCREEN_H */
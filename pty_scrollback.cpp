@@ -0,0 +1,181 @@
+/* --------------------------------------------------------------------------------
+ #
+ #  pty_scrollback.cpp
+ #  4d-plugin-pty
+ #
+ #  Bounded store of output lines, older pages compressed
+ #
+ # --------------------------------------------------------------------------------*/
+
+#include "pty_scrollback.h"
+#include "lz4_block.h"
+#include "utf8.h"
+
+#include <algorithm>
+#include <cstring>
+
+const size_t PtyScrollback::kPageSize;
+const size_t PtyScrollback::kHotPages;
+const size_t PtyScrollback::kMaxLineLength;
+
+static const uint64_t kNoPage = UINT64_MAX;
+
+size_t PtyScrollback::Page::memory() const
+{
+    return sizeof(Page) + text.capacity() + ends.capacity() * sizeof(uint32_t) + compressed.capacity();
+}
+
+PtyScrollback::PtyScrollback(size_t budgetBytes)
+    : m_budget(budgetBytes)
+    , m_lineCount(0)
+    , m_coldMemory(0)
+    , m_cacheFirstLine(kNoPage)
+{
+    m_pages.emplace_back();
+    m_pages.back().firstLine = 0;
+    m_pages.back().lineCount = 0;
+    m_pages.back().size = 0;
+    m_pages.back().text.reserve(kPageSize);
+}
+
+#pragma mark - Writing
+
+void PtyScrollback::append(const char* text, size_t len)
+{
+    while (len > 0) {
+        Page& page = m_pages.back();
+        size_t lineStart = page.ends.empty() ? 0 : page.ends.back();
+        size_t room = kMaxLineLength - (page.text.size() - lineStart);
+
+        const char* newline = (const char*)memchr(text, '\n', std::min(len, room));
+        if (newline) {
+            size_t n = (size_t)(newline - text) + 1;
+            page.text.append(text, n);
+            text += n;
+            len -= n;
+        } else if (len < room) {
+            page.text.append(text, len);     // the line goes on in the next output
+            return;
+        } else {
+            // Too long: ended here, between two code points where possible
+            size_t n = utf8_complete_length(text, room);
+            if (n == 0) n = room;
+            page.text.append(text, n);
+            page.text += '\n';
+            text += n;
+            len -= n;
+        }
+        endLine();
+    }
+}
+
+void PtyScrollback::endLine()
+{
+    Page& page = m_pages.back();
+    page.ends.push_back((uint32_t)page.text.size());
+    page.lineCount++;
+    m_lineCount++;
+
+    if (page.text.size() >= kPageSize) {
+        closePage();
+    }
+}
+
+void PtyScrollback::closePage()
+{
+    m_pages.back().size = (uint32_t)m_pages.back().text.size();
+
+    m_pages.emplace_back();
+    Page& page = m_pages.back();
+    page.firstLine = m_lineCount;
+    page.lineCount = 0;
+    page.size = 0;
+    page.text.reserve(kPageSize);
+
+    if (m_pages.size() > kHotPages) {
+        compress(m_pages[m_pages.size() - 1 - kHotPages]);
+    }
+    dropOldPages();
+}
+
+void PtyScrollback::compress(Page& page)
+{
+    size_t bound = lz4_compress_bound(page.text.size());
+    if (m_compressBuffer.size() < bound) {
+        m_compressBuffer.resize(bound);
+    }
+    size_t n = lz4_compress(page.text.data(), page.text.size(), m_compressBuffer.data());
+
+    page.compressed.assign(m_compressBuffer.data(), m_compressBuffer.data() + n);
+    std::string().swap(page.text);
+    std::vector<uint32_t>().swap(page.ends);
+    m_coldMemory += page.memory();
+}
+
+// The hot pages are kept even when they alone exceed the budget
+void PtyScrollback::dropOldPages()
+{
+    while (m_pages.size() > kHotPages && memoryUsage() > m_budget) {
+        m_coldMemory -= m_pages.front().memory();
+        m_pages.pop_front();
+    }
+}
+
+size_t PtyScrollback::memoryUsage() const
+{
+    size_t total = m_coldMemory;
+    size_t hot = std::min(m_pages.size(), kHotPages);
+    for (size_t i = m_pages.size() - hot; i < m_pages.size(); i++) {
+        total += m_pages[i].memory();
+    }
+    return total;
+}
+
+#pragma mark - Reading
+
+const PtyScrollback::Page* PtyScrollback::findPage(uint64_t number) const
+{
+    if (number < firstLine() || number >= m_lineCount) {
+        return nullptr;
+    }
+    // The last page starting at or before the line
+    auto it = std::upper_bound(m_pages.begin(), m_pages.end(), number,
+                               [](uint64_t n, const Page& page) { return n < page.firstLine; });
+    return &*(it - 1);
+}
+
+bool PtyScrollback::line(uint64_t number, std::string& text)
+{
+    const Page* page = findPage(number);
+    if (page == nullptr) {
+        return false;
+    }
+
+    const char* data = page->text.data();
+    const uint32_t* ends = page->ends.data();
+
+    if (!page->compressed.empty()) {
+        if (m_cacheFirstLine != page->firstLine) {
+            m_cacheFirstLine = kNoPage;
+            m_cacheText.resize(page->size);
+            if (!lz4_decompress(page->compressed.data(), page->compressed.size(), &m_cacheText[0], page->size)) {
+                return false;
+            }
+            m_cacheEnds.clear();
+            for (const char* p = m_cacheText.data(), *end = p + m_cacheText.size(); p < end; ) {
+                const char* newline = (const char*)memchr(p, '\n', (size_t)(end - p));
+                if (newline == nullptr) return false;
+                p = newline + 1;
+                m_cacheEnds.push_back((uint32_t)(p - m_cacheText.data()));
+            }
+            m_cacheFirstLine = page->firstLine;
+        }
+        data = m_cacheText.data();
+        ends = m_cacheEnds.data();
+    }
+
+    size_t index = (size_t)(number - page->firstLine);
+    size_t start = (index == 0) ? 0 : ends[index - 1];
+    text.assign(data + start, ends[index] - 1 - start);
+    return true;
+}
@@ -0,0 +1,81 @@
+/* --------------------------------------------------------------------------------
+ #
+ #  pty_scrollback.h
+ #  4d-plugin-pty
+ #
+ #  Bounded store of output lines, older pages compressed
+ #
+ # --------------------------------------------------------------------------------*/
+
+#ifndef PTY_SCROLLBACK_H
+#define PTY_SCROLLBACK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+// Lines are numbered from 0 in the order they ended, and keep their number when the
+// oldest ones are dropped to stay within the memory budget. They are stored in pages
+// of about kPageSize bytes: the newest kHotPages as plain text, the older ones
+// compressed (LZ4 block format). Reading a line of a compressed page decompresses the
+// whole page once, and keeps it for the next lines. Not thread-safe.
+class PtyScrollback {
+
+public:
+    static const size_t kPageSize = 64 * 1024;
+    static const size_t kHotPages = 2;              // the page being filled and the one before
+    static const size_t kMaxLineLength = kPageSize; // longer lines are split
+
+private:
+    struct Page {
+        uint64_t firstLine;
+        uint32_t lineCount;
+        uint32_t size;                      // bytes of text, once compressed
+        std::string text;                   // hot: the lines, each ended by '\n'
+        std::vector<uint32_t> ends;         // hot: offset past the '\n' of each line
+        std::vector<char> compressed;       // cold
+
+        size_t memory() const;
+    };
+
+    size_t m_budget;
+    std::deque<Page> m_pages;               // oldest first, never empty: the last one is being filled
+    uint64_t m_lineCount;
+    size_t m_coldMemory;                    // memory() of the compressed pages
+
+    std::vector<char> m_compressBuffer;
+
+    // Text of the compressed page read last
+    uint64_t m_cacheFirstLine;              // UINT64_MAX: none
+    std::string m_cacheText;
+    std::vector<uint32_t> m_cacheEnds;
+
+    void endLine();
+    void closePage();
+    void compress(Page& page);
+    void dropOldPages();
+    const Page* findPage(uint64_t number) const;
+
+public:
+    explicit PtyScrollback(size_t budgetBytes);
+
+    // Output text, split into lines on '\n'. A line not ended yet is kept apart until
+    // it is, and is not counted.
+    void append(const char* text, size_t len);
+
+    // Lines [firstLine(), lineCount()) can be read
+    uint64_t firstLine() const { return m_pages.front().firstLine; }
+    uint64_t lineCount() const { return m_lineCount; }
+
+    // Without the '\n'. False if the line was dropped or has not ended yet.
+    bool line(uint64_t number, std::string& text);
+
+    // Bytes held by the pages, compared with the budget. Reads add up to one
+    // decompressed page.
+    size_t memoryUsage() const;
+    size_t budget() const { return m_budget; }
+};
+
+#endif /* PTY_SCROLLBACK_H */
@@ -8,22 +8,56 @@
  # --------------------------------------------------------------------------------*/
 
 #include "pty_session.h"
-
+#include "pty_ansi_stripper.h"
+#include "pty_poller.h"
+#include "pty_ring_buffer.h"
+#include "pty_screen.h"
+#include "pty_scrollback.h"
+#include "pty_event_loop.h"
+#include "pty_reaper.h"
+#include "pty_zygote.h"
+#include "utf8.h"
+
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <cerrno>
+#include <vector>
 
 #include <unistd.h>
 #include <fcntl.h>
 #include <termios.h>
 #include <sys/ioctl.h>
-#include <sys/select.h>
-#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <signal.h>
 
 #if defined(__APPLE__)
 #include <util.h>
+#include <crt_externs.h>
+#define environ (*_NSGetEnviron())
+#else
+extern char** environ;
+#endif
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#elif defined(__APPLE__)
+#include <libproc.h>
+#endif
+
+// posix_spawn can only give the child a controlling terminal where the new session
+// is created before the file actions run (glibc), and can only close the inherited
+// descriptors with addclosefrom_np (glibc 2.34). Elsewhere the shell is started with vfork.
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+#include <spawn.h>
+#define PTY_SPAWN_POSIX_SPAWN 1
+#endif
+
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0      // SO_NOSIGPIPE is set on the stdin socket instead (macOS)
 #endif
 
 PtySession::PtySession(int id)
@@ -34,8 +68,33 @@ PtySession::PtySession(int id)
     , m_cols(80)
     , m_rows(24)
     , m_running(false)
-    , m_exitCode(-1)
+    , m_exitCode(std::make_shared<std::atomic<int> >(-1))
+    , m_closed(false)
+    , m_spawnMethod(kSpawnDefault)
+    , m_controlFd(-1)
+    , m_ioMode(kIoTerminal)
+    , m_stdinFd(-1)
+    , m_stderrFd(-1)
+    , m_rawMode(false)
+    , m_vmin(1)
+    , m_vtime(0)
+    , m_poller(PtyPoller::create())
+    , m_readerMode(kReaderSync)
+    , m_ringSize(kDefaultRingSize)
+    , m_loop(nullptr)
+    , m_consumerWaiting(false)
+    , m_producerWaiting(false)
+    , m_readerDone(false)
+    , m_stopReader(false)
+    , m_coalesceMs(0)
+    , m_coalesceBytes(kDefaultCoalesceBytes)
+    , m_returnOnFirstData(true)
+    , m_screenEnabled(false)
 {
+    for (int i = 0; i < 3; i++) {
+        m_childStdio[i] = -1;
+    }
+
     if (pipe(m_interruptPipe) == -1) {
         m_interruptPipe[0] = -1;
         m_interruptPipe[1] = -1;
@@ -43,12 +102,23 @@ PtySession::PtySession(int id)
         // Set pipe ends to non-blocking
         fcntl(m_interruptPipe[0], F_SETFL, O_NONBLOCK);
         fcntl(m_interruptPipe[1], F_SETFL, O_NONBLOCK);
+        fcntl(m_interruptPipe[0], F_SETFD, FD_CLOEXEC);
+        fcntl(m_interruptPipe[1], F_SETFD, FD_CLOEXEC);
+        m_poller->add(m_interruptPipe[0]);
     }
 }
 
 PtySession::~PtySession()
 {
     close();
+    releaseFds();
+}
+
+void PtySession::setReaderMode(ReaderMode mode, size_t bufferSize, PtyEventLoop* loop)
+{
+    m_readerMode = (mode == kReaderLoop && loop == nullptr) ? kReaderThread : mode;
+    m_ringSize = (bufferSize > 0) ? bufferSize : kDefaultRingSize;
+    m_loop = (m_readerMode == kReaderLoop) ? loop : nullptr;
 }
 
 bool PtySession::configurePty()
@@ -91,6 +161,14 @@ bool PtySession::configurePty()
     ttmode.c_cc[VSTATUS]  = 20;     // Ctrl-T
 #endif
 
+    if (m_rawMode) {
+        // Byte-transparent in both directions: no line editing or length limit, no
+        // signal characters, no echo, no \n to \r\n rewriting
+        cfmakeraw(&ttmode);
+        ttmode.c_cc[VMIN]  = (cc_t)m_vmin;
+        ttmode.c_cc[VTIME] = (cc_t)m_vtime;
+    }
+
     cfsetispeed(&ttmode, B38400);
     cfsetospeed(&ttmode, B38400);
 
@@ -103,11 +181,385 @@ bool PtySession::configurePty()
     return true;
 }
 
-bool PtySession::start(const char* shellPath, int16_t cols, int16_t rows, const char* cwd)
+// Variables every shell starts with, on top of the plugin process environment
+static const char* const kSessionEnv[][2] = {
+    { "TERM",         "xterm-256color" },
+    { "COLORTERM",    "truecolor" },
+    { "LANG",         "en_US.UTF-8" },
+    { "LC_ALL",       "en_US.UTF-8" },
+    { "LC_CTYPE",     "UTF-8" },
+    { "COMMAND_MODE", "unix2003" },
+};
+
+static const size_t kSessionEnvCount = sizeof(kSessionEnv) / sizeof(kSessionEnv[0]);
+
+// The child must not call setenv() after vfork/posix_spawn, so the environment
+// is assembled in the parent. storage owns the strings envp points to. A caller
+// supplied env replaces the default environment entirely.
+static void buildEnvironment(std::vector<std::string>& storage, std::vector<char*>& envp,
+                             const std::vector<std::string>* env = nullptr)
 {
-    m_cols = cols;
-    m_rows = rows;
+    storage.clear();
+    if (env != nullptr) {
+        storage = *env;
+    } else {
+        for (char** e = environ; e != nullptr && *e != nullptr; e++) {
+            bool overridden = false;
+            for (size_t i = 0; i < kSessionEnvCount && !overridden; i++) {
+                size_t len = strlen(kSessionEnv[i][0]);
+                overridden = (strncmp(*e, kSessionEnv[i][0], len) == 0 && (*e)[len] == '=');
+            }
+            if (!overridden) {
+                storage.push_back(*e);
+            }
+        }
+        for (size_t i = 0; i < kSessionEnvCount; i++) {
+            storage.push_back(std::string(kSessionEnv[i][0]) + "=" + kSessionEnv[i][1]);
+        }
+    }
+
+    envp.clear();
+    for (std::string& entry : storage) {
+        envp.push_back(&entry[0]);
+    }
+    envp.push_back(nullptr);
+}
+
+// execvp() semantics, resolved in the parent: a bare name is searched in the PATH
+// of the environment the child will get.
+static std::string resolveExecutable(const char* path, const std::vector<char*>& envp)
+{
+    if (strchr(path, '/') != nullptr || path[0] == '\0') {
+        return path;
+    }
+
+    const char* search = "/usr/bin:/bin";
+    for (char* entry : envp) {
+        if (entry != nullptr && strncmp(entry, "PATH=", 5) == 0) {
+            search = entry + 5;
+            break;
+        }
+    }
+
+    const char* dir = search;
+    for (;;) {
+        const char* end = strchr(dir, ':');
+        size_t len = (end != nullptr) ? (size_t)(end - dir) : strlen(dir);
+        std::string candidate = (len > 0) ? std::string(dir, len) : std::string(".");
+        candidate += '/';
+        candidate += path;
+        if (access(candidate.c_str(), X_OK) == 0) {
+            return candidate;
+        }
+        if (end == nullptr) break;
+        dir = end + 1;
+    }
+    return path;    // exec fails with ENOENT and the child exits with 127
+}
+
+typedef std::chrono::steady_clock Clock;
+
+// Milliseconds left until t, rounded up so that a wait never ends just short of it.
+static int msUntil(Clock::time_point t)
+{
+    auto left = std::chrono::duration_cast<std::chrono::microseconds>(t - Clock::now()).count();
+    return (left > 0) ? (int)((left + 999) / 1000) : 0;
+}
+
+// Same rule as the fork path, where a failed chdir() is ignored: only change
+// directory when it is going to work.
+static bool usableDirectory(const char* cwd)
+{
+    struct stat st;
+    return cwd != nullptr && cwd[0] != '\0' && stat(cwd, &st) == 0 && S_ISDIR(st.st_mode) && access(cwd, X_OK) == 0;
+}
+
+// Closes every descriptor >= lowFd. Runs in the child between fork/vfork and exec,
+// so it only makes system calls: no opendir(), no allocation.
+void PtySession::closeFrom(int lowFd)
+{
+#if defined(__linux__)
+#if defined(SYS_close_range)
+    if (syscall(SYS_close_range, (unsigned int)lowFd, ~0U, 0) == 0) {
+        return;
+    }
+#endif
+    // Kernels before 5.9: list /proc/self/fd with getdents64 into a stack buffer
+    int dir = open("/proc/self/fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir >= 0) {
+        struct Dirent64 {
+            uint64_t d_ino;
+            int64_t d_off;
+            unsigned short d_reclen;
+            unsigned char d_type;
+            char d_name[1];
+        };
+        char buf[4096];
+        bool closedAny;
+        do {
+            // Closing descriptors changes the listing: rescan until nothing is left
+            closedAny = false;
+            lseek(dir, 0, SEEK_SET);
+            long n;
+            while ((n = syscall(SYS_getdents64, dir, buf, sizeof(buf))) > 0) {
+                for (long off = 0; off < n; ) {
+                    const Dirent64* entry = (const Dirent64*)(buf + off);
+                    off += entry->d_reclen;
+                    int fd = 0;
+                    const char* c = entry->d_name;
+                    if (*c < '0' || *c > '9') continue;
+                    for (; *c >= '0' && *c <= '9'; c++) fd = fd * 10 + (*c - '0');
+                    if (fd >= lowFd && fd != dir) {
+                        ::close(fd);
+                        closedAny = true;
+                    }
+                }
+            }
+        } while (closedAny);
+        ::close(dir);
+        return;
+    }
+#elif defined(__APPLE__)
+    // PROC_PIDLISTFDS is a single system call into a caller buffer, fine after vfork.
+    // Walking the table up to _SC_OPEN_MAX would cost millions of close() calls with
+    // a raised descriptor limit.
+    struct proc_fdinfo fds[512];
+    const int capacity = (int)(sizeof(fds) / sizeof(fds[0]));
+    int count;
+    bool closedAny;
+    int size;
+    do {
+        // A full buffer may have left descriptors out: list again once those are closed.
+        // Guarded descriptors refuse close(), so stop when nothing more goes.
+        closedAny = false;
+        size = proc_pidinfo(getpid(), PROC_PIDLISTFDS, 0, fds, (int)sizeof(fds));
+        count = (size > 0) ? size / (int)sizeof(fds[0]) : 0;
+        for (int i = 0; i < count; i++) {
+            if (fds[i].proc_fd >= lowFd && ::close(fds[i].proc_fd) == 0) {
+                closedAny = true;
+            }
+        }
+    } while (count == capacity && closedAny);
+    if (size > 0) {
+        return;
+    }
+#endif
+    // Listing /dev/fd needs opendir(): walk the descriptor table instead
+    long maxFd = sysconf(_SC_OPEN_MAX);
+    if (maxFd < 0 || maxFd > 65536) maxFd = 65536;
+    for (int fd = lowFd; fd < (int)maxFd; fd++) {
+        ::close(fd);
+    }
+}
+
+void PtySession::setSpawnMethod(SpawnMethod method)
+{
+    m_spawnMethod = method;
+}
+
+void PtySession::setIoMode(IoMode mode)
+{
+    m_ioMode = mode;
+}
+
+void PtySession::setCoalescing(int windowMs, size_t maxBytes)
+{
+    m_coalesceMs = (windowMs > 0) ? windowMs : 0;
+    m_coalesceBytes = (maxBytes > 0) ? maxBytes : kDefaultCoalesceBytes;
+}
+
+void PtySession::setReturnOnFirstData(bool returnOnFirstData)
+{
+    m_returnOnFirstData = returnOnFirstData;
+}
+
+void PtySession::setStripAnsi(bool strip)
+{
+    for (int i = 0; i < 2; i++) {
+        m_stripper[i].reset(strip ? new PtyAnsiStripper() : nullptr);
+    }
+}
+
+void PtySession::setScreen(bool enable)
+{
+    m_screenEnabled = enable;
+}
+
+bool PtySession::withScreen(const std::function<void(const PtyScreen&)>& visit)
+{
+    std::lock_guard<std::mutex> lock(m_screenMutex);
+    if (!m_screen) {
+        return false;
+    }
+    visit(*m_screen);
+    return true;
+}
+
+void PtySession::setScrollback(size_t budgetBytes)
+{
+    std::lock_guard<std::mutex> lock(m_scrollbackMutex);
+    m_scrollback.reset(budgetBytes > 0 ? new PtyScrollback(budgetBytes) : nullptr);
+    m_scrollbackStripper.reset(budgetBytes > 0 ? new PtyAnsiStripper() : nullptr);
+}
+
+bool PtySession::withScrollback(const std::function<void(PtyScrollback&)>& visit)
+{
+    std::lock_guard<std::mutex> lock(m_scrollbackMutex);
+    if (!m_scrollback) {
+        return false;
+    }
+    visit(*m_scrollback);
+    return true;
+}
+
+void PtySession::setRawMode(bool raw, int vmin, int vtime)
+{
+    m_rawMode = raw;
+    m_vmin = (int16_t)((vmin < 0) ? 0 : (vmin > 255) ? 255 : vmin);
+    m_vtime = (int16_t)((vtime < 0) ? 0 : (vtime > 255) ? 255 : vtime);
+}
+
+// fork() copies the page tables of the whole 4D process: its cost grows with server memory.
+pid_t PtySession::forkChild(const char* path, char* const argv[], char* const envp[], const char* cwd)
+{
+    pid_t pid = fork();
+    if (pid < 0) {
+        m_lastError = std::string("fork failed: ") + strerror(errno);
+        return -1;
+    }
+
+    if (pid == 0) {
+        // === Child process ===
+
+        // Close master in child
+        ::close(m_masterFd);
+
+        // Create new session
+        setsid();
+
+        if (m_ioMode == kIoTerminal) {
+            // Set controlling terminal
+            ioctl(m_slaveFd, TIOCSCTTY, 0);
 
+            // Redirect stdio to slave
+            dup2(m_slaveFd, STDIN_FILENO);
+            dup2(m_slaveFd, STDOUT_FILENO);
+            dup2(m_slaveFd, STDERR_FILENO);
+        } else {
+            for (int i = 0; i < 3; i++) {
+                dup2(m_childStdio[i], i);
+            }
+        }
+
+        // Drop the slave (already duped) and every descriptor inherited from
+        // the 4D server that is not close-on-exec: files, sockets, other terminals
+        closeFrom(STDERR_FILENO + 1);
+
+        // Set foreground process group
+        if (m_ioMode == kIoTerminal) {
+            pid_t sid = getpid();
+            tcsetpgrp(STDIN_FILENO, sid);
+        }
+
+        // Change directory if provided
+        if (cwd != nullptr && cwd[0] != '\0') {
+            chdir(cwd);
+        }
+
+        // Execute the program with the environment prepared by the parent
+        execve(path, argv, envp);
+
+        // If exec fails
+        _exit(127);
+    }
+
+    return pid;
+}
+
+// Starts the program without duplicating the parent's address space. Master and slave
+// fds are close-on-exec, so the child only keeps the slave (or, in kIoPipes mode,
+// its ends of the pipes) as stdin/stdout/stderr.
+pid_t PtySession::spawnChild(const char* path, const char* slavePath, char* const argv[], char* const envp[], const char* cwd)
+{
+    bool changeDir = usableDirectory(cwd);
+    pid_t pid = -1;
+
+#if defined(PTY_SPAWN_POSIX_SPAWN)
+    // glibc runs setsid() before the file actions, so opening the slave without
+    // O_NOCTTY makes it the controlling terminal of the new session.
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t signals;
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    sigfillset(&signals);
+    posix_spawnattr_setsigdefault(&attr, &signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (m_ioMode == kIoTerminal) {
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, slavePath, O_RDWR, 0);
+        posix_spawn_file_actions_adddup2(&actions, STDIN_FILENO, STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, STDIN_FILENO, STDERR_FILENO);
+    } else {
+        for (int i = 0; i < 3; i++) {
+            posix_spawn_file_actions_adddup2(&actions, m_childStdio[i], i);
+        }
+    }
+    posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1);
+    if (changeDir) {
+        posix_spawn_file_actions_addchdir_np(&actions, cwd);
+    }
+
+    int rc = posix_spawn(&pid, path, &actions, &attr, argv, envp);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (rc != 0) {
+        m_lastError = std::string("posix_spawn failed: ") + strerror(rc);
+        return -1;
+    }
+#else
+    // No way to acquire the controlling terminal through posix_spawn here (file
+    // actions may run before POSIX_SPAWN_SETSID): use vfork, whose child only
+    // makes system calls on memory prepared above before exec'ing.
+    bool terminal = (m_ioMode == kIoTerminal);
+    int stdio[3];
+    for (int i = 0; i < 3; i++) {
+        stdio[i] = terminal ? m_slaveFd : m_childStdio[i];
+    }
+    pid = vfork();
+    if (pid < 0) {
+        m_lastError = std::string("vfork failed: ") + strerror(errno);
+        return -1;
+    }
+
+    if (pid == 0) {
+        setsid();
+        if (terminal) {
+            ioctl(stdio[0], TIOCSCTTY, 0);
+        }
+        for (int i = 0; i < 3; i++) {
+            dup2(stdio[i], i);
+        }
+        closeFrom(STDERR_FILENO + 1);
+        if (terminal) {
+            tcsetpgrp(STDIN_FILENO, getpid());
+        }
+        if (changeDir) {
+            chdir(cwd);
+        }
+        execve(path, argv, envp);
+        _exit(127);
+    }
+#endif
+
+    return pid;
+}
+
+bool PtySession::openPty(std::string& slavePath)
+{
     // Open master PTY
     m_masterFd = posix_openpt(O_RDWR | O_NOCTTY);
     if (m_masterFd < 0) {
@@ -118,13 +570,11 @@ bool PtySession::start(const char* shellPath, int16_t cols, int16_t rows, const
     // Grant and unlock slave
     if (grantpt(m_masterFd) != 0) {
         m_lastError = std::string("grantpt failed: ") + strerror(errno);
-        close();
         return false;
     }
 
     if (unlockpt(m_masterFd) != 0) {
         m_lastError = std::string("unlockpt failed: ") + strerror(errno);
-        close();
         return false;
     }
 
@@ -132,15 +582,14 @@ bool PtySession::start(const char* shellPath, int16_t cols, int16_t rows, const
     const char* slaveName = ptsname(m_masterFd);
     if (slaveName == nullptr) {
         m_lastError = std::string("ptsname failed: ") + strerror(errno);
-        close();
         return false;
     }
+    slavePath = slaveName;      // ptsname() uses a static buffer
 
     // Open slave
     m_slaveFd = ::open(slaveName, O_RDWR | O_NOCTTY);
     if (m_slaveFd < 0) {
         m_lastError = std::string("open slave failed: ") + strerror(errno);
-        close();
         return false;
     }
 
@@ -149,70 +598,128 @@ bool PtySession::start(const char* shellPath, int16_t cols, int16_t rows, const
     fcntl(m_slaveFd, F_SETFD, FD_CLOEXEC);
 
     // Configure terminal
-    if (!configurePty()) {
-        close();
+    return configurePty();
+}
+
+// stdout and stderr are pipes; stdin is a socket so that writing to a child that
+// exited fails with EPIPE instead of raising SIGPIPE in the 4D server.
+bool PtySession::openPipes()
+{
+    int in[2], out[2], err[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, in) != 0) {
+        m_lastError = std::string("socketpair failed: ") + strerror(errno);
         return false;
     }
+    m_stdinFd = in[0];
+    m_childStdio[0] = in[1];
 
-    // Fork
-    pid_t pid = fork();
-    if (pid < 0) {
-        m_lastError = std::string("fork failed: ") + strerror(errno);
-        close();
+    if (pipe(out) != 0) {
+        m_lastError = std::string("pipe failed: ") + strerror(errno);
         return false;
     }
+    m_masterFd = out[0];
+    m_childStdio[1] = out[1];
 
-    if (pid == 0) {
-        // === Child process ===
-
-        // Close master in child
-        ::close(m_masterFd);
+    if (pipe(err) != 0) {
+        m_lastError = std::string("pipe failed: ") + strerror(errno);
+        return false;
+    }
+    m_stderrFd = err[0];
+    m_childStdio[2] = err[1];
 
-        // Create new session
-        setsid();
+    for (int fd : { in[0], in[1], out[0], out[1], err[0], err[1] }) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+#if defined(SO_NOSIGPIPE)
+    int on = 1;
+    setsockopt(m_stdinFd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    return true;
+}
 
-        // Set controlling terminal
-        ioctl(m_slaveFd, TIOCSCTTY, 0);
+void PtySession::closeChildStdio()
+{
+    if (m_slaveFd >= 0) {
+        ::close(m_slaveFd);
+        m_slaveFd = -1;
+    }
+    for (int i = 0; i < 3; i++) {
+        if (m_childStdio[i] >= 0) {
+            ::close(m_childStdio[i]);
+            m_childStdio[i] = -1;
+        }
+    }
+}
 
-        // Redirect stdio to slave
-        dup2(m_slaveFd, STDIN_FILENO);
-        dup2(m_slaveFd, STDOUT_FILENO);
-        dup2(m_slaveFd, STDERR_FILENO);
+bool PtySession::start(const char* shellPath, int16_t cols, int16_t rows, const char* cwd)
+{
+    return startProcess(shellPath, std::vector<std::string>(), nullptr, cols, rows, cwd);
+}
 
-        // Close slave fd (already duped)
-        if (m_slaveFd > STDERR_FILENO) {
-            ::close(m_slaveFd);
-        }
+bool PtySession::startProcess(const char* path, const std::vector<std::string>& argv,
+                              const std::vector<std::string>* env, int16_t cols, int16_t rows,
+                              const char* cwd)
+{
+    m_cols = cols;
+    m_rows = rows;
 
-        // Set foreground process group
-        pid_t sid = getpid();
-        tcsetpgrp(STDIN_FILENO, sid);
+    if (m_screenEnabled && m_ioMode == kIoTerminal) {
+        m_screen.reset(new PtyScreen(cols, rows));
+    }
 
-        // Set environment
-        setenv("TERM", "xterm-256color", 1);
-        setenv("COLORTERM", "truecolor", 1);
-        setenv("LANG", "en_US.UTF-8", 1);
-        setenv("LC_ALL", "en_US.UTF-8", 1);
-        setenv("LC_CTYPE", "UTF-8", 1);
-        setenv("COMMAND_MODE", "unix2003", 1);
+    pid_t pid;
 
-        // Change directory if provided
-        if (cwd != nullptr && cwd[0] != '\0') {
-            chdir(cwd);
+    if (m_spawnMethod == kSpawnZygote) {
+        // The helper opens the PTY and starts the program; only the master fd comes back
+        pid = PtyZygote::shared().spawn(this, path, argv, env, cwd);
+        if (pid < 0) {
+            close();
+            return false;
+        }
+    } else {
+        std::string slavePath;
+        bool opened = (m_ioMode == kIoPipes) ? openPipes() : openPty(slavePath);
+        if (!opened) {
+            close();
+            return false;
         }
 
-        // Execute shell
-        execl(shellPath, shellPath, (char*)nullptr);
+        // Everything the child needs is prepared here: after vfork it may not allocate
+        std::vector<std::string> envStorage;
+        std::vector<char*> envp;
+        buildEnvironment(envStorage, envp, env);
 
-        // If exec fails
-        _exit(127);
-    }
+        std::string file = resolveExecutable(path, envp);
+        std::vector<std::string> argStorage(argv);
+        if (argStorage.empty()) {
+            argStorage.push_back(path);
+        }
+        std::vector<char*> args;
+        for (std::string& arg : argStorage) {
+            args.push_back(&arg[0]);
+        }
+        args.push_back(nullptr);
+
+        // Launch the program on the slave side
+        pid = (m_spawnMethod == kSpawnFork) ? forkChild(file.c_str(), args.data(), envp.data(), cwd)
+                                            : spawnChild(file.c_str(), slavePath.c_str(), args.data(), envp.data(), cwd);
+        if (pid < 0) {
+            close();
+            return false;
+        }
 
-    // === Parent process ===
+        // Close slave in parent
+        closeChildStdio();
+    }
 
-    // Close slave in parent
-    ::close(m_slaveFd);
-    m_slaveFd = -1;
+    m_poller->add(m_masterFd);
+    if (m_stderrFd >= 0) {
+        m_stderrPoller.reset(PtyPoller::create());
+        m_stderrPoller->add(m_stderrFd);
+        if (m_interruptPipe[0] >= 0) {
+            m_stderrPoller->add(m_interruptPipe[0]);
+        }
+    }
 
     m_pid = pid;
     m_running = true;
@@ -220,106 +727,421 @@ bool PtySession::start(const char* shellPath, int16_t cols, int16_t rows, const
     // Set window size
     resize(cols, rows);
 
+    if (m_readerMode == kReaderThread) {
+        m_ring.reset(new PtyRingBuffer(m_ringSize));
+        m_readerThread = std::thread(&PtySession::readerLoop, this);
+    } else if (m_readerMode == kReaderLoop) {
+        m_ring.reset(new PtyRingBuffer(m_ringSize));
+        m_loop->attach(this, m_masterFd);
+    }
+
     return true;
 }
 
 ssize_t PtySession::write(const char* data, size_t len)
 {
-    if (m_masterFd < 0 || !m_running) {
+    if (m_masterFd < 0 || !m_running || m_closed) {
         return -1;
     }
+    std::lock_guard<std::mutex> lock(m_writeMutex);
+    if (m_ioMode == kIoPipes) {
+        return (m_stdinFd >= 0) ? send(m_stdinFd, data, len, MSG_NOSIGNAL) : -1;
+    }
     return ::write(m_masterFd, data, len);
 }
 
-std::string PtySession::read(size_t maxBytes, int timeoutMs)
+bool PtySession::closeInput()
 {
-    if (m_masterFd < 0) {
-        return "";
+    std::lock_guard<std::mutex> lock(m_writeMutex);
+    if (m_ioMode != kIoPipes || m_stdinFd < 0 || m_closed) {
+        return false;
     }
+    // shutdown() rather than close(): a concurrent status check may still use the fd number
+    return shutdown(m_stdinFd, SHUT_WR) == 0;
+}
 
-    if (maxBytes > 65536) maxBytes = 65536;
-    
-    // Use a pre-sized string to avoid heap allocation per read and redundant appends
-    std::string result;
-    result.resize(maxBytes);
-    size_t totalRead = 0;
-
-    // Calculate deadline
-    struct timeval deadline;
-    gettimeofday(&deadline, nullptr);
-    deadline.tv_sec  += timeoutMs / 1000;
-    deadline.tv_usec += (timeoutMs % 1000) * 1000;
-    if (deadline.tv_usec >= 1000000) {
-        deadline.tv_sec  += 1;
-        deadline.tv_usec -= 1000000;
+size_t PtySession::read(char* buf, size_t maxBytes, int timeoutMs, Stream stream)
+{
+    if (m_masterFd < 0 || m_closed) {
+        return 0;
     }
 
-    bool firstIteration = true;
+    if (maxBytes > kMaxReadSize) maxBytes = kMaxReadSize;
 
-    while (totalRead < maxBytes) {
+    if (stream == kStderr) {
+        return (m_stderrPoller) ? readDirect(m_stderrFd, m_stderrPoller.get(), buf, maxBytes, timeoutMs) : 0;
+    }
 
-        struct timeval tv;
-        struct timeval* pTv = &tv;
-
-        if (firstIteration && timeoutMs < 0) {
-            // First iteration: wait infinitely
-            // Because the command is threadSafe: true, this fully suspends the 
-            // preemptive OS worker thread without taking any CPU time gracefully.
-            pTv = nullptr;
-            firstIteration = false;
-        } else if (firstIteration) {
-            // First iteration: use the full timeout directly
-            tv.tv_sec  = timeoutMs / 1000;
-            tv.tv_usec = (timeoutMs % 1000) * 1000;
-            firstIteration = false;
+    std::unique_lock<std::timed_mutex> readLock(m_readMutex, std::defer_lock);
+    if (m_ring || m_screen || m_scrollback) {
+        if (timeoutMs < 0) {
+            readLock.lock();
         } else {
-            // Subsequent iterations: once we have read some data, we should not block 
-            // waiting for more. Only check if more is IMMEDIATELY available in the buffer.
-            tv.tv_sec  = 0;
-            tv.tv_usec = 0;
+            Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+            if (!readLock.try_lock_until(deadline)) {
+                return 0;
+            }
+            if (timeoutMs > 0) timeoutMs = msUntil(deadline);
         }
+    }
 
-        fd_set readfds;
-        FD_ZERO(&readfds);
-        FD_SET(m_masterFd, &readfds);
-        
-        int maxFd = m_masterFd;
-        if (m_interruptPipe[0] >= 0) {
-            FD_SET(m_interruptPipe[0], &readfds);
-            if (m_interruptPipe[0] > maxFd) {
-                maxFd = m_interruptPipe[0];
-            }
+    size_t n = m_ring ? readBuffered(buf, maxBytes, timeoutMs)
+                      : readDirect(m_masterFd, m_poller.get(), buf, maxBytes, timeoutMs);
+
+    if (n > 0 && m_screen) {
+        std::lock_guard<std::mutex> lock(m_screenMutex);
+        m_screen->feed(buf, n);
+    }
+    if (n > 0 && m_scrollback) {
+        appendScrollback(buf, n);
+    }
+    return n;
+}
+
+void PtySession::appendScrollback(const char* data, size_t len)
+{
+    static thread_local std::vector<char> text;
+    if (text.size() < len + PtyAnsiStripper::kMaxCarry) {
+        text.resize(len + PtyAnsiStripper::kMaxCarry);
+    }
+
+    std::lock_guard<std::mutex> lock(m_scrollbackMutex);
+    size_t textLen = m_scrollbackStripper->strip(data, len, text.data());
+    m_scrollback->append(text.data(), textLen);
+}
+
+// Scratch space for the std::string overloads, reused by every read on this thread:
+// only the bytes received are copied into the returned string.
+static char* readScratch(size_t size)
+{
+    static thread_local std::vector<char> scratch;
+    if (scratch.size() < size) {
+        scratch.resize(size);
+    }
+    return scratch.data();
+}
+
+std::string PtySession::read(size_t maxBytes, int timeoutMs, Stream stream)
+{
+    if (maxBytes > kMaxReadSize) maxBytes = kMaxReadSize;
+    char* buf = readScratch(maxBytes);
+    size_t n = read(buf, maxBytes, timeoutMs, stream);
+    return std::string(buf, n);
+}
+
+// Waits on fd through poller, which also watches the interrupt pipe.
+size_t PtySession::readDirect(int fd, PtyPoller* poller, char* buf, size_t maxBytes, int timeoutMs)
+{
+    size_t totalRead = 0;
+
+    // Deadline on the monotonic clock (steady_clock is CLOCK_MONOTONIC): wall-clock
+    // adjustments neither cut a read short nor stretch it
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeoutMs > 0 ? timeoutMs : 0);
+
+    // Gathering: keep reading until maxBytes or the deadline, not just what is
+    // already buffered once the first byte arrived
+    bool gather = !m_returnOnFirstData && timeoutMs != 0;
+
+    // Coalescing: after the first byte, keep reading until the window closes or
+    // enough bytes arrived, so that a burst of small writes is returned at once
+    bool coalesce = (m_coalesceMs > 0) && !gather;
+    size_t coalesceTarget = std::min(maxBytes, m_coalesceBytes);
+    Clock::time_point windowEnd;
+
+    while (totalRead < maxBytes) {
+
+        int waitMs;
+
+        if (totalRead == 0 || gather) {
+            // Nothing yet, or gathering: wait up to the deadline. With timeoutMs < 0 this
+            // fully suspends the preemptive worker thread (the command is threadSafe)
+            // without taking any CPU time.
+            waitMs = (timeoutMs < 0) ? -1 : msUntil(deadline);
+        } else if (coalesce) {
+            waitMs = msUntil(windowEnd);
+            if (waitMs == 0) break;
+        } else {
+            // Once we have read some data, we should not block waiting for more.
+            // Only check if more is IMMEDIATELY available in the buffer.
+            waitMs = 0;
         }
 
-        int rc = select(maxFd + 1, &readfds, nullptr, nullptr, pTv);
+        // poll()/epoll() are not bound by FD_SETSIZE: the 4D server routinely has
+        // more than 1024 open descriptors, where FD_SET on an fd_set is undefined.
+        PtyPoller::Event events[2];
+        int rc = poller->wait(events, 2, waitMs);
         if (rc < 0) {
-            if (errno == EINTR) continue;
+            if (errno == EINTR) continue;   // waits again for what is left of the deadline
             break;   // real error
         }
-        
-        if (m_interruptPipe[0] >= 0 && FD_ISSET(m_interruptPipe[0], &readfds)) {
+
+        bool masterReady = false;
+        bool interrupted = false;
+        for (int i = 0; i < rc; i++) {
+            if (events[i].fd == m_interruptPipe[0]) {
+                interrupted = true;
+            } else if (events[i].fd == fd && events[i].readable) {
+                masterReady = true;
+            }
+        }
+
+        if (interrupted) {
             // We were interrupted via the self-pipe (e.g., session closed)
             break;
         }
-        
-        if (rc == 0) break;  // timeout — no more data immediately available
+
+        if (!masterReady) break;  // timeout — no more data immediately available
 
         size_t toRead = maxBytes - totalRead;
-        ssize_t n = ::read(m_masterFd, &result[totalRead], toRead);
+        ssize_t n = ::read(fd, buf + totalRead, toRead);
         if (n <= 0) break;   // EOF or error
 
+        if (coalesce && totalRead == 0) {
+            windowEnd = Clock::now() + std::chrono::milliseconds(m_coalesceMs);
+        }
         totalRead += n;
-        
+
+        if (gather) {
+            continue;
+        }
+        if (coalesce) {
+            if (totalRead >= coalesceTarget) break;
+            continue;
+        }
+
         // If read() gave us less than we asked for, the kernel buffer is empty.
-        // We can safely return what we have without doing another select() loop.
-        if (n < toRead) {
+        // We can safely return what we have without doing another wait.
+        if ((size_t)n < toRead) {
+            break;
+        }
+    }
+
+    return totalRead;
+}
+
+size_t PtySession::readText(char* buf, size_t maxBytes, int timeoutMs, Stream stream)
+{
+    int index = (stream == kStderr) ? 1 : 0;
+    if (m_stripper[index]) {
+        // The stripper completes split code points itself (kMaxCarry == kTextExtraMax)
+        return readStripped(*m_stripper[index], buf, maxBytes, timeoutMs, stream);
+    }
+
+    std::string& carry = m_utf8Carry[index];
+    size_t len = carry.size();
+    memcpy(buf, carry.data(), len);
+    carry.clear();
+
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeoutMs > 0 ? timeoutMs : 0);
+
+    for (;;) {
+        // len never exceeds kUtf8CarryMax here: buf holds maxBytes + kUtf8CarryMax
+        size_t n = read(buf + len, maxBytes, timeoutMs, stream);
+        if (n == 0) {
+            // Nothing more is coming from an ended process: flush the partial sequence as is
+            if (!m_running) return len;
+            break;
+        }
+        len += n;
+
+        size_t complete = utf8_complete_length(buf, len);
+        if (complete > 0) {
+            carry.assign(buf + complete, len - complete);
+            return complete;
+        }
+        // Only the start of a code point so far; its tail is normally already queued.
+        // The whole call still waits no longer than timeoutMs.
+        if (timeoutMs > 0) {
+            timeoutMs = msUntil(deadline);
+            if (timeoutMs == 0) break;
+        }
+    }
+
+    carry.assign(buf, len);
+    return 0;
+}
+
+size_t PtySession::readStripped(PtyAnsiStripper& stripper, char* buf, size_t maxBytes, int timeoutMs, Stream stream)
+{
+    static thread_local std::vector<char> raw;
+    if (raw.size() < maxBytes) {
+        raw.resize(maxBytes);
+    }
+
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeoutMs > 0 ? timeoutMs : 0);
+
+    for (;;) {
+        size_t n = read(raw.data(), maxBytes, timeoutMs, stream);
+        if (n == 0) {
+            // Nothing more is coming from an ended process: release the held character
+            return m_running ? 0 : stripper.flush(buf);
+        }
+
+        size_t len = stripper.strip(raw.data(), n, buf);
+        if (len > 0 || timeoutMs == 0) return len;
+
+        // Only escape sequences so far (a prompt redraw, a title): wait for the text
+        if (timeoutMs > 0) {
+            timeoutMs = msUntil(deadline);
+            if (timeoutMs == 0) return 0;
+        }
+    }
+}
+
+std::string PtySession::readText(size_t maxBytes, int timeoutMs, Stream stream)
+{
+    if (maxBytes > kMaxReadSize) maxBytes = kMaxReadSize;
+    char* buf = readScratch(maxBytes + kTextExtraMax);
+    size_t n = readText(buf, maxBytes, timeoutMs, stream);
+    return std::string(buf, n);
+}
+
+PtySession::PumpResult PtySession::pump()
+{
+    size_t span;
+    char* dst = m_ring->writeSpan(&span);
+
+    if (span == 0) {
+        // Ring is full: stop draining until the consumer catches up. The child
+        // then blocks on the kernel PTY buffer, exactly as in synchronous mode.
+        m_producerWaiting.store(true);
+        if (m_ring->space() == 0) {
+            return kPumpFull;
+        }
+        // The consumer made room in the meantime
+        m_producerWaiting.store(false);
+        dst = m_ring->writeSpan(&span);
+    }
+
+    ssize_t n = ::read(m_masterFd, dst, span);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+        return kPumpIdle;
+    }
+    if (n <= 0) {
+        // EOF, or EIO once the child side is gone
+        m_readerDone.store(true);
+        notifyConsumer();
+        return kPumpClosed;
+    }
+
+    m_ring->commit((size_t)n);
+    if (m_consumerWaiting.load()) {
+        notifyConsumer();
+    }
+    return kPumpData;
+}
+
+void PtySession::notifyConsumer()
+{
+    std::lock_guard<std::mutex> lock(m_ringMutex);
+    m_ringDataCond.notify_all();
+}
+
+bool PtySession::hasBufferedOutput() const
+{
+    return m_ring && (!m_ring->empty() || m_readerDone.load());
+}
+
+void PtySession::readerLoop()
+{
+    // Sole producer of m_ring; also the only user of m_poller in this mode.
+    while (!m_stopReader.load()) {
+
+        if (m_producerWaiting.load()) {
+            std::unique_lock<std::mutex> lock(m_ringMutex);
+            m_ringSpaceCond.wait(lock, [this] { return !m_producerWaiting.load() || m_stopReader.load(); });
+            continue;
+        }
+
+        PtyPoller::Event events[2];
+        int rc = m_poller->wait(events, 2, -1);
+        if (rc < 0) {
+            if (errno == EINTR) continue;
             break;
         }
+
+        bool interrupted = false;
+        for (int i = 0; i < rc; i++) {
+            if (events[i].fd == m_interruptPipe[0]) interrupted = true;
+        }
+        if (interrupted) break;
+
+        if (pump() == kPumpClosed) break;
     }
 
-    // Shrink down to actual bytes read
-    result.resize(totalRead);
-    return result;
+    m_readerDone.store(true);
+    notifyConsumer();
+}
+
+void PtySession::resumeProducer()
+{
+    // Restart a producer that paused on a full ring
+    if (m_producerWaiting.exchange(false)) {
+        if (m_loop != nullptr) {
+            m_loop->resume(this, m_masterFd);
+        } else {
+            std::lock_guard<std::mutex> lock(m_ringMutex);
+            m_ringSpaceCond.notify_all();
+        }
+    }
+}
+
+size_t PtySession::readBuffered(char* buf, size_t maxBytes, int timeoutMs)
+{
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeoutMs > 0 ? timeoutMs : 0);
+    auto ready = [this] { return !m_ring->empty() || m_readerDone.load(); };
+
+    // Fast path: output already drained by the reader, no syscall needed.
+    size_t n = m_ring->read(buf, maxBytes);
+
+    if (n == 0 && timeoutMs != 0 && !m_readerDone.load()) {
+        std::unique_lock<std::mutex> lock(m_ringMutex);
+        m_consumerWaiting.store(true);
+        if (timeoutMs < 0) {
+            m_ringDataCond.wait(lock, ready);
+        } else {
+            m_ringDataCond.wait_until(lock, deadline, ready);
+        }
+        m_consumerWaiting.store(false);
+        lock.unlock();
+
+        n = m_ring->read(buf, maxBytes);
+    }
+
+    if (n > 0) {
+        resumeProducer();
+    }
+
+    // As in readDirect(): gather until maxBytes or the deadline, or wait for the rest
+    // of a burst during the coalescing window
+    bool gather = !m_returnOnFirstData && timeoutMs != 0;
+    if (n > 0 && (gather || m_coalesceMs > 0)) {
+        size_t target = gather ? maxBytes : std::min(maxBytes, m_coalesceBytes);
+        bool forever = gather && timeoutMs < 0;
+        Clock::time_point end = gather ? deadline : Clock::now() + std::chrono::milliseconds(m_coalesceMs);
+
+        while (n < target && !m_readerDone.load()) {
+            std::unique_lock<std::mutex> lock(m_ringMutex);
+            m_consumerWaiting.store(true);
+            bool more = true;
+            if (forever) {
+                m_ringDataCond.wait(lock, ready);
+            } else {
+                more = m_ringDataCond.wait_until(lock, end, ready);
+            }
+            m_consumerWaiting.store(false);
+            lock.unlock();
+
+            size_t got = m_ring->read(buf + n, maxBytes - n);
+            n += got;
+            if (got > 0) {
+                resumeProducer();
+            }
+            if (!more) break;
+        }
+    }
+
+    return n;
 }
 
 bool PtySession::resize(int16_t cols, int16_t rows)
@@ -328,6 +1150,8 @@ bool PtySession::resize(int16_t cols, int16_t rows)
         return false;
     }
 
+    std::lock_guard<std::mutex> lock(m_processMutex);
+
     struct winsize ws;
     ws.ws_col = cols;
     ws.ws_row = rows;
@@ -337,6 +1161,10 @@ bool PtySession::resize(int16_t cols, int16_t rows)
     if (ioctl(m_masterFd, TIOCSWINSZ, &ws) != -1) {
         m_cols = cols;
         m_rows = rows;
+        if (m_screen) {
+            std::lock_guard<std::mutex> screenLock(m_screenMutex);
+            m_screen->resize(cols, rows);
+        }
         return true;
     }
     return false;
@@ -344,10 +1172,24 @@ bool PtySession::resize(int16_t cols, int16_t rows)
 
 bool PtySession::checkRunning()
 {
+    std::lock_guard<std::mutex> lock(m_processMutex);
+
     if (!m_running || m_pid <= 0) {
         return false;
     }
 
+    if (m_controlFd >= 0) {
+        // Not our child: the zygote reaps it and sends its exit code
+        int32_t code;
+        ssize_t n = recv(m_controlFd, &code, sizeof(code), MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            return true;
+        }
+        m_running = false;
+        *m_exitCode = (n == (ssize_t)sizeof(code)) ? code : -1;
+        return false;
+    }
+
     int status;
     pid_t result = waitpid(m_pid, &status, WNOHANG);
 
@@ -359,11 +1201,11 @@ bool PtySession::checkRunning()
     if (result == m_pid) {
         m_running = false;
         if (WIFEXITED(status)) {
-            m_exitCode = WEXITSTATUS(status);
+            *m_exitCode = WEXITSTATUS(status);
         } else if (WIFSIGNALED(status)) {
-            m_exitCode = -WTERMSIG(status);
+            *m_exitCode = -WTERMSIG(status);
         } else {
-            m_exitCode = -1;
+            *m_exitCode = -1;
         }
     }
 
@@ -372,6 +1214,8 @@ bool PtySession::checkRunning()
 
 bool PtySession::sendSignal(int signum)
 {
+    std::lock_guard<std::mutex> lock(m_processMutex);
+
     if (m_pid <= 0 || !m_running) {
         return false;
     }
@@ -388,55 +1232,80 @@ bool PtySession::sendSignal(int signum)
 
 bool PtySession::close()
 {
-    // Wake up any thread stuck in a blocking read
+    // Only the first call does the work. The fds stay open until the destructor:
+    // another thread may still be inside read() or write() on this session.
+    if (m_closed.exchange(true)) {
+        return true;
+    }
+
+    // Wake up any thread stuck in a blocking read. The pipe is never drained,
+    // so every later wait on the poller returns immediately as well.
     if (m_interruptPipe[1] >= 0) {
         char dummy = 'x';
         ::write(m_interruptPipe[1], &dummy, 1);
     }
 
-    // Close master fd
-    if (m_masterFd >= 0) {
-        ::close(m_masterFd);
-        m_masterFd = -1;
+    // Stop the background reader before its fds go away
+    if (m_readerThread.joinable()) {
+        m_stopReader.store(true);
+        {
+            std::lock_guard<std::mutex> lock(m_ringMutex);
+            m_ringSpaceCond.notify_all();
+        }
+        m_readerThread.join();
     }
-
-    // Close slave fd
-    if (m_slaveFd >= 0) {
-        ::close(m_slaveFd);
-        m_slaveFd = -1;
+    if (m_loop != nullptr && m_masterFd >= 0) {
+        m_loop->detach(this, m_masterFd);
+    }
+    if (m_ring) {
+        // Wake a read() blocked on the ring
+        m_readerDone.store(true);
+        notifyConsumer();
     }
 
-    // Terminate child process
-    if (m_pid > 0 && m_running) {
-        // Try SIGHUP first (shell standard)
-        ::kill(m_pid, SIGHUP);
-
-        // Give it a moment
-        int status;
-        pid_t result = waitpid(m_pid, &status, WNOHANG);
+    // Terminate child process: SIGHUP now, then SIGTERM and SIGKILL from the reaper
+    // thread if it is still around after the grace periods.
+    std::lock_guard<std::mutex> lock(m_processMutex);
+    if (m_controlFd >= 0) {
+        // Zygote session: dropping the control channel makes the helper run the same ladder
+        ::close(m_controlFd);
+        m_controlFd = -1;
+        m_running = false;
+    } else if (m_pid > 0 && m_running) {
+        std::shared_ptr<std::atomic<int> > exitCode = m_exitCode;
+        PtyReaper::shared().reap(m_pid, [exitCode](pid_t, int code) {
+            *exitCode = code;
+        });
+        m_running = false;
+    }
 
-        if (result == 0) {
-            // Still running, try SIGTERM
-            ::kill(m_pid, SIGTERM);
-            usleep(100000); // 100ms
+    return true;
+}
 
-            result = waitpid(m_pid, &status, WNOHANG);
-            if (result == 0) {
-                // Force kill
-                ::kill(m_pid, SIGKILL);
-                waitpid(m_pid, &status, 0);
-            }
-        }
+void PtySession::releaseFds()
+{
+    // Close master fd
+    if (m_masterFd >= 0) {
+        m_poller->remove(m_masterFd);
+        ::close(m_masterFd);
+        m_masterFd = -1;
+    }
 
-        if (WIFEXITED(status)) {
-            m_exitCode = WEXITSTATUS(status);
-        }
+    // Close slave fd, or the child's ends of the pipes if it never started
+    closeChildStdio();
 
-        m_running = false;
-        m_pid = -1;
+    if (m_stdinFd >= 0) {
+        ::close(m_stdinFd);
+        m_stdinFd = -1;
+    }
+    if (m_stderrFd >= 0) {
+        if (m_stderrPoller) m_stderrPoller->remove(m_stderrFd);
+        ::close(m_stderrFd);
+        m_stderrFd = -1;
     }
 
     if (m_interruptPipe[0] >= 0) {
+        m_poller->remove(m_interruptPipe[0]);
         ::close(m_interruptPipe[0]);
         m_interruptPipe[0] = -1;
     }
@@ -444,6 +1313,4 @@ bool PtySession::close()
         ::close(m_interruptPipe[1]);
         m_interruptPipe[1] = -1;
     }
-
-    return true;
 }
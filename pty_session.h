@@ -10,11 +10,61 @@
 #ifndef PTY_SESSION_H
 #define PTY_SESSION_H
 
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 #include <sys/types.h>
 
+class PtyAnsiStripper;
+class PtyEventLoop;
+class PtyPoller;
+class PtyRingBuffer;
+class PtyScreen;
+class PtyScrollback;
+
 class PtySession {
 
+public:
+    enum ReaderMode {
+        kReaderSync = 0,    // read() waits on the master fd itself
+        kReaderThread,      // a background thread drains the master fd into a ring buffer
+        kReaderLoop         // a shared PtyEventLoop drains the master fd into a ring buffer
+    };
+
+    enum PumpResult {
+        kPumpData,
+        kPumpIdle,
+        kPumpFull,          // ring full, producer paused until the consumer reads
+        kPumpClosed
+    };
+
+    enum SpawnMethod {
+        kSpawnDefault = 0,  // posix_spawn (glibc) or vfork: no copy of the parent's address space
+        kSpawnFork,         // plain fork(), slower as the parent process grows
+        kSpawnZygote        // forked by the PtyZygote helper, fd passed back over a socket
+    };
+
+    enum IoMode {
+        kIoTerminal = 0,    // stdin, stdout and stderr all on the PTY slave
+        kIoPipes            // no terminal: a socket for stdin, a pipe each for stdout and stderr
+    };
+
+    enum Stream {
+        kStdout = 1,        // the terminal output in kIoTerminal mode
+        kStderr = 2         // kIoPipes only
+    };
+
+    static const size_t kDefaultRingSize = 256 * 1024;
+    static const size_t kDefaultCoalesceBytes = 16 * 1024;
+    static const size_t kMaxReadSize = 65536;      // larger maxBytes are clamped
+    static const size_t kUtf8CarryMax = 3;         // bytes readText() may hold back
+    static const size_t kTextExtraMax = 7;         // bytes readText() may return beyond maxBytes
+
 private:
     int m_id;
     int m_masterFd;
@@ -22,30 +72,181 @@ private:
     pid_t m_pid;
     int16_t m_cols;
     int16_t m_rows;
-    bool m_running;
-    int m_exitCode;
+    std::atomic<bool> m_running;
+    // Shared with the reaper, which reports the exit status after close() returned
+    std::shared_ptr<std::atomic<int> > m_exitCode;
+    std::atomic<bool> m_closed;
+    SpawnMethod m_spawnMethod;
+    int m_controlFd;                // kSpawnZygote: exit code in, hangup out
+
+    // kIoPipes: m_masterFd reads the child's stdout
+    IoMode m_ioMode;
+    int m_stdinFd;
+    int m_stderrFd;
+    int m_childStdio[3];            // the child's ends, closed in the parent once it started
+    std::unique_ptr<PtyPoller> m_stderrPoller;
+
+    // kIoTerminal: cfmakeraw() settings instead of the cooked line discipline
+    bool m_rawMode;
+    int16_t m_vmin;
+    int16_t m_vtime;
+
+    // Per-session locks: commands on different sessions never wait on each other.
+    std::mutex m_writeMutex;        // keeps concurrent writes from interleaving
+    std::mutex m_processMutex;      // child state: waitpid, signals, window size
     std::string m_lastError;
     int m_interruptPipe[2];
+    std::unique_ptr<PtyPoller> m_poller;
+
+    // Buffered reader (kReaderThread)
+    ReaderMode m_readerMode;
+    size_t m_ringSize;
+    std::unique_ptr<PtyRingBuffer> m_ring;
+    PtyEventLoop* m_loop;
+    std::thread m_readerThread;
+    std::mutex m_ringMutex;
+    std::condition_variable m_ringDataCond;
+    std::condition_variable m_ringSpaceCond;
+    std::atomic<bool> m_consumerWaiting;
+    std::atomic<bool> m_producerWaiting;
+    std::atomic<bool> m_readerDone;
+    std::atomic<bool> m_stopReader;
+
+    // Output coalescing window, off when m_coalesceMs is 0
+    int m_coalesceMs;
+    size_t m_coalesceBytes;
+    bool m_returnOnFirstData;
+
+    // Trailing bytes of an incomplete UTF-8 sequence held back by readText(), per stream
+    std::string m_utf8Carry[2];
+    // setStripAnsi(): escape sequence state carried from one readText() to the next, per stream
+    std::unique_ptr<PtyAnsiStripper> m_stripper[2];
+
+    // setScreen(): the terminal output interpreted into a cell grid, fed by every read
+    bool m_screenEnabled;
+    std::unique_ptr<PtyScreen> m_screen;
+    std::mutex m_screenMutex;
+
+    // With a ring, a screen or a scrollback, held across a stdout read and the feed
+    // that follows: the ring has a single consumer, and concurrent readers feed the
+    // output in the order it was read. Waiting for it counts in the reader's timeout.
+    std::timed_mutex m_readMutex;
+
+    // setScrollback(): the lines of the output, as text, fed by every read
+    std::unique_ptr<PtyScrollback> m_scrollback;
+    std::unique_ptr<PtyAnsiStripper> m_scrollbackStripper;
+    std::mutex m_scrollbackMutex;
+
 
     bool configurePty();
     void setupChildProcess();
+    bool openPty(std::string& slavePath);
+    bool openPipes();
+    void closeChildStdio();
+    static void closeFrom(int lowFd);
+    pid_t forkChild(const char* path, char* const argv[], char* const envp[], const char* cwd);
+    pid_t spawnChild(const char* path, const char* slavePath, char* const argv[], char* const envp[], const char* cwd);
+    void releaseFds();
+    PumpResult pump();
+    void notifyConsumer();
+    void resumeProducer();
+    void readerLoop();
+    size_t readBuffered(char* buf, size_t maxBytes, int timeoutMs);
+    size_t readDirect(int fd, PtyPoller* poller, char* buf, size_t maxBytes, int timeoutMs);
+    size_t readStripped(PtyAnsiStripper& stripper, char* buf, size_t maxBytes, int timeoutMs, Stream stream);
+    void appendScrollback(const char* data, size_t len);
+
+    friend class PtyEventLoop;
+    friend class PtyZygote;
 
 public:
     PtySession(int id);
     ~PtySession();
 
+    // Must be called before start(). bufferSize bounds the output kept while nobody reads.
+    // kReaderLoop requires a running loop; without one the session falls back to kReaderThread.
+    void setReaderMode(ReaderMode mode, size_t bufferSize = kDefaultRingSize, PtyEventLoop* loop = nullptr);
+
+    // Must be called before start().
+    void setSpawnMethod(SpawnMethod method);
+
+    // Must be called before start(). kIoPipes skips the terminal (line discipline,
+    // echo, window size) and keeps stderr apart from stdout.
+    void setIoMode(IoMode mode);
+
+    // Must be called before start(). Once a read got its first byte, it keeps collecting
+    // output for up to windowMs, or until maxBytes are gathered, instead of returning as
+    // soon as nothing more is immediately available. windowMs = 0 turns this off.
+    void setCoalescing(int windowMs, size_t maxBytes = kDefaultCoalesceBytes);
+
+    // By default a read returns what is available once the first byte arrived. With false,
+    // it keeps reading until maxBytes are gathered, the timeout expires or the output ends.
+    void setReturnOnFirstData(bool returnOnFirstData);
+
+    // Must be called before start(). Raw mode passes bytes through the terminal untouched;
+    // reads by the child return once vmin bytes arrived or after vtime tenths of a second
+    // (see termios VMIN/VTIME). Ignored in kIoPipes mode.
+    void setRawMode(bool raw, int vmin = 1, int vtime = 0);
+
+    // Must be called before the first read. readText() then returns plain text, as
+    // PtyAnsiStripper produces it: escape sequences, CR and other controls removed,
+    // backspaces applied. Output made only of escape sequences does not end the wait.
+    void setStripAnsi(bool strip);
+
+    // Must be called before start(). Keeps a PtyScreen of the window size, updated with
+    // the output as it is read (so only while somebody reads). kIoTerminal only.
+    void setScreen(bool enable);
+    // Calls visit with the screen, which is not modified meanwhile. Returns false when
+    // the session keeps no screen.
+    bool withScreen(const std::function<void(const PtyScreen&)>& visit);
+
+    // Must be called before the first read. Keeps the lines of the output (stdout only),
+    // stripped as with setStripAnsi(), in a PtyScrollback of budgetBytes; 0 keeps none.
+    // Only the output read is kept, as with setScreen().
+    void setScrollback(size_t budgetBytes);
+    // Calls visit with the scrollback, which is not modified meanwhile. Returns false
+    // when the session keeps none.
+    bool withScrollback(const std::function<void(PtyScrollback&)>& visit);
+
     bool start(const char* shellPath, int16_t cols, int16_t rows, const char* cwd = nullptr);
+    // Executes path directly with the given argument vector (argv[0] included; empty
+    // means { path }). A path without '/' is looked up in PATH. env lists "KEY=VALUE"
+    // entries and becomes the whole environment of the child; nullptr gives the
+    // default one (the plugin's environment plus TERM, LANG and friends).
+    bool startProcess(const char* path, const std::vector<std::string>& argv,
+                      const std::vector<std::string>* env, int16_t cols, int16_t rows,
+                      const char* cwd = nullptr);
     ssize_t write(const char* data, size_t len);
-    std::string read(size_t maxBytes, int timeoutMs);
+    // kIoPipes: the child reads end of file once it consumed what was written.
+    bool closeInput();
+    // Reads up to maxBytes into buf and returns the count, 0 on timeout or once closed.
+    // kStderr reads nothing in kIoTerminal mode, where stderr goes to the terminal.
+    size_t read(char* buf, size_t maxBytes, int timeoutMs, Stream stream = kStdout);
+    // Same as read(), but the result never ends inside a UTF-8 sequence: a split
+    // code point is kept back and prepended to the next call. With setStripAnsi(), the
+    // last character of an unfinished line is also kept back, until more output or
+    // the end of the process, so that a backspace in the next read can erase it.
+    // buf must have room for maxBytes + kTextExtraMax bytes.
+    size_t readText(char* buf, size_t maxBytes, int timeoutMs, Stream stream = kStdout);
+    // Convenience overloads: the bytes received, copied out of a per-thread buffer.
+    std::string read(size_t maxBytes, int timeoutMs, Stream stream = kStdout);
+    std::string readText(size_t maxBytes, int timeoutMs, Stream stream = kStdout);
     bool resize(int16_t cols, int16_t rows);
     bool sendSignal(int signum);
+    // Stops the session: wakes blocked readers, stops the reader and hands the child to
+    // PtyReaper, which terminates and reaps it in the background (close() does not wait).
+    // Safe to call while other threads are using the session; its fds are only
+    // released by the destructor, once nobody references the session any more.
     bool close();
     bool checkRunning();
 
     int id() const { return m_id; }
+    ReaderMode readerMode() const { return m_readerMode; }
+    IoMode ioMode() const { return m_ioMode; }
+    bool hasBufferedOutput() const;
     pid_t pid() const { return m_pid; }
     bool isRunning() const { return m_running; }
-    int exitCode() const { return m_exitCode; }
+    int exitCode() const { return m_exitCode->load(); }
     const std::string& lastError() const { return m_lastError; }
 };
 
@@ -0,0 +1,385 @@
+/* --------------------------------------------------------------------------------
+ #
+ #  pty_vt_parser.cpp
+ #  4d-plugin-pty
+ #
+ #  Incremental VT500-series escape sequence parser (Paul Williams' state machine)
+ #
+ # --------------------------------------------------------------------------------*/
+
+#include "pty_vt_parser.h"
+#include "utf8.h"
+
+#include <cstring>
+
+const int PtyVtParser::kMaxParams;
+const int PtyVtParser::kMaxIntermediates;
+const size_t PtyVtParser::kMaxOscLength;
+
+#pragma mark - Transition table
+
+// See https://vt100.net/emu/dec_ansi_parser. Each entry packs the action to perform
+// (high nibble) and the state to enter (low nibble, kStay to remain in the current one).
+// Two departures from the diagram: ':' separates sub-parameters (SGR 38:2:r:g:b) instead
+// of spoiling the sequence, and BEL ends an OSC string as it does in xterm.
+
+enum Action {
+    kNone = 0,
+    kPrint,
+    kExecute,
+    kCollect,
+    kParam,
+    kEscDispatch,
+    kCsiDispatch,
+    kPut,
+    kOscPut
+};
+
+static const int kStay = 0x0F;
+
+struct VtTable {
+    uint8_t next[PtyVtParser::kStateCount][256];
+    uint8_t entry[PtyVtParser::kStateCount];    // 0, or one of the entry actions below
+    uint8_t exit[PtyVtParser::kStateCount];
+};
+
+enum EntryExitAction {
+    kClear = 1,
+    kHook,
+    kUnhook,
+    kOscStart,
+    kOscEnd
+};
+
+static constexpr void setRange(uint8_t* row, int from, int to, int action, int state) {
+    for (int c = from; c <= to; c++) {
+        row[c] = (uint8_t)((action << 4) | state);
+    }
+}
+
+// C0 controls other than CAN, SUB and ESC, which are handled from every state
+static constexpr void setControls(uint8_t* row, int action, int state = kStay) {
+    setRange(row, 0x00, 0x17, action, state);
+    setRange(row, 0x19, 0x19, action, state);
+    setRange(row, 0x1C, 0x1F, action, state);
+}
+
+static constexpr VtTable buildTable() {
+    typedef PtyVtParser P;
+    VtTable t = {};
+
+    for (int s = 0; s < P::kStateCount; s++) {
+        uint8_t* row = t.next[s];
+        setRange(row, 0x00, 0xFF, kNone, kStay);
+
+        // Anywhere
+        setRange(row, 0x18, 0x18, kExecute, P::kGround);
+        setRange(row, 0x1A, 0x1A, kExecute, P::kGround);
+        setRange(row, 0x1B, 0x1B, kNone, P::kEscape);
+    }
+
+    uint8_t* row = t.next[P::kGround];
+    setControls(row, kExecute);
+    setRange(row, 0x20, 0x7E, kPrint, kStay);
+    setRange(row, 0x80, 0xFF, kPrint, kStay);
+
+    row = t.next[P::kEscape];
+    setControls(row, kExecute);
+    setRange(row, 0x20, 0x2F, kCollect, P::kEscapeIntermediate);
+    setRange(row, 0x30, 0x7E, kEscDispatch, P::kGround);
+    setRange(row, 'P', 'P', kNone, P::kDcsEntry);
+    setRange(row, 'X', 'X', kNone, P::kSosPmApcString);
+    setRange(row, '[', '[', kNone, P::kCsiEntry);
+    setRange(row, ']', ']', kNone, P::kOscString);
+    setRange(row, '^', '_', kNone, P::kSosPmApcString);
+
+    row = t.next[P::kEscapeIntermediate];
+    setControls(row, kExecute);
+    setRange(row, 0x20, 0x2F, kCollect, kStay);
+    setRange(row, 0x30, 0x7E, kEscDispatch, P::kGround);
+
+    row = t.next[P::kCsiEntry];
+    setControls(row, kExecute);
+    setRange(row, 0x20, 0x2F, kCollect, P::kCsiIntermediate);
+    setRange(row, 0x30, 0x3B, kParam, P::kCsiParam);
+    setRange(row, 0x3C, 0x3F, kCollect, P::kCsiParam);
+    setRange(row, 0x40, 0x7E, kCsiDispatch, P::kGround);
+
+    row = t.next[P::kCsiParam];
+    setControls(row, kExecute);
+    setRange(row, 0x20, 0x2F, kCollect, P::kCsiIntermediate);
+    setRange(row, 0x30, 0x3B, kParam, kStay);
+    setRange(row, 0x3C, 0x3F, kNone, P::kCsiIgnore);
+    setRange(row, 0x40, 0x7E, kCsiDispatch, P::kGround);
+
+    row = t.next[P::kCsiIntermediate];
+    setControls(row, kExecute);
+    setRange(row, 0x20, 0x2F, kCollect, kStay);
+    setRange(row, 0x30, 0x3F, kNone, P::kCsiIgnore);
+    setRange(row, 0x40, 0x7E, kCsiDispatch, P::kGround);
+
+    row = t.next[P::kCsiIgnore];
+    setControls(row, kExecute);
+    setRange(row, 0x40, 0x7E, kNone, P::kGround);
+
+    row = t.next[P::kDcsEntry];
+    setRange(row, 0x20, 0x2F, kCollect, P::kDcsIntermediate);
+    setRange(row, 0x30, 0x3B, kParam, P::kDcsParam);
+    setRange(row, 0x3C, 0x3F, kCollect, P::kDcsParam);
+    setRange(row, 0x40, 0x7E, kNone, P::kDcsPassthrough);
+
+    row = t.next[P::kDcsParam];
+    setRange(row, 0x20, 0x2F, kCollect, P::kDcsIntermediate);
+    setRange(row, 0x30, 0x3B, kParam, kStay);
+    setRange(row, 0x3C, 0x3F, kNone, P::kDcsIgnore);
+    setRange(row, 0x40, 0x7E, kNone, P::kDcsPassthrough);
+
+    row = t.next[P::kDcsIntermediate];
+    setRange(row, 0x20, 0x2F, kCollect, kStay);
+    setRange(row, 0x30, 0x3F, kNone, P::kDcsIgnore);
+    setRange(row, 0x40, 0x7E, kNone, P::kDcsPassthrough);
+
+    row = t.next[P::kDcsPassthrough];
+    setControls(row, kPut);
+    setRange(row, 0x20, 0x7E, kPut, kStay);
+    setRange(row, 0x80, 0xFF, kPut, kStay);
+
+    row = t.next[P::kOscString];
+    setRange(row, 0x07, 0x07, kNone, P::kGround);
+    setRange(row, 0x20, 0x7F, kOscPut, kStay);
+    setRange(row, 0x80, 0xFF, kOscPut, kStay);
+
+    t.entry[P::kEscape] = kClear;
+    t.entry[P::kCsiEntry] = kClear;
+    t.entry[P::kDcsEntry] = kClear;
+    t.entry[P::kDcsPassthrough] = kHook;
+    t.exit[P::kDcsPassthrough] = kUnhook;
+    t.entry[P::kOscString] = kOscStart;
+    t.exit[P::kOscString] = kOscEnd;
+
+    return t;
+}
+
+// Computed at compile time: usable by parsers constructed during static initialization
+static constexpr VtTable kTable = buildTable();
+
+#pragma mark - Parser
+
+PtyVtParser::PtyVtParser(Handler* handler)
+    : m_handler(handler)
+    , m_state(kGround)
+    , m_oscLength(0)
+    , m_utf8Length(0)
+    , m_utf8Needed(0)
+{
+    clear();
+}
+
+void PtyVtParser::reset()
+{
+    m_state = kGround;
+    m_oscLength = 0;
+    m_utf8Length = 0;
+    m_utf8Needed = 0;
+    clear();
+}
+
+int PtyVtParser::param(int index, int defaultValue) const
+{
+    if (index < 0 || index >= m_paramCount || m_params[index] < 0) {
+        return defaultValue;
+    }
+    return m_params[index];
+}
+
+void PtyVtParser::clear()
+{
+    m_paramCount = 0;
+    m_subparams = 0;
+    m_intermediateCount = 0;
+    m_ignoring = false;
+}
+
+void PtyVtParser::collect(unsigned char c)
+{
+    if (m_intermediateCount < kMaxIntermediates) {
+        m_intermediates[m_intermediateCount++] = (char)c;
+    } else {
+        m_ignoring = true;
+    }
+}
+
+void PtyVtParser::addParam(unsigned char c)
+{
+    if (m_paramCount == 0) {
+        m_params[0] = -1;
+        m_paramCount = 1;
+    }
+
+    if (c == ';' || c == ':') {
+        if (m_paramCount < kMaxParams) {
+            if (c == ':') m_subparams |= (uint16_t)(1u << m_paramCount);
+            m_params[m_paramCount++] = -1;
+        } else {
+            m_params[kMaxParams - 1] = -1;     // past the limit, the last slot is reused
+        }
+        return;
+    }
+
+    int32_t& value = m_params[m_paramCount - 1];
+    value = (value < 0 ? 0 : value) * 10 + (c - '0');
+    if (value > 65535) value = 65535;
+}
+
+void PtyVtParser::oscPut(const char* data, size_t len)
+{
+    size_t room = kMaxOscLength - m_oscLength;
+    if (len > room) len = room;
+    memcpy(m_osc + m_oscLength, data, len);
+    m_oscLength += len;
+}
+
+void PtyVtParser::perform(int action, unsigned char c)
+{
+    switch (action) {
+        case kPrint: {
+            char ch = (char)c;
+            m_handler->print(&ch, 1);
+            break;
+        }
+        case kExecute:
+            m_handler->execute(c);
+            break;
+        case kCollect:
+            collect(c);
+            break;
+        case kParam:
+            addParam(c);
+            break;
+        case kEscDispatch:
+            if (!m_ignoring) m_handler->escDispatch(*this, (char)c);
+            break;
+        case kCsiDispatch:
+            if (!m_ignoring) m_handler->csiDispatch(*this, (char)c);
+            break;
+        case kPut: {
+            char ch = (char)c;
+            m_handler->dcsPut(&ch, 1);
+            break;
+        }
+        case kOscPut: {
+            char ch = (char)c;
+            oscPut(&ch, 1);
+            break;
+        }
+    }
+}
+
+// Exit action of the state left, then the transition action, then the entry action
+// of the state entered. A transition to the current state runs both as well.
+void PtyVtParser::transition(State next, int action, unsigned char c)
+{
+    switch (kTable.exit[m_state]) {
+        case kUnhook:
+            if (!m_ignoring) m_handler->dcsUnhook();
+            break;
+        case kOscEnd:
+            m_handler->oscDispatch(m_osc, m_oscLength);
+            break;
+    }
+
+    perform(action, c);
+    m_state = next;
+
+    switch (kTable.entry[next]) {
+        case kClear:
+            clear();
+            break;
+        case kHook:
+            if (!m_ignoring) m_handler->dcsHook(*this, (char)c);
+            break;
+        case kOscStart:
+            m_oscLength = 0;
+            break;
+    }
+}
+
+// Total length of the UTF-8 sequence started by a lead byte (1 for anything invalid)
+static inline int sequenceLength(uint8_t c) {
+    if (c >= 0xC2 && c < 0xE0) return 2;
+    if (c >= 0xE0 && c < 0xF0) return 3;
+    if (c >= 0xF0 && c < 0xF5) return 4;
+    return 1;
+}
+
+// Completes the code point left over by the previous chunk, and prints it.
+const uint8_t* PtyVtParser::resumeCodePoint(const uint8_t* p, const uint8_t* end)
+{
+    while (p < end && m_utf8Length < m_utf8Needed && (*p & 0xC0) == 0x80) {
+        m_utf8[m_utf8Length++] = (char)*p++;
+    }
+    if (p == end && m_utf8Length < m_utf8Needed) {
+        return p;       // still incomplete
+    }
+    m_handler->print(m_utf8, (size_t)m_utf8Length);
+    m_utf8Length = 0;
+    return p;
+}
+
+// Prints [p, runEnd). A code point cut off by the end of the chunk is kept for the next one.
+void PtyVtParser::printRun(const uint8_t* p, const uint8_t* runEnd, const uint8_t* end)
+{
+    size_t len = (size_t)(runEnd - p);
+    if (runEnd == end) {
+        size_t complete = utf8_complete_length((const char*)p, len);
+        if (complete < len) {
+            m_utf8Length = (int)(len - complete);
+            m_utf8Needed = sequenceLength(p[complete]);
+            memcpy(m_utf8, p + complete, (size_t)m_utf8Length);
+            len = complete;
+        }
+    }
+    if (len > 0) {
+        m_handler->print((const char*)p, len);
+    }
+}
+
+void PtyVtParser::feed(const char* data, size_t len)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    const uint8_t* end = p + len;
+
+    if (m_utf8Length > 0) {
+        p = resumeCodePoint(p, end);
+    }
+
+    while (p < end) {
+        // Runs of text and string content go to the handler in one call
+        if (m_state == kGround || m_state == kOscString || m_state == kDcsPassthrough) {
+            const uint8_t* q = p;
+            while (q < end && *q >= 0x20 && *q != 0x7F) q++;
+            if (q > p) {
+                if (m_state == kGround) {
+                    printRun(p, q, end);
+                } else if (m_state == kOscString) {
+                    oscPut((const char*)p, (size_t)(q - p));
+                } else {
+                    m_handler->dcsPut((const char*)p, (size_t)(q - p));
+                }
+                p = q;
+                continue;
+            }
+        }
+
+        unsigned char c = *p++;
+        uint8_t packed = kTable.next[m_state][c];
+        int action = packed >> 4;
+        int next = packed & 0x0F;
+
+        if (next == kStay) {
+            perform(action, c);
+        } else {
+            transition((State)next, action, c);
+        }
+    }
+}
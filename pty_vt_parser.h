@@ -0,0 +1,119 @@
+/* --------------------------------------------------------------------------------
+ #
+ #  pty_vt_parser.h
+ #  4d-plugin-pty
+ #
+ #  Incremental VT500-series escape sequence parser (Paul Williams' state machine)
+ #
+ # --------------------------------------------------------------------------------*/
+
+#ifndef PTY_VT_PARSER_H
+#define PTY_VT_PARSER_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Bytes are fed in chunks of any size, as they come out of PtySession::read: a sequence
+// split across two reads is reassembled. Nothing is allocated after construction.
+//
+// The input is taken as UTF-8, like the terminals the sessions are started for: bytes
+// 0x80-0xFF are text (or string content), never C1 controls. print() only receives whole
+// code points, except for sequences that are invalid in the input itself.
+class PtyVtParser {
+
+public:
+    static const int kMaxParams = 16;           // further parameters are dropped
+    static const int kMaxIntermediates = 2;     // more than that and the sequence is ignored
+    static const size_t kMaxOscLength = 4096;   // longer OSC strings are truncated
+
+    // Callbacks, named after the actions of the state machine. The parameters and
+    // intermediates of the sequence being dispatched are read back from the parser.
+    class Handler {
+    public:
+        virtual ~Handler() {}
+
+        // A run of printable text, in UTF-8.
+        virtual void print(const char* /*text*/, size_t /*len*/) {}
+        // A C0 control: BEL, BS, HT, LF, CR...
+        virtual void execute(unsigned char /*control*/) {}
+        // ESC [ params intermediates final
+        virtual void csiDispatch(const PtyVtParser& /*parser*/, char /*final*/) {}
+        // ESC intermediates final, e.g. ESC ( B or ESC 7
+        virtual void escDispatch(const PtyVtParser& /*parser*/, char /*final*/) {}
+        // ESC ] data (BEL | ESC \): the whole string, e.g. "0;title"
+        virtual void oscDispatch(const char* /*data*/, size_t /*len*/) {}
+        // ESC P params intermediates final, then the payload in runs, then ST
+        virtual void dcsHook(const PtyVtParser& /*parser*/, char /*final*/) {}
+        virtual void dcsPut(const char* /*data*/, size_t /*len*/) {}
+        virtual void dcsUnhook() {}
+    };
+
+    enum State {
+        kGround = 0,
+        kEscape,
+        kEscapeIntermediate,
+        kCsiEntry,
+        kCsiParam,
+        kCsiIntermediate,
+        kCsiIgnore,
+        kDcsEntry,
+        kDcsParam,
+        kDcsIntermediate,
+        kDcsPassthrough,
+        kDcsIgnore,
+        kOscString,
+        kSosPmApcString,
+        kStateCount
+    };
+
+private:
+    Handler* m_handler;
+    State m_state;
+
+    int32_t m_params[kMaxParams];           // -1: parameter left empty
+    int m_paramCount;
+    uint16_t m_subparams;                   // bit i: parameter i followed a ':'
+    char m_intermediates[kMaxIntermediates];
+    int m_intermediateCount;
+    bool m_ignoring;                        // too many intermediates
+
+    char m_osc[kMaxOscLength];
+    size_t m_oscLength;
+
+    // Leading bytes of a code point cut off by the end of the previous chunk
+    char m_utf8[4];
+    int m_utf8Length;
+    int m_utf8Needed;
+
+    void clear();
+    void collect(unsigned char c);
+    void addParam(unsigned char c);
+    void oscPut(const char* data, size_t len);
+    void perform(int action, unsigned char c);
+    void transition(State next, int action, unsigned char c);
+
+    const uint8_t* resumeCodePoint(const uint8_t* p, const uint8_t* end);
+    void printRun(const uint8_t* p, const uint8_t* runEnd, const uint8_t* end);
+
+public:
+    explicit PtyVtParser(Handler* handler);
+
+    void feed(const char* data, size_t len);
+
+    // Back to the ground state, dropping any partial sequence.
+    void reset();
+
+    State state() const { return m_state; }
+
+    // Only meaningful inside csiDispatch, escDispatch and dcsHook.
+    int paramCount() const { return m_paramCount; }
+    int param(int index, int defaultValue = 0) const;    // defaultValue if missing or left empty
+    bool isSubparam(int index) const { return index > 0 && index < m_paramCount && (m_subparams & (1u << index)); }
+    int intermediateCount() const { return m_intermediateCount; }
+    const char* intermediates() const { return m_intermediates; }     // not NUL-terminated
+    // First intermediate, or 0: the private marker of a CSI ('?', '>'...) or the
+    // designator of an ESC sequence ('(', '#'...).
+    char leader() const { return m_intermediateCount ? m_intermediates[0] : 0; }
+};
+
+#endif /* PTY_VT_PARSER_H */
@@ -0,0 +1,656 @@
+/* --------------------------------------------------------------------------------
+ #
+ #  pty_zygote.cpp
+ #  4d-plugin-pty
+ #
+ #  Small helper process, started on first use, that spawns sessions on request
+ #
+ # --------------------------------------------------------------------------------*/
+
+#include "pty_zygote.h"
+#include "pty_poller.h"
+#include "pty_reaper.h"
+#include "pty_session.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <unistd.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#if defined(__APPLE__)
+#include <crt_externs.h>
+#define environ (*_NSGetEnviron())
+#else
+extern char** environ;
+#endif
+
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0      // SO_NOSIGPIPE is set on the sockets instead (macOS)
+#endif
+
+#pragma mark - Socket helpers
+
+static void setNoSigPipe(int fd)
+{
+#if defined(SO_NOSIGPIPE)
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#else
+    (void)fd;
+#endif
+}
+
+typedef std::chrono::steady_clock Clock;
+
+// Milliseconds left until t, rounded up.
+static int msUntil(Clock::time_point t)
+{
+    auto left = std::chrono::duration_cast<std::chrono::microseconds>(t - Clock::now()).count();
+    return (left > 0) ? (int)((left + 999) / 1000) : 0;
+}
+
+// SO_SNDTIMEO or SO_RCVTIMEO: blocking calls on fd fail with EAGAIN after ms.
+static void setTimeout(int fd, int option, int ms)
+{
+    struct timeval tv;
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, option, &tv, sizeof(tv));
+}
+
+static bool waitReadable(int fd, Clock::time_point deadline)
+{
+    for (;;) {
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int rc = poll(&pfd, 1, msUntil(deadline));
+        if (rc > 0) return true;
+        if (rc == 0 || errno != EINTR) return false;
+    }
+}
+
+static bool sendAll(int fd, const void* data, size_t len)
+{
+    const char* p = (const char*)data;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static bool recvAll(int fd, void* data, size_t len)
+{
+    char* p = (char*)data;
+    while (len > 0) {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+// Sends len bytes, the first of which carry fdCount descriptors (SCM_RIGHTS).
+static bool sendWithFds(int sock, const void* data, size_t len, const int* fds, int fdCount)
+{
+    if (fdCount == 0) {
+        return sendAll(sock, data, len);
+    }
+
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * fdCount), 0);
+    struct iovec iov;
+    iov.iov_base = (void*)data;
+    iov.iov_len = len;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = (socklen_t)control.size();
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fdCount);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fdCount);
+
+    ssize_t n;
+    do {
+        n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) return false;
+
+    return sendAll(sock, (const char*)data + n, len - (size_t)n);
+}
+
+// Receives len bytes with either no descriptors or exactly fdCount of them;
+// returns the number of fds, -1 on error. Anything else received is closed.
+static int recvWithFds(int sock, void* data, size_t len, int* fds, int fdCount)
+{
+    // Room for one more fd, so that a surplus arrives and can be closed
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * (fdCount + 1)), 0);
+    struct iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = len;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = (socklen_t)control.size();
+
+    int flags = 0;
+#if defined(MSG_CMSG_CLOEXEC)
+    flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &msg, flags);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) return -1;
+
+    std::vector<int> received;
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < count; i++) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+                received.push_back(fd);
+            }
+        }
+    }
+
+    bool valid = !(msg.msg_flags & MSG_CTRUNC) &&
+                 (received.empty() || received.size() == (size_t)fdCount);
+    if (!valid || !recvAll(sock, (char*)data + n, len - (size_t)n)) {
+        for (int fd : received) ::close(fd);
+        return -1;
+    }
+    for (size_t i = 0; i < received.size(); i++) {
+        fds[i] = received[i];
+    }
+    return (int)received.size();
+}
+
+#pragma mark - Plugin side
+
+PtyZygote::PtyZygote()
+    : m_socket(-1)
+    , m_pid(-1)
+{
+}
+
+PtyZygote::~PtyZygote()
+{
+    stop();
+}
+
+PtyZygote& PtyZygote::shared()
+{
+    static PtyZygote zygote;
+    return zygote;
+}
+
+const int PtyZygote::kReplyTimeoutMs;
+const char* const PtyZygote::kHelperArgument = "--pty-zygote";
+
+std::string PtyZygote::defaultHelperPath()
+{
+    Dl_info info;
+    if (dladdr((void*)&PtyZygote::defaultHelperPath, &info) == 0 || info.dli_fname == nullptr) {
+        return std::string();
+    }
+    std::string path(info.dli_fname);
+    size_t slash = path.rfind('/');
+    return ((slash == std::string::npos) ? std::string(".") : path.substr(0, slash)) + "/pty-zygote";
+}
+
+void PtyZygote::setHelperPath(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_helperPath = path;
+}
+
+bool PtyZygote::start()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::string error;
+    return startLocked(error);
+}
+
+// Called with m_mutex held. posix_spawn rather than fork(): the server has threads,
+// and the helper's code may only run in a fresh process.
+bool PtyZygote::startLocked(std::string& error)
+{
+    if (m_socket >= 0) {
+        return true;
+    }
+
+    std::string path = m_helperPath.empty() ? defaultHelperPath() : m_helperPath;
+    if (path.empty() || access(path.c_str(), X_OK) != 0) {
+        error = "zygote helper not found: " + path;
+        return false;
+    }
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        error = std::string("socketpair failed: ") + strerror(errno);
+        return false;
+    }
+    fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+    fcntl(sv[1], F_SETFD, FD_CLOEXEC);
+    if (sv[1] == kChannelFd) {
+        // dup2() onto itself would leave close-on-exec set
+        int moved = fcntl(sv[1], F_DUPFD_CLOEXEC, kChannelFd + 1);
+        ::close(sv[1]);
+        sv[1] = moved;
+    }
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t signals;
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    sigfillset(&signals);
+    posix_spawnattr_setsigdefault(&attr, &signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, sv[1], kChannelFd);
+
+    pid_t pid = -1;
+    char* argv[] = { &path[0], (char*)kHelperArgument, nullptr };
+    int rc = (sv[1] >= 0) ? posix_spawn(&pid, path.c_str(), &actions, &attr, argv, environ) : errno;
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (sv[1] >= 0) {
+        ::close(sv[1]);
+    }
+    if (rc != 0) {
+        ::close(sv[0]);
+        error = std::string("zygote helper not started: ") + strerror(rc);
+        return false;
+    }
+
+    setNoSigPipe(sv[0]);
+    setTimeout(sv[0], SO_SNDTIMEO, kReplyTimeoutMs);     // a helper that stops reading
+    m_socket = sv[0];
+    m_pid = pid;
+    return true;
+}
+
+// Called with m_mutex held.
+void PtyZygote::retireLocked()
+{
+    ::close(m_socket);
+    m_socket = -1;
+    if (m_pid > 0) {
+        PtyReaper::shared().reap(m_pid);
+        m_pid = -1;
+    }
+}
+
+void PtyZygote::stop()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_socket >= 0) {
+        ::close(m_socket);
+        m_socket = -1;
+    }
+    if (m_pid > 0) {
+        // The helper exits once its children are terminated (a few hundred ms at most)
+        while (waitpid(m_pid, nullptr, 0) < 0 && errno == EINTR) {}
+        m_pid = -1;
+    }
+}
+
+bool PtyZygote::isRunning()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_socket >= 0;
+}
+
+pid_t PtyZygote::pid()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return (m_socket >= 0) ? m_pid : -1;
+}
+
+pid_t PtyZygote::spawn(PtySession* session, const char* path, const std::vector<std::string>& argv,
+                       const std::vector<std::string>* env, const char* cwd)
+{
+    std::string* error = &session->m_lastError;
+
+    std::string argvBlock;
+    for (const std::string& arg : argv) {
+        argvBlock.append(arg.c_str(), arg.size() + 1);
+    }
+    std::string envBlock;
+    if (env != nullptr) {
+        for (const std::string& entry : *env) {
+            envBlock.append(entry.c_str(), entry.size() + 1);
+        }
+    }
+
+    Request req;
+    req.cols = session->m_cols;
+    req.rows = session->m_rows;
+    req.pathLen = (uint32_t)strlen(path);
+    req.cwdLen = (cwd != nullptr) ? (uint32_t)strlen(cwd) : 0;
+    req.argvLen = (uint32_t)argvBlock.size();
+    req.envLen = (env != nullptr) ? (int32_t)envBlock.size() : -1;
+    bool pipes = (session->m_ioMode == PtySession::kIoPipes);
+    req.ioMode = session->m_ioMode;
+    req.rawMode = session->m_rawMode ? 1 : 0;
+    req.vmin = session->m_vmin;
+    req.vtime = session->m_vtime;
+    int expected = pipes ? 4 : 2;
+
+    std::string message((const char*)&req, sizeof(req));
+    message.append(path, req.pathLen);
+    if (req.cwdLen > 0) {
+        message.append(cwd, req.cwdLen);
+    }
+    message += argvBlock;
+    message += envBlock;
+
+    // Each request has its own reply socket: a reply that comes too late goes away
+    // with it instead of being read by the next request.
+    int reply[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, reply) != 0) {
+        *error = std::string("socketpair failed: ") + strerror(errno);
+        return -1;
+    }
+    fcntl(reply[0], F_SETFD, FD_CLOEXEC);
+    fcntl(reply[1], F_SETFD, FD_CLOEXEC);
+
+    pid_t helper = -1;
+    {
+        // Requests must not interleave on the channel; replies are waited for unlocked
+        std::lock_guard<std::mutex> lock(m_mutex);
+        bool sent = false;
+        if (startLocked(*error)) {
+            helper = m_pid;
+            sent = sendWithFds(m_socket, message.data(), message.size(), &reply[1], 1);
+            if (!sent) {
+                // Gone, or stuck with part of the request: the next spawn starts another one
+                *error = "zygote channel closed";
+                retireLocked();
+            }
+        }
+        if (!sent) {
+            ::close(reply[0]);
+            ::close(reply[1]);
+            return -1;
+        }
+    }
+    ::close(reply[1]);
+
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(kReplyTimeoutMs);
+    Response resp;
+    int fds[4] = { -1, -1, -1, -1 };
+    int count = -1;
+    if (waitReadable(reply[0], deadline)) {
+        // The rest of the reply is bounded by the same deadline
+        setTimeout(reply[0], SO_RCVTIMEO, std::max(msUntil(deadline), 1));
+        count = recvWithFds(reply[0], &resp, sizeof(resp), fds, expected);
+    }
+    ::close(reply[0]);
+
+    if (count < 0) {
+        bool late = (Clock::now() >= deadline);
+        *error = late ? "zygote did not reply in time" : "zygote channel closed";
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_socket >= 0 && m_pid == helper) {
+            retireLocked();     // unless another request replaced it already
+        }
+        return -1;
+    }
+
+    if (resp.pid < 0 || count != expected) {
+        resp.error[sizeof(resp.error) - 1] = '\0';
+        *error = resp.error;
+        for (int i = 0; i < count; i++) ::close(fds[i]);
+        return -1;
+    }
+
+    session->m_masterFd = fds[0];
+    session->m_controlFd = fds[1];
+    if (pipes) {
+        session->m_stdinFd = fds[2];
+        session->m_stderrFd = fds[3];
+    }
+    return resp.pid;
+}
+
+#pragma mark - Helper process
+
+// Splits a block of NUL-terminated strings.
+static std::vector<std::string> splitBlock(const std::string& block)
+{
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start < block.size()) {
+        size_t end = block.find('\0', start);
+        if (end == std::string::npos) end = block.size();
+        items.push_back(block.substr(start, end - start));
+        start = end + 1;
+    }
+    return items;
+}
+
+static int g_sigchldPipe = -1;
+
+static void onSigchld(int)
+{
+    int saved = errno;
+    char c = 'c';
+    ::write(g_sigchldPipe, &c, 1);
+    errno = saved;
+}
+
+int PtyZygote::helperMain()
+{
+    struct stat st;
+    if (fstat(kChannelFd, &st) != 0 || !S_ISSOCK(st.st_mode)) {
+        fprintf(stderr, "pty-zygote: started by the PTY plugin only\n");
+        return 2;
+    }
+    serve(kChannelFd);
+    return 0;
+}
+
+void PtyZygote::serve(int sock)
+{
+    // Own session, away from the host's terminal signals
+    setsid();
+
+    // Drop every descriptor inherited from the host but the channel, moved to fd 3
+    if (sock != STDERR_FILENO + 1) {
+        dup2(sock, STDERR_FILENO + 1);
+        ::close(sock);
+        sock = STDERR_FILENO + 1;
+    }
+    PtySession::closeFrom(sock + 1);
+    fcntl(sock, F_SETFD, FD_CLOEXEC);
+    setNoSigPipe(sock);
+
+    int sigPipe[2];
+    if (pipe(sigPipe) != 0) {
+        _exit(1);
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(sigPipe[i], F_SETFL, O_NONBLOCK);
+        fcntl(sigPipe[i], F_SETFD, FD_CLOEXEC);
+    }
+    g_sigchldPipe = sigPipe[1];
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSigchld;
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, nullptr);
+
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, nullptr);
+
+    struct Child {
+        std::unique_ptr<PtySession> session;
+        bool reported;
+    };
+    std::map<int, Child> children;     // by our end of the control socket
+
+    std::unique_ptr<PtyPoller> poller(PtyPoller::create());
+    poller->add(sock);
+    poller->add(sigPipe[0]);
+    std::vector<PtyPoller::Event> events(16);
+
+    bool running = true;
+    while (running) {
+        int rc = poller->wait(events.data(), (int)events.size(), -1);
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        for (int i = 0; i < rc && running; i++) {
+            int fd = events[i].fd;
+
+            if (fd == sigPipe[0]) {
+                char buf[64];
+                while (::read(sigPipe[0], buf, sizeof(buf)) > 0) {}
+
+                for (auto& pair : children) {
+                    Child& child = pair.second;
+                    if (!child.reported && !child.session->checkRunning()) {
+                        int32_t code = child.session->exitCode();
+                        sendAll(pair.first, &code, sizeof(code));
+                        child.reported = true;
+                    }
+                }
+                continue;
+            }
+
+            if (fd == sock) {
+                Request req;
+                int reply = -1;
+                int received = recvWithFds(sock, &req, sizeof(req), &reply, 1);
+                if (received != 1 || req.pathLen > 65536 || req.cwdLen > 65536 ||
+                    req.argvLen > (1u << 24) || req.envLen > (1 << 24)) {
+                    if (received > 0) ::close(reply);
+                    running = false;    // the plugin closed the channel or exited
+                    break;
+                }
+                setNoSigPipe(reply);    // the plugin may have given up waiting
+                std::string path(req.pathLen, '\0');
+                std::string cwd(req.cwdLen, '\0');
+                std::string argvBlock(req.argvLen, '\0');
+                std::string envBlock(req.envLen > 0 ? (size_t)req.envLen : 0, '\0');
+                if ((req.pathLen > 0 && !recvAll(sock, &path[0], req.pathLen)) ||
+                    (req.cwdLen > 0 && !recvAll(sock, &cwd[0], req.cwdLen)) ||
+                    (!argvBlock.empty() && !recvAll(sock, &argvBlock[0], argvBlock.size())) ||
+                    (!envBlock.empty() && !recvAll(sock, &envBlock[0], envBlock.size()))) {
+                    ::close(reply);
+                    running = false;
+                    break;
+                }
+                std::vector<std::string> env = splitBlock(envBlock);
+
+                Response resp;
+                memset(&resp, 0, sizeof(resp));
+
+                std::unique_ptr<PtySession> session(new PtySession(0));
+                session->setIoMode(req.ioMode == PtySession::kIoPipes ? PtySession::kIoPipes : PtySession::kIoTerminal);
+                session->setRawMode(req.rawMode != 0, req.vmin, req.vtime);
+                int ctl[2] = { -1, -1 };
+                bool started = session->startProcess(path.c_str(), splitBlock(argvBlock),
+                                                     req.envLen < 0 ? nullptr : &env,
+                                                     req.cols, req.rows, cwd.empty() ? nullptr : cwd.c_str());
+
+                if (started && socketpair(AF_UNIX, SOCK_STREAM, 0, ctl) == 0) {
+                    fcntl(ctl[0], F_SETFD, FD_CLOEXEC);
+                    setNoSigPipe(ctl[0]);
+                    resp.pid = (int32_t)session->pid();
+                    int fds[4] = { session->m_masterFd, ctl[1], session->m_stdinFd, session->m_stderrFd };
+                    bool pipes = (session->m_ioMode == PtySession::kIoPipes);
+                    sendWithFds(reply, &resp, sizeof(resp), fds, pipes ? 4 : 2);
+                    ::close(ctl[1]);
+                    if (pipes) {
+                        // Our copy of stdin would keep the child from ever reading end of file
+                        session->releaseFds();
+                    }
+
+                    poller->add(ctl[0]);
+                    Child& child = children[ctl[0]];
+                    child.session = std::move(session);
+                    child.reported = false;
+                } else {
+                    resp.pid = -1;
+                    std::string message = started ? std::string("socketpair failed: ") + strerror(errno)
+                                                  : session->lastError();
+                    strncpy(resp.error, message.c_str(), sizeof(resp.error) - 1);
+                    sendAll(reply, &resp, sizeof(resp));
+                    session->close();
+                }
+                ::close(reply);
+                continue;
+            }
+
+            auto it = children.find(fd);
+            if (it != children.end()) {
+                // Only hangup is expected on a control socket: the plugin closed the session
+                char buf[16];
+                ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+                if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                    it->second.session->close();
+                    poller->remove(fd);
+                    ::close(fd);
+                    children.erase(it);
+                }
+            }
+        }
+
+        if (rc == (int)events.size()) {
+            events.resize(events.size() * 2);
+        }
+    }
+
+    // Terminate what is left and give the reaper time to run its ladder
+    for (auto& pair : children) {
+        pair.second.session->close();
+    }
+    for (int i = 0; i < 100 && PtyReaper::shared().pending() > 0; i++) {
+        usleep(10000);
+    }
+    _exit(0);
+}
@@ -0,0 +1,99 @@
+/* --------------------------------------------------------------------------------
+ #
+ #  pty_zygote.h
+ #  4d-plugin-pty
+ #
+ #  Small helper process, started on first use, that spawns sessions on request
+ #
+ # --------------------------------------------------------------------------------*/
+
+#ifndef PTY_ZYGOTE_H
+#define PTY_ZYGOTE_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+class PtySession;
+
+// The helper is a separate program (pty-zygote, next to the plugin binary in the
+// bundle), started with posix_spawn on the first zygote spawn: spawns neither depend
+// on the server's size nor inherit its threads and locks, and nothing runs in a
+// forked copy of the server. For each request it opens the PTY, starts the shell and
+// sends back over a Unix socket (SCM_RIGHTS):
+//   - the master fd (kIoPipes sessions: the stdout pipe, then stdin and stderr last),
+//   - a control socket: the helper writes the child's exit code to it, and
+//     terminates the child (SIGHUP, SIGTERM, SIGKILL) once the plugin closes it.
+class PtyZygote {
+
+private:
+    // Sent with the request's own reply socket (SCM_RIGHTS), and followed by the path,
+    // the cwd, then the argv and env entries, each one NUL-terminated. envLen < 0 asks
+    // for the default session environment.
+    struct Request {
+        int16_t cols;
+        int16_t rows;
+        uint32_t pathLen;
+        uint32_t cwdLen;
+        uint32_t argvLen;
+        int32_t envLen;
+        int32_t ioMode;             // PtySession::IoMode
+        int32_t rawMode;            // PtySession::setRawMode()
+        int16_t vmin;
+        int16_t vtime;
+    };
+
+    struct Response {
+        int32_t pid;                // < 0 on failure
+        char error[200];
+    };
+
+    std::mutex m_mutex;             // held to send a request, not to wait for its reply
+    int m_socket;
+    pid_t m_pid;
+    std::string m_helperPath;       // empty: defaultHelperPath()
+
+    static const int kChannelFd = 3;    // the helper's end of the channel
+
+    bool startLocked(std::string& error);
+    void retireLocked();            // the next spawn starts another helper
+    static void serve(int sock);
+
+public:
+    // A spawn fails if the helper has not replied by then, and the helper is replaced.
+    static const int kReplyTimeoutMs = 3000;
+
+    PtyZygote();
+    ~PtyZygote();
+
+    static PtyZygote& shared();
+
+    // argv[1] of the helper program. A test binary run with it serves as the helper.
+    static const char* const kHelperArgument;
+
+    // Entry point of the helper program: serves the channel it inherits as fd 3 and
+    // exits once the plugin closes it. Returns only if not started by start().
+    static int helperMain();
+
+    // "pty-zygote" in the directory of the binary this code is linked into.
+    static std::string defaultHelperPath();
+    void setHelperPath(const std::string& path);
+
+    // Starts the helper unless it is running. spawn() does it on first use.
+    bool start();
+    // Closes the channel; the helper terminates its remaining children and exits.
+    void stop();
+    bool isRunning();
+    pid_t pid();                    // -1 if not running
+
+    // Called by PtySession::startProcess() with the same arguments: starts the program
+    // with the session's settings (size, I/O and terminal modes) and stores the received
+    // fds, all close-on-exec, in the session. Returns the child pid, or -1 with the
+    // session's last error set.
+    pid_t spawn(PtySession* session, const char* path, const std::vector<std::string>& argv,
+                const std::vector<std::string>* env, const char* cwd);
+};
+
+#endif /* PTY_ZYGOTE_H */
@@ -0,0 +1,22 @@
+/* --------------------------------------------------------------------------------
+ #
+ #  pty_zygote_helper.cpp
+ #  4d-plugin-pty
+ #
+ #  The pty-zygote program, copied next to the plugin binary in the bundle
+ #
+ # --------------------------------------------------------------------------------*/
+
+#include "pty_zygote.h"
+
+#include <cstdio>
+#include <cstring>
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2 || strcmp(argv[1], PtyZygote::kHelperArgument) != 0) {
+        fprintf(stderr, "pty-zygote: started by the PTY plugin only\n");
+        return 2;
+    }
+    return PtyZygote::helperMain();
+}
@@ -5,17 +5,50 @@
  #
  #  Build & run:
  #    cd /Users/eric/Downloads/4d-plugin-pty/4d-plugin-pty
- #    c++ -std=c++17 -o test_pty test_pty.cpp pty_session.cpp && ./test_pty
+ #    c++ -std=c++17 -o test_pty test_pty.cpp pty_session.cpp pty_poller.cpp pty_ring_buffer.cpp \
+ #        pty_event_loop.cpp pty_pool.cpp pty_reaper.cpp pty_registry.cpp \
+ #        pty_zygote.cpp pty_vt_parser.cpp pty_ansi_stripper.cpp pty_screen.cpp \
+ #        pty_scrollback.cpp lz4_block.cpp base64.cpp utf8.cpp && ./test_pty
  #
  # --------------------------------------------------------------------------------*/
 
 #include "pty_session.h"
-
+#include "pty_poller.h"
+#include "pty_ring_buffer.h"
+#include "pty_event_loop.h"
+#include "pty_pool.h"
+#include "pty_reaper.h"
+#include "pty_registry.h"
+#include "pty_zygote.h"
+#include "base64.h"
+#include "utf8.h"
+#include "pty_vt_parser.h"
+#include "pty_ansi_stripper.h"
+#include "pty_screen.h"
+#include "pty_scrollback.h"
+#include "lz4_block.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 #include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
 #include <signal.h>
+#include <sys/resource.h>
+#if defined(__APPLE__)
+#include <libproc.h>
+#endif
+#include <sys/select.h>
+#include <sys/time.h>
 
 // ---- helpers ----------------------------------------------------------------
 
@@ -343,9 +376,1545 @@ static void test_bad_shell_path() {
     printf("\n");
 }
 
+static void test_spawn_methods() {
+    printf("\n--- test_spawn_methods (posix_spawn/vfork vs fork) ---\n");
+
+    const PtySession::SpawnMethod methods[] = { PtySession::kSpawnDefault, PtySession::kSpawnFork };
+    const char* names[] = { "spawn", "fork" };
+
+    for (int m = 0; m < 2; m++) {
+        PtySession pty(16 + m);
+        pty.setSpawnMethod(methods[m]);
+        bool ok = pty.start("/bin/zsh", 80, 24, "/tmp");
+        char label[96];
+        snprintf(label, sizeof(label), "%s: started", names[m]);
+        check(ok, label);
+        usleep(300000);
+        while (!pty.read(4096, 100).empty()) {}
+
+        // /dev/tty can only be opened by a process that has a controlling terminal
+        const char* cmd = "(: </dev/tty) 2>/dev/null && echo ctty_$((1+1)); echo term_$TERM; echo cwd_$PWD\n";
+        pty.write(cmd, strlen(cmd));
+
+        std::string all;
+        for (int i = 0; i < 20 && all.find("cwd_/tmp") == std::string::npos; i++) {
+            all += stripAnsi(pty.read(4096, 200));
+        }
+        snprintf(label, sizeof(label), "%s: slave is the controlling terminal", names[m]);
+        check(all.find("ctty_2") != std::string::npos, label);
+        snprintf(label, sizeof(label), "%s: session environment applied", names[m]);
+        check(all.find("term_xterm-256color") != std::string::npos, label);
+        snprintf(label, sizeof(label), "%s: started in cwd", names[m]);
+        check(all.find("cwd_/tmp") != std::string::npos, label);
+
+        pty.close();
+    }
+    printf("\n");
+}
+
+static void test_zygote() {
+    printf("\n--- test_zygote (sessions spawned by the helper) ---\n");
+
+    check(!PtyZygote::shared().isRunning(), "helper not started before the first zygote spawn");
+
+    PtySession pty(18);
+    pty.setSpawnMethod(PtySession::kSpawnZygote);
+    bool ok = pty.start("/bin/zsh", 100, 30, "/tmp");
+    check(ok, "start() through the helper");
+    check(PtyZygote::shared().isRunning(), "helper started on first use");
+    check(pty.pid() > 0 && pty.checkRunning(), "child running");
+    usleep(300000);
+    while (!pty.read(4096, 100).empty()) {}
+
+    const char* cmd = "(: </dev/tty) 2>/dev/null && echo ctty_$((1+1)); stty size; echo cwd_$PWD\n";
+    pty.write(cmd, strlen(cmd));
+    std::string all;
+    for (int i = 0; i < 20 && all.find("cwd_/tmp") == std::string::npos; i++) {
+        all += stripAnsi(pty.read(4096, 200));
+    }
+    check(all.find("ctty_2") != std::string::npos, "slave is the controlling terminal");
+    check(all.find("30 100") != std::string::npos, "window size applied");
+    check(all.find("cwd_/tmp") != std::string::npos, "started in cwd");
+
+    // The exit code comes back from the helper, which reaps the child
+    cmd = "exit 3\n";
+    pty.write(cmd, strlen(cmd));
+    for (int i = 0; i < 100 && pty.checkRunning(); i++) usleep(10000);
+    check(!pty.isRunning() && pty.exitCode() == 3, "exit code reported by the helper");
+    pty.close();
+
+    // Closing the session makes the helper terminate the child
+    PtySession other(19);
+    other.setSpawnMethod(PtySession::kSpawnZygote);
+    other.start("/bin/zsh", 80, 24);
+    pid_t pid = other.pid();
+    other.close();
+    bool gone = false;
+    for (int i = 0; i < 100 && !gone; i++) {
+        usleep(10000);
+        gone = (kill(pid, 0) != 0);
+    }
+    check(gone, "child terminated after close");
+
+    PtySession bad(20);
+    bad.setSpawnMethod(PtySession::kSpawnZygote);
+    check(!bad.start("/nonexistent/shell", 80, 24) && !bad.lastError().empty(), "spawn error reported");
+
+    // A helper that stops answering: the spawn gives up at its deadline without
+    // holding up other callers, and the next spawn starts another helper
+    pid_t helper = PtyZygote::shared().pid();
+    kill(helper, SIGSTOP);
+    std::atomic<bool> stuckDone(false);
+    bool stuckOk = true;
+    std::string stuckError;
+    auto t0 = std::chrono::steady_clock::now();
+    std::thread stuck([&] {
+        PtySession s(21);
+        s.setSpawnMethod(PtySession::kSpawnZygote);
+        stuckOk = s.start("/bin/zsh", 80, 24);
+        stuckError = s.lastError();
+        s.close();
+        stuckDone = true;
+    });
+    usleep(200000);
+    auto t1 = std::chrono::steady_clock::now();
+    PtyZygote::shared().isRunning();
+    auto lockMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t1).count();
+    check(!stuckDone && lockMs < 100, "zygote not locked while a reply is awaited");
+    stuck.join();
+    auto stuckMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+    check(!stuckOk && stuckError.find("in time") != std::string::npos &&
+          stuckMs >= PtyZygote::kReplyTimeoutMs - 50 && stuckMs < PtyZygote::kReplyTimeoutMs + 1000,
+          "spawn fails at the reply deadline");
+
+    PtySession again(22);
+    again.setSpawnMethod(PtySession::kSpawnZygote);
+    check(again.start("/bin/zsh", 80, 24) && PtyZygote::shared().pid() != helper, "another helper started");
+    again.close();
+    gone = false;
+    for (int i = 0; i < 100 && !gone; i++) {
+        usleep(10000);
+        gone = (kill(helper, 0) != 0);
+    }
+    check(gone, "stuck helper terminated");
+    printf("\n");
+}
+
+// Reads until the session's program ends; returns everything it printed.
+static std::string readUntilExit(PtySession& pty) {
+    std::string all;
+    for (int i = 0; i < 100; i++) {
+        std::string chunk = pty.read(4096, 100);
+        all += chunk;
+        if (chunk.empty()) {
+            if (!pty.checkRunning()) break;
+            usleep(10000);  // a hung-up terminal reads empty right away
+        }
+    }
+    return all;
+}
+
+static void test_start_process() {
+    printf("\n--- test_start_process (argv and env without a shell) ---\n");
+
+    const PtySession::SpawnMethod methods[] = { PtySession::kSpawnDefault, PtySession::kSpawnFork, PtySession::kSpawnZygote };
+    const char* names[] = { "spawn", "fork", "zygote" };
+
+    for (int m = 0; m < 3; m++) {
+        printf("  [%s]\n", names[m]);
+
+        // Arguments reach the program as given: no word splitting, no expansion
+        std::vector<std::string> argv = { "sh", "-c", "printf '<%s>' \"$1\" \"$2\"; echo \" foo=$FOO term=$TERM\"", "sh", "two words", "$HOME" };
+        std::vector<std::string> env = { "FOO=bar", "PATH=/usr/bin:/bin" };
+
+        PtySession pty(21 + m);
+        pty.setSpawnMethod(methods[m]);
+        check(pty.startProcess("/bin/sh", argv, &env, 80, 24, "/tmp"), "startProcess()");
+        std::string out = readUntilExit(pty);
+        check(out.find("<two words><$HOME>") != std::string::npos, "argv passed verbatim");
+        check(out.find("foo=bar term=\r\n") != std::string::npos, "env replaces the default environment");
+        check(!pty.isRunning() && pty.exitCode() == 0, "exit code of the program");
+        pty.close();
+
+        // Bare names are looked up in the PATH of the child's environment
+        PtySession lookup(24 + m);
+        lookup.setSpawnMethod(methods[m]);
+        std::vector<std::string> pwdArgv = { "pwd" };
+        check(lookup.startProcess("pwd", pwdArgv, &env, 80, 24, "/tmp"), "startProcess() with a bare name");
+        out = readUntilExit(lookup);
+        check(out.find("/tmp") != std::string::npos, "found in PATH, started in cwd");
+        lookup.close();
+
+        // Default environment when env is null
+        PtySession defaults(27 + m);
+        defaults.setSpawnMethod(methods[m]);
+        std::vector<std::string> termArgv = { "sh", "-c", "echo term=$TERM" };
+        defaults.startProcess("/bin/sh", termArgv, nullptr, 80, 24);
+        out = readUntilExit(defaults);
+        check(out.find("term=xterm-256color") != std::string::npos, "default environment");
+        defaults.close();
+
+        PtySession missing(30 + m);
+        missing.setSpawnMethod(methods[m]);
+        std::vector<std::string> none;
+        if (missing.startProcess("no_such_program_pty", none, &env, 80, 24)) {
+            readUntilExit(missing);
+            check(!missing.isRunning() && missing.exitCode() == 127, "missing program exits with 127");
+        } else {
+            check(!missing.lastError().empty(), "missing program reported");
+        }
+        missing.close();
+    }
+    printf("\n");
+}
+
+static void test_pipe_session() {
+    printf("\n--- test_pipe_session (no terminal, stdout and stderr apart) ---\n");
+
+    const PtySession::SpawnMethod methods[] = { PtySession::kSpawnDefault, PtySession::kSpawnFork, PtySession::kSpawnZygote };
+    const char* names[] = { "spawn", "fork", "zygote" };
+
+    for (int m = 0; m < 3; m++) {
+        printf("  [%s]\n", names[m]);
+
+        PtySession pty(40 + m);
+        pty.setIoMode(PtySession::kIoPipes);
+        pty.setSpawnMethod(methods[m]);
+        std::vector<std::string> argv = { "sh", "-c", "echo out_1; echo err_1 >&2; read x; echo got_$x; [ -t 0 ] || echo no_tty; exit 4" };
+        check(pty.startProcess("/bin/sh", argv, nullptr, 80, 24), "startProcess() with pipes");
+        check(pty.ioMode() == PtySession::kIoPipes, "ioMode() is kIoPipes");
+
+        std::string out = pty.read(4096, 2000);
+        std::string err = pty.read(4096, 2000, PtySession::kStderr);
+        check(out == "out_1\n", "stdout read alone, no CR added");
+        check(err == "err_1\n", "stderr read separately");
+
+        const char* line = "hi\n";
+        check(pty.write(line, strlen(line)) == 3, "write() feeds stdin");
+        out.clear();
+        for (int i = 0; i < 20 && out.find("no_tty") == std::string::npos; i++) {
+            out += pty.read(4096, 100);
+        }
+        check(out == "got_hi\nno_tty\n", "input not echoed, stdin is not a terminal");
+        readUntilExit(pty);
+        check(pty.exitCode() == 4, "exit code");
+        check(pty.write(line, strlen(line)) < 0, "write() after exit fails without SIGPIPE");
+        pty.close();
+
+        // End of input lets a filter finish
+        PtySession filter(43 + m);
+        filter.setIoMode(PtySession::kIoPipes);
+        filter.setSpawnMethod(methods[m]);
+        std::vector<std::string> wc = { "wc", "-c" };
+        filter.startProcess("wc", wc, nullptr, 80, 24);
+        filter.write("abcdef", 6);
+        check(filter.closeInput(), "closeInput()");
+        out = readUntilExit(filter);
+        check(out.find("6") != std::string::npos, "filter saw end of file");
+        check(filter.exitCode() == 0, "filter exited");
+        filter.close();
+    }
+
+    // Terminal sessions have no separate stderr and no input to close
+    PtySession tty(46);
+    tty.start("/bin/zsh", 80, 24);
+    check(tty.read(4096, 100, PtySession::kStderr).empty(), "kStderr empty on a terminal");
+    check(!tty.closeInput(), "closeInput() refused on a terminal");
+    tty.close();
+    printf("\n");
+}
+
+static void test_raw_mode() {
+    printf("\n--- test_raw_mode (cfmakeraw settings, VMIN/VTIME) ---\n");
+
+    const PtySession::SpawnMethod methods[] = { PtySession::kSpawnDefault, PtySession::kSpawnFork, PtySession::kSpawnZygote };
+    const char* names[] = { "spawn", "fork", "zygote" };
+
+    for (int m = 0; m < 3; m++) {
+        printf("  [%s]\n", names[m]);
+
+        // Control characters reach the program as data, and nothing is echoed
+        PtySession pty(50 + m);
+        pty.setRawMode(true);
+        pty.setSpawnMethod(methods[m]);
+        std::vector<std::string> argv = { "sh", "-c", "head -c 4 | od -An -tx1; printf 'a\\nb'" };
+        check(pty.startProcess("/bin/sh", argv, nullptr, 80, 24), "startProcess() in raw mode");
+        pty.write("\x03\x04\r\n", 4);
+        std::string out = readUntilExit(pty);
+        check(out.find("03 04 0d 0a") != std::string::npos, "Ctrl-C, Ctrl-D and CR passed through");
+        check(out.find("a\nb") != std::string::npos, "no CR added before LF");
+        check(out.find("\x03") == std::string::npos, "input not echoed");
+        pty.close();
+
+        PtySession timed(53 + m);
+        timed.setRawMode(true, 5, 2);
+        timed.setSpawnMethod(methods[m]);
+        std::vector<std::string> stty = { "stty", "-a" };
+        timed.startProcess("stty", stty, nullptr, 80, 24);
+        out = readUntilExit(timed);
+        check(out.find("min = 5") != std::string::npos && out.find("time = 2") != std::string::npos, "VMIN and VTIME applied");
+        check(out.find("-icanon") != std::string::npos && out.find("-echo ") != std::string::npos, "canonical mode and echo off");
+        timed.close();
+    }
+
+    // Default sessions keep the cooked line discipline
+    PtySession cooked(56);
+    std::vector<std::string> argv = { "sh", "-c", "printf 'a\\nb'" };
+    cooked.startProcess("/bin/sh", argv, nullptr, 80, 24);
+    check(readUntilExit(cooked).find("a\r\nb") != std::string::npos, "cooked mode still maps LF to CR LF");
+    cooked.close();
+    printf("\n");
+}
+
+static void test_coalescing() {
+    printf("\n--- test_coalescing (small writes batched into one read) ---\n");
+
+    PtyEventLoop loop;
+    loop.start();
+    const PtySession::ReaderMode modes[] = { PtySession::kReaderSync, PtySession::kReaderThread, PtySession::kReaderLoop };
+    const char* names[] = { "sync", "thread", "loop" };
+    std::vector<std::string> argv = { "sh", "-c", "sleep 0.2; for i in 1 2 3 4 5 6 7 8; do printf f$i.; sleep 0.005; done; sleep 1" };
+
+    for (int m = 0; m < 3; m++) {
+        printf("  [%s]\n", names[m]);
+
+        PtySession plain(60 + m);
+        plain.setReaderMode(modes[m], PtySession::kDefaultRingSize, &loop);
+        plain.startProcess("/bin/sh", argv, nullptr, 80, 24);
+        std::string first = plain.read(4096, 2000);
+        check(first == "f1.", "without a window the first fragment comes alone");
+        plain.close();
+
+        PtySession batched(63 + m);
+        batched.setReaderMode(modes[m], PtySession::kDefaultRingSize, &loop);
+        batched.setCoalescing(500);
+        batched.startProcess("/bin/sh", argv, nullptr, 80, 24);
+        first = batched.read(4096, 2000);
+        check(first == "f1.f2.f3.f4.f5.f6.f7.f8.", "the whole burst in one read");
+        batched.close();
+
+        // The byte threshold ends the window early
+        PtySession bounded(66 + m);
+        bounded.setReaderMode(modes[m], PtySession::kDefaultRingSize, &loop);
+        bounded.setCoalescing(2000, 6);
+        bounded.startProcess("/bin/sh", argv, nullptr, 80, 24);
+        bounded.read(4096, 0);
+        auto t0 = std::chrono::steady_clock::now();
+        first = bounded.read(4096, 2000);
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+        check(first.size() >= 6 && first.compare(0, 6, "f1.f2.") == 0, "at least coalesceBytes returned");
+        check(ms < 1000, "returned before the window closed");
+        bounded.close();
+    }
+    loop.stop();
+    printf("\n");
+}
+
+static void test_gather_read() {
+    printf("\n--- test_gather_read (read until maxBytes or the deadline) ---\n");
+
+    PtyEventLoop loop;
+    loop.start();
+    const PtySession::ReaderMode modes[] = { PtySession::kReaderSync, PtySession::kReaderThread, PtySession::kReaderLoop };
+    const char* names[] = { "sync", "thread", "loop" };
+    std::vector<std::string> burst = { "sh", "-c", "sleep 0.2; for i in 1 2 3 4 5; do printf c$i.; sleep 0.05; done" };
+    std::vector<std::string> slow = { "sh", "-c", "sleep 0.2; while :; do printf x; sleep 0.05; done" };
+
+    for (int m = 0; m < 3; m++) {
+        printf("  [%s]\n", names[m]);
+
+        PtySession first(70 + m);
+        first.setReaderMode(modes[m], PtySession::kDefaultRingSize, &loop);
+        first.startProcess("/bin/sh", burst, nullptr, 80, 24);
+        check(first.read(4096, 2000) == "c1.", "default returns on first data");
+        first.close();
+
+        // Until the output ends
+        PtySession all(73 + m);
+        all.setReaderMode(modes[m], PtySession::kDefaultRingSize, &loop);
+        all.setReturnOnFirstData(false);
+        all.startProcess("/bin/sh", burst, nullptr, 80, 24);
+        check(all.read(4096, 3000) == "c1.c2.c3.c4.c5.", "gathered until the program ended");
+        all.close();
+
+        // Until the deadline
+        PtySession timed(76 + m);
+        timed.setReaderMode(modes[m], PtySession::kDefaultRingSize, &loop);
+        timed.setReturnOnFirstData(false);
+        timed.startProcess("/bin/sh", slow, nullptr, 80, 24);
+        auto t0 = std::chrono::steady_clock::now();
+        std::string out = timed.read(4096, 600);
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+        check(ms >= 590 && ms < 900, "returned at the deadline");
+        check(out.size() >= 3, "gathered output arriving during the timeout");
+
+        // Until maxBytes
+        t0 = std::chrono::steady_clock::now();
+        out = timed.read(3, 5000);
+        ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+        check(out == "xxx" && ms < 1000, "returned once maxBytes gathered");
+        timed.close();
+    }
+    loop.stop();
+    printf("\n");
+}
+
+static void test_read_into_buffer() {
+    printf("\n--- test_read_into_buffer (caller-owned buffers) ---\n");
+
+    const PtySession::ReaderMode modes[] = { PtySession::kReaderSync, PtySession::kReaderThread };
+    const char* names[] = { "sync", "thread" };
+    std::vector<std::string> argv = { "sh", "-c", "printf abc; sleep 0.3; printf '\\303\\251t\\303'; sleep 0.3; printf '\\251'" };
+
+    for (int m = 0; m < 2; m++) {
+        printf("  [%s]\n", names[m]);
+
+        PtySession pty(80 + m);
+        pty.setReaderMode(modes[m]);
+        pty.startProcess("/bin/sh", argv, nullptr, 80, 24);
+
+        // Only the bytes received are written: the rest of the buffer is untouched
+        char buf[64];
+        memset(buf, '#', sizeof(buf));
+        size_t n = pty.read(buf, 32, 2000);
+        check(n == 3 && memcmp(buf, "abc", 3) == 0, "read() returns the byte count");
+        check(buf[3] == '#' && buf[31] == '#', "bytes past the count not written");
+
+        // The split code point is held back, then returned whole
+        n = pty.readText(buf, 32, 2000);
+        check(n == 3 && memcmp(buf, "\xC3\xA9t", 3) == 0, "readText() keeps the partial sequence back");
+        n = pty.readText(buf, 32, 2000);
+        check(n == 2 && memcmp(buf, "\xC3\xA9", 2) == 0, "carried bytes prepended in the caller's buffer");
+
+        check(pty.read(buf, 32, 0) == 0, "0 when nothing is available");
+        pty.close();
+        check(pty.read(buf, 32, 100) == 0, "0 once closed");
+    }
+    printf("\n");
+}
+
+static void test_high_fd_numbers() {
+    printf("\n--- test_high_fd_numbers (fds above FD_SETSIZE) ---\n");
+
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    if (rl.rlim_cur < FD_SETSIZE + 64) {
+        rl.rlim_cur = (rl.rlim_max < FD_SETSIZE + 64) ? rl.rlim_max : FD_SETSIZE + 64;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    if (rl.rlim_cur < FD_SETSIZE + 16) {
+        check(true, "RLIMIT_NOFILE too low to test (skipped)");
+        return;
+    }
+
+    // Occupy the low descriptors so the session's master fd lands above FD_SETSIZE
+    std::vector<int> filler;
+    int fd;
+    while ((fd = open("/dev/null", O_RDONLY)) >= 0 && fd < FD_SETSIZE + 8) {
+        filler.push_back(fd);
+    }
+    if (fd >= 0) filler.push_back(fd);
+
+    PtySession pty(11);
+    bool ok = pty.start("/bin/zsh", 80, 24);
+    check(ok, "start() with fds above FD_SETSIZE");
+
+    const char* cmd = "echo high_fd_ok\n";
+    pty.write(cmd, strlen(cmd));
+
+    std::string all;
+    for (int i = 0; i < 10 && all.find("high_fd_ok\r\n") == std::string::npos; i++) {
+        all += stripAnsi(pty.read(4096, 500));
+    }
+    check(all.find("high_fd_ok") != std::string::npos, "read works on a high fd");
+
+    pty.close();
+    for (int f : filler) close(f);
+    printf("\n");
+}
+
+static void test_poller_concurrent_wait() {
+    printf("\n--- test_poller_concurrent_wait (one poller, several readers) ---\n");
+
+    const PtyPoller::Backend backends[] = { PtyPoller::kBackendPoll, PtyPoller::kBackendSelect, PtyPoller::kBackendEpoll };
+    for (PtyPoller::Backend backend : backends) {
+        std::unique_ptr<PtyPoller> poller(PtyPoller::create(backend));
+        if (!poller) continue;
+
+        int fds[2];
+        if (pipe(fds) != 0) continue;
+        if (write(fds[1], "x", 1) != 1) continue;
+        poller->add(fds[0]);
+
+        // Threads share the poller as two 4D processes share a session's
+        std::atomic<int> readable(0);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&] {
+                for (int i = 0; i < 2000; i++) {
+                    PtyPoller::Event ev;
+                    if (poller->wait(&ev, 1, 0) == 1 && ev.fd == fds[0] && ev.readable) readable++;
+                }
+            });
+        }
+        for (std::thread& t : threads) t.join();
+
+        std::string label = std::string(PtyPoller::backendName(backend)) + ": concurrent wait() calls all see the fd";
+        check(readable == 8000, label.c_str());
+        close(fds[0]);
+        close(fds[1]);
+    }
+    printf("\n");
+}
+
+// Number of open descriptors of another process, -1 if it cannot be inspected.
+static int countProcessFds(pid_t pid) {
+#if defined(__APPLE__)
+    int size = proc_pidinfo(pid, PROC_PIDLISTFDS, 0, nullptr, 0);
+    if (size <= 0) return -1;
+    std::vector<struct proc_fdinfo> fds(size / sizeof(struct proc_fdinfo) + 16);
+    size = proc_pidinfo(pid, PROC_PIDLISTFDS, 0, fds.data(), (int)(fds.size() * sizeof(struct proc_fdinfo)));
+    return (size < 0) ? -1 : size / (int)sizeof(struct proc_fdinfo);
+#else
+    std::string dir = "/proc/" + std::to_string(pid) + "/fd";
+    DIR* d = opendir(dir.c_str());
+    if (d == nullptr) return -1;
+    int count = 0;
+    while (struct dirent* entry = readdir(d)) {
+        if (entry->d_name[0] != '.') count++;
+    }
+    closedir(d);
+    return count;
+#endif
+}
+
+static void test_child_fds() {
+    printf("\n--- test_child_fds (1000 sessions, children only keep stdio) ---\n");
+
+    const int kSessions = 1000;
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    if (rl.rlim_cur < (rlim_t)kSessions * 6) {
+        rl.rlim_cur = (rl.rlim_max < (rlim_t)kSessions * 6) ? rl.rlim_max : (rlim_t)kSessions * 6;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    if (rl.rlim_cur < (rlim_t)kSessions * 6) {
+        check(true, "RLIMIT_NOFILE too low to test (skipped)");
+        return;
+    }
+
+    // Descriptors a 4D server would have open without FD_CLOEXEC
+    int leak[2];
+    check(pipe(leak) == 0, "inheritable pipe opened");
+    int file = open("/dev/null", O_RDONLY);
+
+    const PtySession::SpawnMethod methods[] = { PtySession::kSpawnDefault, PtySession::kSpawnFork, PtySession::kSpawnZygote };
+    std::vector<std::unique_ptr<PtySession> > sessions;
+    std::vector<std::string> argv = { "cat" };
+    int started = 0, inspected = 0, clean = 0;
+
+    for (int i = 0; i < kSessions; i++) {
+        std::unique_ptr<PtySession> pty(new PtySession(1000 + i));
+        pty->setSpawnMethod(methods[i % 3]);
+        if (!pty->startProcess("/bin/cat", argv, nullptr, 80, 24)) {
+            continue;
+        }
+        started++;
+
+        // Right after fork the child still has the parent's table: wait for exec
+        int count = -1;
+        for (int t = 0; t < 100; t++) {
+            count = countProcessFds(pty->pid());
+            if (count == 3) break;
+            usleep(1000);
+        }
+        if (count >= 0) inspected++;
+        if (count == 3) clean++;
+        sessions.push_back(std::move(pty));
+    }
+
+    printf("  %d started, %d inspected, %d with only stdio open\n", started, inspected, clean);
+    check(started == kSessions, "1000 sessions started");
+    if (inspected == 0) {
+        check(true, "child descriptors cannot be listed here (skipped)");
+    } else {
+        check(clean == inspected, "no child inherited other descriptors");
+    }
+
+    for (auto& pty : sessions) {
+        pty->close();
+    }
+    sessions.clear();
+    ::close(leak[0]);
+    ::close(leak[1]);
+    ::close(file);
+    printf("\n");
+}
+
+static void test_ring_buffer() {
+    printf("\n--- test_ring_buffer ---\n");
+
+    PtyRingBuffer ring(4096);
+    check(ring.capacity() == 4096, "capacity rounded to 4096");
+
+    std::string chunk(3000, 'a');
+    check(ring.write(chunk.data(), chunk.size()) == 3000, "first write fits");
+    check(ring.write(chunk.data(), chunk.size()) == 1096, "second write truncated at capacity");
+    check(ring.space() == 0, "ring full");
+
+    char out[4096];
+    check(ring.read(out, 2000) == 2000, "partial read");
+
+    // This write wraps around the end of the storage
+    std::string wrap;
+    for (int i = 0; i < 2000; i++) wrap += (char)('A' + i % 26);
+    check(ring.write(wrap.data(), wrap.size()) == 2000, "wrapping write");
+
+    size_t n = ring.read(out, sizeof(out));
+    check(n == 4096, "read everything back");
+    check(std::string(out + 2096, 2000) == wrap, "wrapped data intact");
+    check(ring.empty(), "ring empty after read");
+    printf("\n");
+}
+
+static void test_reader_thread() {
+    printf("\n--- test_reader_thread (buffered mode) ---\n");
+
+    PtySession pty(12);
+    pty.setReaderMode(PtySession::kReaderThread, 64 * 1024);
+    bool ok = pty.start("/bin/zsh", 80, 24);
+    check(ok, "start() in thread mode");
+    pty.read(4096, 1000); // drain prompt
+
+    // Produce more than the ring holds without reading, then drain it all
+    const char* cmd = "head -c 200000 /dev/zero | tr '\\0' 'z'; echo; echo reader_$((40+2))\n";
+    pty.write(cmd, strlen(cmd));
+    usleep(300000);
+
+    size_t zs = 0;
+    std::string tail;
+    for (int i = 0; i < 200 && tail.find("reader_42") == std::string::npos; i++) {
+        std::string chunk = pty.read(65536, 1000);
+        for (char c : chunk) if (c == 'z') zs++;
+        tail = (tail + chunk).substr(tail.size() + chunk.size() > 64 ? tail.size() + chunk.size() - 64 : 0);
+    }
+    check(zs >= 200000, "all output delivered through the ring");
+    check(tail.find("reader_42") != std::string::npos, "got trailing marker");
+
+    // A blocking read must be woken when the session is closed
+    pty.close();
+    check(pty.read(4096, -1).empty(), "read after close returns empty");
+
+    // Two readers of one ring, in small chunks: every byte is read exactly once
+    PtyEventLoop loop;
+    loop.start();
+    const PtySession::ReaderMode modes[] = { PtySession::kReaderThread, PtySession::kReaderLoop };
+    const char* names[] = { "thread", "loop" };
+    std::string expected;
+    for (int i = 0; i < 40; i++) {
+        char line[32];
+        snprintf(line, sizeof(line), "ring %02d abcdefghij\n", i);
+        expected += line;
+    }
+    for (int m = 0; m < 2; m++) {
+        PtySession shared(97 + m);
+        shared.setIoMode(PtySession::kIoPipes);
+        shared.setReaderMode(modes[m], 64 * 1024, &loop);
+        std::vector<std::string> awkArgv = { "awk", "BEGIN { for (i = 0; i < 40; i++) printf \"ring %02d abcdefghij\\n\", i }" };
+        shared.startProcess("awk", awkArgv, nullptr, 80, 24);
+        std::string got[2];
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 2; t++) {
+            readers.emplace_back([&shared, &got, t] {
+                char buf[7];
+                for (int i = 0; i < 2000; i++) {
+                    size_t n = shared.read(buf, sizeof(buf), 50);
+                    got[t].append(buf, n);
+                    if (n == 0 && !shared.checkRunning()) break;
+                }
+            });
+        }
+        for (std::thread& t : readers) t.join();
+
+        std::string all = got[0] + got[1];
+        std::string sortedAll = all, sortedExpected = expected;
+        std::sort(sortedAll.begin(), sortedAll.end());
+        std::sort(sortedExpected.begin(), sortedExpected.end());
+        check(all.size() == expected.size() && sortedAll == sortedExpected,
+              (std::string(names[m]) + " mode: concurrent readers share the output without duplicates").c_str());
+        shared.close();
+    }
+    loop.stop();
+    printf("\n");
+}
+
+static void test_event_loop() {
+    printf("\n--- test_event_loop (shared I/O thread) ---\n");
+
+    PtyEventLoop loop;
+    check(loop.start(), "loop started");
+
+    const int count = 3;
+    PtySession* sessions[count];
+    std::vector<int> ids;
+    for (int i = 0; i < count; i++) {
+        sessions[i] = new PtySession(100 + i);
+        sessions[i]->setReaderMode(PtySession::kReaderLoop, 64 * 1024, &loop);
+        sessions[i]->start("/bin/zsh", 80, 24);
+        ids.push_back(100 + i);
+    }
+    check(sessions[0]->readerMode() == PtySession::kReaderLoop, "session in loop mode");
+
+    // Drain every prompt
+    usleep(500000);
+    for (int i = 0; i < count; i++) {
+        while (!sessions[i]->read(65536, 100).empty()) {}
+    }
+
+    std::vector<int> ready;
+    check(!loop.waitAny(ids, 200, ready), "waitAny times out when idle");
+
+    const char* cmd = "echo loop_$((20+1))\n";
+    sessions[1]->write(cmd, strlen(cmd));
+
+    bool got = loop.waitAny(ids, 2000, ready);
+    check(got && ready.size() == 1 && ready[0] == 101, "waitAny reports only the active session");
+
+    std::string all;
+    for (int i = 0; i < 10 && all.find("loop_21") == std::string::npos; i++) {
+        all += stripAnsi(sessions[1]->read(4096, 500));
+    }
+    check(all.find("loop_21") != std::string::npos, "output read from the loop buffer");
+
+    for (int i = 0; i < count; i++) {
+        sessions[i]->close();
+        delete sessions[i];
+    }
+
+    // Sessions the loop does not know: the full timeout still passes (no busy loop)
+    auto t0 = std::chrono::steady_clock::now();
+    bool none = !loop.waitAny(ids, 200, ready) && !loop.waitAny(std::vector<int>(), 200, ready);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+    check(none && ms >= 390, "waitAny waits the timeout for detached or no sessions");
+
+    loop.stop();
+    printf("\n");
+}
+
+// The original bit-at-a-time encoder, kept as the reference implementation
+static std::string legacyBase64(const std::string &in) {
+    static const std::string b = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    int val=0, valb=-6;
+    for (unsigned char c : in) {
+        val = (val<<8) + c;
+        valb += 8;
+        while (valb>=0) {
+            out.push_back(b[(val>>valb)&0x3F]);
+            valb-=6;
+        }
+    }
+    if (valb>-6) out.push_back(b[((val<<8)>>(valb+8))&0x3F]);
+    while (out.size()%4) out.push_back('=');
+    return out;
+}
+
+static void test_base64_equivalence() {
+    printf("\n--- test_base64_equivalence (%s) ---\n", base64_implementation());
+
+    srand(1234);
+    int mismatches = 0;
+    std::vector<char> buf;
+
+    for (int round = 0; round < 5000; round++) {
+        size_t len = (round < 300) ? (size_t)round : (size_t)(rand() % 70000);
+        std::string in(len, '\0');
+        for (size_t i = 0; i < len; i++) in[i] = (char)(rand() & 0xFF);
+
+        std::string expected = legacyBase64(in);
+
+        buf.assign(base64_encoded_length(len) + 1, '#');
+        size_t n = base64_encode_scalar((const uint8_t*)in.data(), len, buf.data());
+        bool ok = (n == expected.size()) && std::string(buf.data(), n) == expected && buf[n] == '#';
+
+        buf.assign(base64_encoded_length(len) + 1, '#');
+        n = base64_encode((const uint8_t*)in.data(), len, buf.data());
+        ok = ok && (n == expected.size()) && std::string(buf.data(), n) == expected && buf[n] == '#';
+
+        ok = ok && base64_encode(in) == expected;
+
+        std::vector<uint16_t> wide(base64_encoded_length(len) + 1, 0xFFFF);
+        n = base64_encode_utf16((const uint8_t*)in.data(), len, wide.data());
+        ok = ok && (n == expected.size()) && wide[n] == 0xFFFF;
+        for (size_t i = 0; ok && i < n; i++) ok = (wide[i] == (uint16_t)(unsigned char)expected[i]);
+
+        if (!ok) mismatches++;
+    }
+
+    check(mismatches == 0, "dispatched, scalar and UTF-16 encoders match the reference on random input");
+    printf("\n");
+}
+
+static void test_close_during_read() {
+    printf("\n--- test_close_during_read (shared ownership) ---\n");
+
+    // Mirrors the plugin: PTY Read holds its own reference while PTY Close drops the registry's
+    std::shared_ptr<PtySession> pty = std::make_shared<PtySession>(14);
+    pty->start("/bin/zsh", 80, 24);
+    usleep(300000);
+    while (!pty->read(4096, 100).empty()) {} // drain prompt
+
+    std::weak_ptr<PtySession> watch = pty;
+    std::atomic<bool> returned(false);
+    std::thread reader([ref = pty, &returned]() mutable {
+        ref->read(4096, -1);
+        returned = true;
+        ref.reset();
+    });
+
+    usleep(200000);
+    check(!returned, "reader blocked in read()");
+
+    pty->close();
+    pty.reset();
+    reader.join();
+    check(returned, "close() woke the blocked reader");
+    check(watch.expired(), "session freed once the reader released it");
+    printf("\n");
+}
+
+static void test_session_registry() {
+    printf("\n--- test_session_registry (sharded table) ---\n");
+
+    PtyRegistry registry;
+    int first = registry.nextId();
+    check(first == 1 && registry.nextId() == 2, "ids allocated in sequence");
+
+    // Sessions are never started here: the table only stores references
+    const int perThread = 500;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&registry, perThread]() {
+            for (int i = 0; i < perThread; i++) {
+                int id = registry.nextId();
+                registry.insert(id, std::make_shared<PtySession>(id));
+                if (i % 2 == 0) registry.remove(id);
+            }
+        });
+    }
+    for (std::thread& t : threads) t.join();
+
+    std::vector<int> ids = registry.ids();
+    check(ids.size() == 4 * perThread / 2, "concurrent inserts and removes all applied");
+    check(std::is_sorted(ids.begin(), ids.end()), "ids listed in ascending order");
+    check(registry.find(ids[0]) != nullptr && registry.find(ids[0])->id() == ids[0], "find returns the session");
+
+    PtySessionRef removed = registry.remove(ids[0]);
+    check(removed != nullptr && registry.find(ids[0]) == nullptr, "remove hands back the reference");
+    check(registry.remove(ids[0]) == nullptr, "second remove finds nothing");
+
+    check(registry.removeAll().size() == ids.size() - 1 && registry.ids().empty(), "removeAll empties every shard");
+    printf("\n");
+}
+
+static void test_pool() {
+    printf("\n--- test_pool (pre-warmed shells) ---\n");
+
+    std::atomic<int> nextId(200);
+    PtyPool pool([&nextId] { return nextId++; });
+
+    check(pool.acquire("/bin/zsh", "/tmp") == nullptr, "disabled pool never hits");
+
+    pool.configure(1, 60000);
+    check(pool.acquire("/bin/zsh", "/tmp") == nullptr, "first acquire misses");
+    for (int i = 0; i < 300 && pool.stats().idle < 1; i++) usleep(10000);
+    check(pool.stats().idle == 1, "missed key replenished in the background");
+
+    PtySessionRef session = pool.acquire("/bin/zsh", "/tmp");
+    check(session != nullptr && session->isRunning(), "second acquire hits a running shell");
+    if (session != nullptr) {
+        usleep(200000);
+        while (!session->read(4096, 100).empty()) {}
+        const char* cmd = "echo pool_$((6*7)) $PWD\n";
+        session->write(cmd, strlen(cmd));
+        std::string all;
+        for (int i = 0; i < 10 && all.find("pool_42") == std::string::npos; i++) {
+            all += stripAnsi(session->read(4096, 200));
+        }
+        check(all.find("pool_42 /tmp") != std::string::npos, "pooled shell usable and in its cwd");
+        session->close();
+    }
+
+    PtyPool::Stats stats = pool.stats();
+    check(stats.hits == 1 && stats.misses == 1, "hit and miss counted");
+
+    // An idle key goes away together with its shells
+    pool.configure(1, 300);
+    for (int i = 0; i < 300 && pool.stats().keys > 0; i++) usleep(10000);
+    stats = pool.stats();
+    check(stats.keys == 0 && stats.idle == 0 && stats.evicted >= 1, "idle key evicted");
+
+    // A shell that cannot start is retried with a growing delay, then given up
+    pool.configure(1, 60000);
+    uint64_t failuresBefore = pool.stats().failures;
+    pool.acquire("/nonexistent/pty-shell", "");
+    usleep(600000);
+    stats = pool.stats();
+    check(stats.failures - failuresBefore >= 1 && stats.failures - failuresBefore <= 3,
+          "failing key retried with backoff");
+    for (int i = 0; i < 800 && pool.stats().failedKeys < 1; i++) usleep(10000);
+    stats = pool.stats();
+    check(stats.failedKeys == 1 && stats.failures - failuresBefore == PtyPool::kMaxFailures && stats.idle == 0,
+          "failing key given up");
+    usleep(600000);
+    check(pool.stats().failures == stats.failures, "no retries once given up");
+    pool.prewarm("/nonexistent/pty-shell", "");
+    check(pool.stats().failedKeys == 0, "prewarm tries a given up key again");
+
+    pool.stop();
+    printf("\n");
+}
+
+static void test_reaper() {
+    printf("\n--- test_reaper (asynchronous close) ---\n");
+
+    // A child that ignores SIGHUP and SIGTERM must go through the whole ladder
+    pid_t pid = fork();
+    if (pid == 0) {
+        signal(SIGHUP, SIG_IGN);
+        signal(SIGTERM, SIG_IGN);
+        for (;;) pause();
+    }
+    usleep(50000);
+
+    PtyReaper reaper;
+    std::atomic<int> exitCode(0);
+    std::atomic<bool> reaped(false);
+    struct timeval t0, t1;
+    gettimeofday(&t0, nullptr);
+    reaper.reap(pid, [&exitCode, &reaped](pid_t, int code) {
+        exitCode = code;
+        reaped = true;
+    });
+    gettimeofday(&t1, nullptr);
+    long us = (t1.tv_sec - t0.tv_sec) * 1000000L + (t1.tv_usec - t0.tv_usec);
+    check(us < 20000, "reap() returns immediately");
+    check(reaper.pending() == 1, "child pending");
+
+    for (int i = 0; i < 100 && !reaped; i++) usleep(10000);
+    check(reaped && exitCode == -SIGKILL, "stubborn child killed and reaped");
+    check(reaper.pending() == 0, "nothing left pending");
+    check(kill(pid, 0) != 0, "no zombie left behind");
+
+    // PtySession::close() hands its child to the shared reaper
+    PtySession pty(15);
+    pty.start("/bin/zsh", 80, 24);
+    usleep(100000);
+    gettimeofday(&t0, nullptr);
+    pty.close();
+    gettimeofday(&t1, nullptr);
+    us = (t1.tv_sec - t0.tv_sec) * 1000000L + (t1.tv_usec - t0.tv_usec);
+    check(us < 20000, "close() does not wait for the child");
+    for (int i = 0; i < 100 && PtyReaper::shared().pending() > 0; i++) usleep(10000);
+    check(pty.exitCode() == -SIGHUP, "exit status reported after close");
+    printf("\n");
+}
+
+static std::u16string toUTF16(const std::string& in) {
+    std::vector<uint16_t> out(in.size() + 1);
+    size_t n = utf8_to_utf16((const uint8_t*)in.data(), in.size(), out.data());
+    return std::u16string(out.begin(), out.begin() + n);
+}
+
+static void test_utf8_text() {
+    printf("\n--- test_utf8_text (PTY Read text) ---\n");
+
+    check(utf8_complete_length("abc", 3) == 3, "ASCII is complete");
+    check(utf8_complete_length("a\xC3", 2) == 1, "lone 2-byte lead is held back");
+    check(utf8_complete_length("a\xE2\x82", 3) == 1, "partial 3-byte sequence is held back");
+    check(utf8_complete_length("a\xF0\x9F\x98", 4) == 1, "partial 4-byte sequence is held back");
+    check(utf8_complete_length("a\xF0\x9F\x98\x80", 5) == 5, "whole 4-byte sequence is complete");
+    check(utf8_complete_length("a\xFF", 2) == 2, "invalid byte is not held back");
+
+    check(toUTF16("hello, world") == u"hello, world", "ASCII widened");
+    check(toUTF16("\xC3\xA9\xE2\x82\xAC") == u"\u00E9\u20AC", "2 and 3-byte sequences decoded");
+    check(toUTF16("\xF0\x9F\x98\x80") == u"\U0001F600", "4-byte sequence becomes a surrogate pair");
+    check(toUTF16("a\xFF" "b\xC0\x80" "c\xED\xA0\x80") == u"a\uFFFDb\uFFFD\uFFFDc\uFFFD\uFFFD\uFFFD",
+          "invalid, overlong and surrogate sequences replaced");
+
+    // Read a byte at a time: every chunk must end on a whole code point
+    PtySession pty(13);
+    pty.start("/bin/zsh", 80, 24);
+    pty.read(4096, 1000); // drain prompt
+
+    const char* cmd = "printf 'A\\303\\251B\\342\\202\\254C\\360\\237\\230\\200D\\n'\n";
+    pty.write(cmd, strlen(cmd));
+    usleep(200000);
+
+    std::string all;
+    bool whole = true;
+    for (int i = 0; i < 400 && all.find("D\r\n") == std::string::npos; i++) {
+        std::string chunk = pty.readText(1, 200);
+        if (utf8_complete_length(chunk.data(), chunk.size()) != chunk.size()) whole = false;
+        all += chunk;
+    }
+    check(whole, "readText never splits a code point");
+    check(all.find("A\xC3\xA9" "B\xE2\x82\xAC" "C\xF0\x9F\x98\x80" "D") != std::string::npos,
+          "multibyte output reassembled");
+
+    pty.close();
+
+    // A code point trickling in byte by byte, never completed: one timeout in all
+    PtySession partial(14);
+    std::vector<std::string> argv = { "sh", "-c", "printf '\\360'; sleep 0.2; printf '\\237'; sleep 0.2; printf '\\230'; sleep 3" };
+    auto t0 = std::chrono::steady_clock::now();
+    partial.startProcess("/bin/sh", argv, nullptr, 80, 24);
+    std::string text = partial.readText(4096, 300);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+    check(text.empty(), "incomplete code point held back");
+    check(ms < 550, "readText waits no longer than timeoutMs for the rest of a code point");
+    partial.close();
+
+    printf("\n");
+}
+
+// Records parser callbacks as text. Consecutive print() and dcsPut() runs are merged,
+// since where a run is cut depends on how the input was chunked.
+class VtRecorder : public PtyVtParser::Handler {
+public:
+    std::string log;
+    char last = 0;
+
+    void event(char kind, const std::string& text) {
+        if (kind == last && (kind == 'P' || kind == 'd')) {
+            log.pop_back();     // reopen the bracket
+            log += text + "]";
+        } else {
+            log += std::string(1, kind) + "[" + text + "]";
+        }
+        last = kind;
+    }
+    static std::string sequence(const PtyVtParser& p, char final) {
+        std::string s(p.intermediates(), (size_t)p.intermediateCount());
+        for (int i = 0; i < p.paramCount(); i++) {
+            if (i > 0) s += p.isSubparam(i) ? ":" : ";";
+            s += p.param(i, -1) < 0 ? "_" : std::to_string(p.param(i));
+        }
+        return s + final;
+    }
+
+    void print(const char* text, size_t len) override { event('P', std::string(text, len)); }
+    void execute(unsigned char c) override { event('X', std::to_string(c)); }
+    void csiDispatch(const PtyVtParser& p, char final) override { event('C', sequence(p, final)); }
+    void escDispatch(const PtyVtParser& p, char final) override { event('E', sequence(p, final)); }
+    void oscDispatch(const char* data, size_t len) override { event('O', std::string(data, len)); }
+    void dcsHook(const PtyVtParser& p, char final) override { event('H', sequence(p, final)); }
+    void dcsPut(const char* data, size_t len) override { event('d', std::string(data, len)); }
+    void dcsUnhook() override { event('U', ""); }
+};
+
+static std::string vtParse(const std::string& input, size_t chunk = 0) {
+    VtRecorder recorder;
+    PtyVtParser parser(&recorder);
+    if (chunk == 0) chunk = input.size();
+    for (size_t i = 0; i < input.size(); i += chunk) {
+        parser.feed(input.data() + i, std::min(chunk, input.size() - i));
+    }
+    return recorder.log;
+}
+
+static void test_vt_parser() {
+    printf("\n--- test_vt_parser ---\n");
+
+    check(vtParse("hello\r\n") == "P[hello]X[13]X[10]", "text and C0 controls");
+    check(vtParse("\x1b[1;31mred\x1b[0m") == "C[1;31m]P[red]C[0m]", "SGR parameters");
+    check(vtParse("\x1b[m\x1b[;5H") == "C[m]C[_;5H]", "missing and empty parameters");
+    check(vtParse("\x1b[?25l\x1b[>0c") == "C[?25l]C[>0c]", "private markers");
+    check(vtParse("\x1b[38:2::10:20:30m") == "C[38:2:_:10:20:30m]", "colon sub-parameters");
+    check(vtParse("\x1b[2 q") == "C[ 2q]", "CSI intermediates");
+    check(vtParse("\x1b[99999A") == "C[65535A]", "parameter values are capped");
+    check(vtParse("\x1b(B\x1b" "7\x1b#8") == "E[(B]E[7]E[#8]", "ESC sequences");
+    check(vtParse("\x1b]0;title\x07x") == "O[0;title]P[x]", "OSC ended by BEL");
+    check(vtParse("\x1b]8;;http://a\x1b\\") == "O[8;;http://a]E[\\]", "OSC ended by ST");
+    check(vtParse("\x1bP1$r0m\x1b\\") == "H[$1r]d[0m]U[]E[\\]", "DCS hook, payload, unhook");
+    check(vtParse("\x1b_apc\x1b\\x") == "E[\\]P[x]", "APC string ignored");
+    check(vtParse("\x1b[12\x18x") == "X[24]P[x]", "CAN aborts a sequence");
+    check(vtParse("\x1b[1\nA") == "X[10]C[1A]", "C0 executed inside a CSI");
+    check(vtParse("\x1b[1<2mx") == "P[x]", "malformed CSI ignored up to its final byte");
+    check(vtParse("\x1b[1 !\"mx") == "P[x]", "too many intermediates ignored");
+    check(vtParse("a\x7f" "b\x1b[\x7fm") == "P[ab]C[m]", "DEL ignored");
+
+    std::string params;
+    for (int i = 0; i < 20; i++) params += std::to_string(i) + ";";
+    std::string out = vtParse("\x1b[" + params + "m");
+    check(out.find("C[0;1;2;") == 0 && std::count(out.begin(), out.end(), ';') == PtyVtParser::kMaxParams - 1,
+          "parameters beyond the limit dropped");
+
+    std::string longOsc = "\x1b]2;" + std::string(10000, 'x') + "\x07";
+    check(vtParse(longOsc).size() == 3 + PtyVtParser::kMaxOscLength, "long OSC truncated");
+
+    // Code points are never split, whatever the chunk size
+    std::string utf8 = "A\xC3\xA9" "B\xE2\x82\xAC" "C\xF0\x9F\x98\x80" "D";
+    bool whole = true;
+    for (size_t chunk = 1; chunk <= 4; chunk++) {
+        struct Check : PtyVtParser::Handler {
+            bool whole = true;
+            void print(const char* text, size_t len) override {
+                if (utf8_complete_length(text, len) != len || (text[0] & 0xC0) == 0x80) whole = false;
+            }
+        } handler;
+        PtyVtParser checker(&handler);
+        for (size_t i = 0; i < utf8.size(); i += chunk) {
+            checker.feed(utf8.data() + i, std::min(chunk, utf8.size() - i));
+        }
+        whole = whole && handler.whole;
+    }
+    check(whole, "print() receives whole code points");
+    check(vtParse("\xC3" "\x1b[m", 1) == "P[\xC3]C[m]", "truncated code point flushed by ESC");
+
+    // Chunking does not change the result
+    std::string session =
+        "\x1b[?2004h\x1b]0;user@host: ~\x07\x1b[01;32muser@host\x1b[00m:\x1b[01;34m~\x1b[00m$ ls\r\n"
+        "\x1b[0m\x1b[01;34mdir\x1b[0m  f\xC3\xA9" "e.txt\r\n\x1bP+q544e\x1b\\\x1b(B\x1b[38:5:208mx\x08y\x1b[K";
+    std::string whole_log = vtParse(session);
+    bool same = true;
+    for (size_t chunk = 1; chunk <= 7; chunk++) {
+        if (vtParse(session, chunk) != whole_log) same = false;
+    }
+    check(same, "same callbacks for any chunk size");
+    check(whole_log.find("O[0;user@host: ~]") != std::string::npos && whole_log.find("P[  f\xC3\xA9" "e.txt]X[13]") != std::string::npos,
+          "prompt title and UTF-8 file name recognised");
+
+    // reset() drops a partial sequence
+    VtRecorder recorder;
+    PtyVtParser parser(&recorder);
+    parser.feed("\x1b[31", 4);
+    check(parser.state() == PtyVtParser::kCsiParam, "partial CSI pending");
+    parser.reset();
+    parser.feed("m", 1);
+    check(recorder.log == "P[m]", "reset() returns to ground");
+
+    printf("\n");
+}
+
+static void test_ansi_stripper() {
+    printf("\n--- test_ansi_stripper (stripAnsi session option) ---\n");
+
+    // Same result as stripAnsi() above on typical output
+    const char* samples[] = {
+        "\x1b[?2004h\x1b]0;user@host: ~\x07\x1b[01;32muser@host\x1b[00m:~$ ls\r\n",
+        "\x1b[0m\x1b[01;34mdir\x1b[0m  f\xC3\xA9" "e.txt\r\n\ttab\r\n",
+        "\x1b(B\x1b)0\x1b=\x1b>plain\x1b]8;;http://x\x1b\\link\x1b]8;;\x1b\\\r\n",
+        "abc\x08\x08X\x07\x1b[Kdone\n",
+    };
+    bool same = true;
+    for (const char* sample : samples) {
+        PtyAnsiStripper stripper;
+        if (stripper.strip(sample) != stripAnsi(sample)) same = false;
+    }
+    check(same, "same output as stripAnsi()");
+
+    PtyAnsiStripper stripper;
+    check(stripper.strip("caf\xC3\xA9\x08" "e\n") == "cafe\n", "backspace erases a whole code point");
+    std::string dcs = stripper.strip("\x1bP1$r0m\x1b\\ok");
+    dcs += stripper.flush();
+    check(dcs == "ok", "DCS payload dropped");
+
+    // A backspace at the start of a chunk erases the end of the previous one
+    std::string erased = stripper.strip("ab");
+    erased += stripper.strip("\bc");
+    erased += stripper.strip("\ncaf\xC3\xA9");
+    erased += stripper.strip("\b \be\n");
+    check(erased == "ac\ncafe\n", "backspace reaches into the previous chunk");
+    std::string shown = stripper.strip("$ ");
+    check(shown == "$", "last character of an unfinished line held back");
+    shown += stripper.flush();
+    check(shown == "$ " && stripper.flush().empty(), "held character returned by flush()");
+
+    // State carried across chunks, whatever the cut
+    std::string input = std::string(samples[0]) + samples[1] + samples[2];
+    std::string expected = stripAnsi(input);
+    bool chunked = true;
+    for (size_t chunk = 1; chunk <= 9; chunk++) {
+        PtyAnsiStripper s;
+        std::string out;
+        for (size_t i = 0; i < input.size(); i += chunk) {
+            out += s.strip(input.substr(i, chunk));
+        }
+        if (out != expected) chunked = false;
+    }
+    check(chunked, "sequences and code points split across chunks");
+
+    // Through a session: readText() returns the clean text
+    PtySession pty(90);
+    pty.setStripAnsi(true);
+    std::vector<std::string> argv = { "sh", "-c",
+        "printf '\\033]0;title\\007'; sleep 0.2; printf '\\033[1;31mred\\033[0m\\r\\nx\\010y\\033['; sleep 0.2; printf '2Jend\\r\\n'" };
+    pty.startProcess("/bin/sh", argv, nullptr, 80, 24);
+
+    std::string all;
+    for (int i = 0; i < 100 && all.find("end\n") == std::string::npos; i++) {
+        all += pty.readText(4096, 200);
+    }
+    check(all == "red\nyend\n", "readText() returns plain text");
+    pty.close();
+
+    // An echoed character erased by the next read, as a line editor does
+    PtySession edit(91);
+    edit.setStripAnsi(true);
+    std::vector<std::string> editArgv = { "sh", "-c", "printf 'ab'; sleep 0.3; printf '\\010 \\010c\\r\\n$ '; sleep 0.3" };
+    edit.startProcess("/bin/sh", editArgv, nullptr, 80, 24);
+    all.clear();
+    for (int i = 0; i < 100 && all.find("$ ") == std::string::npos; i++) {
+        all += edit.readText(4096, 100);
+        if (!edit.checkRunning() && all.find("$ ") == std::string::npos) all += edit.readText(4096, 0);
+    }
+    check(all == "ac\n$ ", "backspace erases a character returned by an earlier read");
+    edit.close();
+
+    printf("\n");
+}
+
+static std::string screenRows(const PtyScreen& screen) {
+    std::string all;
+    for (int y = 0; y < screen.rows(); y++) {
+        all += screen.rowText(y) + "|";
+    }
+    return all;
+}
+
+static void test_screen() {
+    printf("\n--- test_screen (headless screen model) ---\n");
+
+    {
+        PtyScreen screen(10, 4);
+        const char* out = "hello\r\nworld";
+        screen.feed(out, strlen(out));
+        check(screenRows(screen) == "hello|world|||", "text and newlines");
+        check(screen.cursorX() == 5 && screen.cursorY() == 1, "cursor after the text");
+
+        out = "\x1b[4;3HX\x1b[1;4H\x1b[K\x1b[2;2H\x1b[1P";
+        screen.feed(out, strlen(out));
+        check(screenRows(screen) == "hel|wrld||  X|", "CUP, EL and DCH");
+
+        out = "\x1b[2J\x1b[H0123456789ab";
+        screen.feed(out, strlen(out));
+        check(screenRows(screen) == "0123456789|ab|||", "autowrap at the last column");
+
+        out = "\x1b[2J\x1b[H0123456789\r\nx";
+        screen.feed(out, strlen(out));
+        check(screenRows(screen) == "0123456789|x|||", "no blank line after a full line (pending wrap)");
+
+        out = "\x1b[2J\x1b[Ha\r\nb\r\nc\r\nd\r\ne";
+        screen.feed(out, strlen(out));
+        check(screenRows(screen) == "b|c|d|e|", "scrolls at the bottom");
+
+        out = "\x1b[2;3r\x1b[3;1H\nf\x1b[r";
+        screen.feed(out, strlen(out));
+        check(screenRows(screen) == "b|d|f|e|", "scroll region");
+
+        out = "\x1b[H\x1b[2L";
+        screen.feed(out, strlen(out));
+        check(screenRows(screen) == "||b|d|", "insert lines");
+        out = "\x1b[M";
+        screen.feed(out, strlen(out));
+        check(screenRows(screen) == "|b|d||", "delete lines");
+    }
+
+    {
+        PtyScreen screen(10, 3);
+        const char* out = "main\x1b[?1049h\x1b[2;1Halt";
+        screen.feed(out, strlen(out));
+        check(screen.alternateScreen() && screenRows(screen) == "|alt||", "alternate screen");
+        out = "\x1b[?1049l";
+        screen.feed(out, strlen(out));
+        check(!screen.alternateScreen() && screenRows(screen) == "main|||", "main screen restored");
+        check(screen.cursorX() == 4 && screen.cursorY() == 0, "cursor restored");
+
+        out = "\x1b[?25l";
+        screen.feed(out, strlen(out));
+        check(!screen.cursorVisible(), "cursor hidden");
+    }
+
+    {
+        PtyScreen screen(10, 2);
+        const char* out = "\x1b[1;31mR\x1b[38;5;200;4mG\x1b[0;48;2;255;0;0mB\x1b[38:2::0:0:255mL\x1b[0m ";
+        screen.feed(out, strlen(out));
+        const PtyScreen::Cell* r = screen.row(0);
+        check(PtyScreen::foreground(r[0].attrs) == 1 && (r[0].attrs & PtyScreen::kAttrBold), "bold red");
+        check(PtyScreen::foreground(r[1].attrs) == 200 && (r[1].attrs & PtyScreen::kAttrUnderline), "256-color foreground");
+        check(PtyScreen::background(r[2].attrs) == 196 && !(r[2].attrs & PtyScreen::kAttrBold), "24-bit background mapped to the palette");
+        check(PtyScreen::foreground(r[3].attrs) == 21, "colon form of a 24-bit color");
+        check(r[4].attrs == PtyScreen::kDefaultAttrs, "SGR 0 resets");
+    }
+
+    {
+        PtyScreen screen(10, 2);
+        const char* out = "a\xE4\xB8\xAD" "b\x1b(0lqk\x1b(B";
+        screen.feed(out, strlen(out));
+        check(screen.rowText(0) == "a\xE4\xB8\xAD" "b\xE2\x94\x8C\xE2\x94\x80\xE2\x94\x90", "wide character and line drawing");
+        check(screen.cursorX() == 7, "wide character takes two columns");
+        out = "\r\x1b[2Cx";
+        screen.feed(out, strlen(out));
+        check(screen.rowText(0) == "a xb\xE2\x94\x8C\xE2\x94\x80\xE2\x94\x90", "overwriting half a wide character blanks it");
+    }
+
+    {
+        // Byte-at-a-time feeding gives the same screen
+        std::string out = "\x1b[?1049h\x1b[H\x1b[2J\x1b[1;1H\x1b[7m top - 10:00 \x1b[0m\r\n"
+                          "\x1b[38;5;33mPID\x1b[m  caf\xC3\xA9 \xE4\xB8\xAD\x1b[3;5H\x1b[K\x1b]0;title\x07ok\x1b[2;3r\n\n\n";
+        PtyScreen whole(20, 5), split(20, 5);
+        whole.feed(out.data(), out.size());
+        for (char c : out) split.feed(&c, 1);
+        bool same = whole.cursorX() == split.cursorX() && whole.cursorY() == split.cursorY();
+        for (int y = 0; y < 5; y++) {
+            if (memcmp(whole.row(y), split.row(y), 20 * sizeof(PtyScreen::Cell)) != 0) same = false;
+        }
+        check(same, "chunking does not change the screen");
+
+        whole.resize(10, 3);
+        check(whole.cols() == 10 && whole.rows() == 3 && whole.cursorY() < 3, "resize keeps the cursor on screen");
+    }
+
+    {
+        // Change tracking: only the rows written since a generation are reported
+        auto changed = [](const PtyScreen& screen, uint64_t since) {
+            std::string rows;
+            for (int y = 0; y < screen.rows(); y++) {
+                if (screen.rowChanged(y, since)) rows += std::to_string(y);
+            }
+            return rows;
+        };
+        PtyScreen screen(10, 5);
+        check(changed(screen, 0) == "01234", "every row changed since generation 0");
+
+        uint64_t g = screen.generation();
+        check(changed(screen, g) == "", "nothing changed since the current generation");
+
+        const char* out = "\x1b[2;1Hab\x1b[4;3H\x1b[K";
+        screen.feed(out, strlen(out));
+        check(screen.generation() > g && changed(screen, g) == "13", "printed and erased rows changed");
+
+        g = screen.generation();
+        out = "\x1b[3;1H\x1b[5;1H";
+        screen.feed(out, strlen(out));
+        check(changed(screen, g) == "", "cursor moves change no row");
+
+        g = screen.generation();
+        out = "\x1b[2;4r\x1b[4;1H\n";
+        screen.feed(out, strlen(out));
+        check(changed(screen, g) == "123", "scrolling changes the scroll region");
+
+        g = screen.generation();
+        out = "\x1b[?1049h";
+        screen.feed(out, strlen(out));
+        check(changed(screen, g) == "01234", "switching screens changes every row");
+
+        g = screen.generation();
+        screen.resize(12, 5);
+        check(changed(screen, g) == "01234", "resize changes every row");
+    }
+
+    // A session keeps its screen up to date as output is read
+    PtySession pty(91);
+    pty.setScreen(true);
+    std::vector<std::string> argv = { "sh", "-c", "printf 'top\\033[3;5Hmid\\033[1;1H\\033[2K\\033[?25l'" };
+    pty.startProcess("/bin/sh", argv, nullptr, 20, 4);
+    readUntilExit(pty);
+
+    std::string rows;
+    bool visible = true;
+    bool kept = pty.withScreen([&](const PtyScreen& screen) {
+        rows = screenRows(screen);
+        visible = screen.cursorVisible();
+    });
+    check(kept, "withScreen() with setScreen(true)");
+    check(rows == "||    mid||", "session screen reflects the output");
+    check(!visible, "session screen cursor hidden");
+    check(pty.resize(30, 6) && pty.withScreen([](const PtyScreen& screen) {
+        check(screen.cols() == 30 && screen.rows() == 6, "screen follows resize()");
+    }), "resize with a screen");
+    pty.close();
+
+    // Two readers at once, in small chunks: the screen still gets the lines whole and in order
+    PtySession shared(95);
+    shared.setScreen(true);
+    std::vector<std::string> awkArgv = { "awk", "BEGIN { for (i = 0; i < 20; i++) printf \"\\033[32mline %d\\033[0m\\n\", i }" };
+    shared.startProcess("awk", awkArgv, nullptr, 80, 24);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 2; t++) {
+        readers.emplace_back([&shared] {
+            char buf[7];
+            for (int i = 0; i < 300; i++) {
+                if (shared.read(buf, sizeof(buf), 50) == 0 && !shared.checkRunning()) break;
+            }
+        });
+    }
+    for (std::thread& t : readers) t.join();
+
+    std::string screenText;
+    shared.withScreen([&](const PtyScreen& screen) { screenText = screenRows(screen); });
+    check(screenText.compare(0, 14, "line 0|line 1|") == 0 && screenText.find("line 19|") != std::string::npos,
+          "concurrent readers feed the screen in order");
+    shared.close();
+
+    PtySession plain(92);
+    plain.start("/bin/sh", 80, 24);
+    check(!plain.withScreen([](const PtyScreen&) {}), "no screen by default");
+    plain.close();
+
+    printf("\n");
+}
+
+// ---- scrollback ---------------------------------------------------------------
+
+static void test_scrollback() {
+    printf("\n--- test_scrollback (compressed output lines) ---\n");
+
+    {
+        // LZ4 blocks: round trip, and malformed blocks rejected
+        std::string text;
+        for (int i = 0; i < 5000; i++) {
+            text += "[ " + std::to_string(i % 100) + "%] Building CXX object src/module" + std::to_string(i % 37) + ".cpp.o\n";
+        }
+        std::string noise;
+        uint32_t seed = 5;
+        for (int i = 0; i < 70000; i++) {
+            seed = seed * 1103515245u + 12345u;
+            noise += (char)(seed >> 16);
+        }
+        bool roundTrips = true;
+        for (const std::string& in : { std::string(), std::string("abc"), std::string(100, '='), text, noise }) {
+            std::vector<char> packed(lz4_compress_bound(in.size()));
+            size_t n = lz4_compress(in.data(), in.size(), packed.data());
+            std::string out(in.size(), '\0');
+            if (!lz4_decompress(packed.data(), n, &out[0], out.size()) || out != in) roundTrips = false;
+            if (in == text) check(n < in.size() / 4, "build log compresses at least 4:1");
+        }
+        check(roundTrips, "lz4_compress / lz4_decompress round trip");
+
+        std::vector<char> packed(lz4_compress_bound(text.size()));
+        size_t n = lz4_compress(text.data(), text.size(), packed.data());
+        std::string out(text.size(), '\0');
+        check(!lz4_decompress(packed.data(), n / 2, &out[0], out.size()), "truncated block rejected");
+        check(!lz4_decompress(packed.data(), n, &out[0], out.size() - 1), "wrong output size rejected");
+    }
+
+    {
+        // Lines across hot and compressed pages, fed in uneven chunks
+        PtyScrollback scrollback(64 * 1024 * 1024);
+        std::string out;
+        for (int i = 0; i < 100000; i++) {
+            out += "line " + std::to_string(i) + (i % 3 ? " ok" : " \xC3\xA9t\xC3\xA9") + "\n";
+        }
+        out += "partial";
+        for (size_t i = 0, chunk = 1; i < out.size(); i += chunk, chunk = chunk * 7 % 5000 + 1) {
+            scrollback.append(out.data() + i, std::min(chunk, out.size() - i));
+        }
+        check(scrollback.firstLine() == 0 && scrollback.lineCount() == 100000, "every ended line counted");
+
+        std::string line;
+        bool same = true;
+        for (int i : { 0, 1, 2, 50000, 31, 99999, 7, 99998 }) {
+            if (!scrollback.line(i, line) || line != "line " + std::to_string(i) + (i % 3 ? " ok" : " \xC3\xA9t\xC3\xA9")) same = false;
+        }
+        check(same, "random access by line number");
+        check(!scrollback.line(100000, line), "the partial line is not readable yet");
+        scrollback.append("\n", 1);
+        check(scrollback.line(100000, line) && line == "partial", "readable once ended");
+        check(scrollback.memoryUsage() < out.size() / 2, "older pages are compressed");
+
+        std::string longLine(PtyScrollback::kMaxLineLength + 10, 'x');
+        scrollback.append(longLine.data(), longLine.size());
+        scrollback.append("\n", 1);
+        check(scrollback.lineCount() == 100003 && scrollback.line(100002, line) && line == "xxxxxxxxxx",
+              "lines longer than kMaxLineLength are split");
+    }
+
+    {
+        // The oldest pages are dropped to stay within the budget
+        PtyScrollback scrollback(512 * 1024);
+        std::string out;
+        uint32_t seed = 9;
+        for (int i = 0; i < 200000; i++) {
+            seed = seed * 1103515245u + 12345u;
+            char hash[16];
+            snprintf(hash, sizeof(hash), "%08x", seed);
+            out += std::to_string(i) + " " + hash + "\n";
+        }
+        scrollback.append(out.data(), out.size());
+
+        std::string line;
+        check(scrollback.firstLine() > 0 && scrollback.lineCount() == 200000, "old lines dropped, numbers kept");
+        check(scrollback.memoryUsage() <= scrollback.budget(), "memory within the budget");
+        check(!scrollback.line(scrollback.firstLine() - 1, line), "dropped line not readable");
+        check(scrollback.line(scrollback.firstLine(), line) && line.compare(0, line.find(' '), std::to_string(scrollback.firstLine())) == 0,
+              "first kept line readable");
+    }
+
+    // A session keeps the lines of its output, without escape sequences
+    PtySession pty(93);
+    pty.setScrollback(1024 * 1024);
+    std::vector<std::string> argv = { "awk", "BEGIN { for (i = 0; i < 20; i++) printf \"\\033[32mline %d\\033[0m\\n\", i }" };
+    pty.startProcess("awk", argv, nullptr, 80, 24);
+    readUntilExit(pty);
+
+    uint64_t count = 0;
+    std::string first, last;
+    bool kept = pty.withScrollback([&](PtyScrollback& scrollback) {
+        count = scrollback.lineCount();
+        scrollback.line(0, first);
+        scrollback.line(count - 1, last);
+    });
+    check(kept, "withScrollback() with setScrollback()");
+    check(count == 20 && first == "line 0" && last == "line 19", "session scrollback holds the output lines");
+    pty.close();
+
+    // Two readers at once, in small chunks: the lines still arrive whole and in order
+    PtySession shared(96);
+    shared.setScrollback(1024 * 1024);
+    shared.startProcess("awk", argv, nullptr, 80, 24);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 2; t++) {
+        readers.emplace_back([&shared] {
+            char buf[7];
+            for (int i = 0; i < 300; i++) {
+                if (shared.read(buf, sizeof(buf), 50) == 0 && !shared.checkRunning()) break;
+            }
+        });
+    }
+    for (std::thread& t : readers) t.join();
+
+    bool ordered = true;
+    shared.withScrollback([&](PtyScrollback& scrollback) {
+        std::string line;
+        for (uint64_t n = 0; n < 20; n++) {
+            if (!scrollback.line(n, line) || line != "line " + std::to_string(n)) ordered = false;
+        }
+    });
+    check(ordered, "concurrent readers feed the scrollback in order");
+    shared.close();
+
+    PtySession plain(94);
+    plain.start("/bin/sh", 80, 24);
+    check(!plain.withScrollback([](PtyScrollback&) {}), "no scrollback by default");
+    plain.close();
+
+    printf("\n");
+}
+
 // ---- main -------------------------------------------------------------------
 
-int main() {
+int main(int argc, char** argv) {
+    // This binary is also the zygote helper of its sessions
+    if (argc > 1 && strcmp(argv[1], PtyZygote::kHelperArgument) == 0) {
+        return PtyZygote::helperMain();
+    }
+    char self[PATH_MAX];
+    if (realpath(argv[0], self) != nullptr) {
+        PtyZygote::shared().setHelperPath(self);
+    }
+
     printf("=== PtySession standalone tests ===\n");
 
     test_start_and_status();
@@ -358,6 +1927,32 @@ int main() {
     test_resize();
     test_close_kills_child();
     test_bad_shell_path();
+    test_spawn_methods();
+    test_zygote();
+    test_start_process();
+    test_pipe_session();
+    test_raw_mode();
+    test_coalescing();
+    test_gather_read();
+    test_read_into_buffer();
+    test_high_fd_numbers();
+    test_poller_concurrent_wait();
+    test_child_fds();
+    test_ring_buffer();
+    test_reader_thread();
+    test_event_loop();
+    test_base64_equivalence();
+    test_utf8_text();
+    test_vt_parser();
+    test_ansi_stripper();
+    test_screen();
+    test_scrollback();
+    test_close_during_read();
+    test_session_registry();
+    test_reaper();
+    test_pool();
+
+    PtyZygote::shared().stop();
 
     printf("===================================\n");
     if (g_fail == 0)
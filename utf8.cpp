@@ -0,0 +1,147 @@
+#include "utf8.h"
+
+#include <cstring>
+
+// Total sequence length announced by a lead byte, 0 for a continuation or invalid byte.
+static inline int sequence_length(uint8_t c) {
+    if (c < 0x80) return 1;
+    if (c < 0xC2) return 0;     // continuation byte, or overlong 2-byte lead
+    if (c < 0xE0) return 2;
+    if (c < 0xF0) return 3;
+    if (c < 0xF5) return 4;
+    return 0;
+}
+
+size_t utf8_complete_length(const char *data, size_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+
+    // Walk back over at most 3 continuation bytes to the last lead byte
+    size_t back = 0;
+    while (back < 3 && back < len && (p[len - 1 - back] & 0xC0) == 0x80) {
+        back++;
+    }
+    if (back == len) {
+        return len;     // only continuation bytes: nothing to complete, let them decode as U+FFFD
+    }
+
+    size_t lead = len - 1 - back;
+    int need = sequence_length(p[lead]);
+    if (need > (int)(back + 1)) {
+        return lead;
+    }
+    return len;
+}
+
+size_t utf8_to_utf16(const uint8_t *in, size_t len, uint16_t *out) {
+    uint16_t *o = out;
+    size_t i = 0;
+
+    while (i < len) {
+        // Terminal output is mostly ASCII: widen 8 bytes at a time while the high bits are clear
+        while (i + 8 <= len) {
+            uint64_t block;
+            memcpy(&block, in + i, 8);
+            if (block & 0x8080808080808080ULL) break;
+            for (int k = 0; k < 8; k++) o[k] = in[i + k];
+            o += 8;
+            i += 8;
+        }
+        if (i >= len) break;
+
+        uint8_t c = in[i];
+        if (c < 0x80) {
+            *o++ = c;
+            i++;
+            continue;
+        }
+
+        int need = sequence_length(c);
+        if (need == 0 || i + need > len) {
+            *o++ = 0xFFFD;
+            i++;
+            continue;
+        }
+
+        uint32_t cp;
+        bool valid = true;
+        if (need == 2) {
+            valid = (in[i + 1] & 0xC0) == 0x80;
+            cp = ((c & 0x1F) << 6) | (in[i + 1] & 0x3F);
+        } else if (need == 3) {
+            valid = (in[i + 1] & 0xC0) == 0x80 && (in[i + 2] & 0xC0) == 0x80;
+            cp = ((c & 0x0F) << 12) | ((in[i + 1] & 0x3F) << 6) | (in[i + 2] & 0x3F);
+            valid = valid && cp >= 0x800 && (cp < 0xD800 || cp > 0xDFFF);
+        } else {
+            valid = (in[i + 1] & 0xC0) == 0x80 && (in[i + 2] & 0xC0) == 0x80 && (in[i + 3] & 0xC0) == 0x80;
+            cp = ((c & 0x07) << 18) | ((in[i + 1] & 0x3F) << 12) | ((in[i + 2] & 0x3F) << 6) | (in[i + 3] & 0x3F);
+            valid = valid && cp >= 0x10000 && cp <= 0x10FFFF;
+        }
+
+        if (!valid) {
+            *o++ = 0xFFFD;
+            i++;
+            continue;
+        }
+
+        if (cp >= 0x10000) {
+            cp -= 0x10000;
+            *o++ = (uint16_t)(0xD800 | (cp >> 10));
+            *o++ = (uint16_t)(0xDC00 | (cp & 0x3FF));
+        } else {
+            *o++ = (uint16_t)cp;
+        }
+        i += need;
+    }
+
+    return (size_t)(o - out);
+}
+
+uint32_t utf8_decode(const uint8_t *in, size_t len, size_t *consumed) {
+    uint8_t c = in[0];
+    *consumed = 1;
+    if (c < 0x80) return c;
+
+    int need = sequence_length(c);
+    if (need == 0 || (size_t)need > len) return 0xFFFD;
+
+    for (int k = 1; k < need; k++) {
+        if ((in[k] & 0xC0) != 0x80) return 0xFFFD;
+    }
+
+    uint32_t cp;
+    if (need == 2) {
+        cp = ((c & 0x1F) << 6) | (in[1] & 0x3F);
+    } else if (need == 3) {
+        cp = ((c & 0x0F) << 12) | ((in[1] & 0x3F) << 6) | (in[2] & 0x3F);
+        if (cp < 0x800 || (cp >= 0xD800 && cp <= 0xDFFF)) return 0xFFFD;
+    } else {
+        cp = ((c & 0x07) << 18) | ((in[1] & 0x3F) << 12) | ((in[2] & 0x3F) << 6) | (in[3] & 0x3F);
+        if (cp < 0x10000 || cp > 0x10FFFF) return 0xFFFD;
+    }
+
+    *consumed = (size_t)need;
+    return cp;
+}
+
+size_t utf8_encode(uint32_t cp, char *out) {
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char)(0xC0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
@@ -0,0 +1,23 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Length of the longest prefix of data that does not end inside a multibyte sequence.
+// The remaining 0-3 bytes are the start of a code point whose tail has not arrived yet.
+size_t utf8_complete_length(const char *data, size_t len);
+
+// Transcodes len bytes of UTF-8 into UTF-16 code units. out must hold len units
+// (no sequence produces more units than it has bytes). Invalid or truncated
+// sequences become U+FFFD. Returns the number of units written; no NUL is added.
+size_t utf8_to_utf16(const uint8_t *in, size_t len, uint16_t *out);
+
+// Decodes the code point at the start of in (len > 0) and stores the number of bytes it
+// took in *consumed. Invalid or truncated sequences give U+FFFD and consume one byte.
+uint32_t utf8_decode(const uint8_t *in, size_t len, size_t *consumed);
+
+// Writes code point cp as 1-4 bytes of UTF-8 and returns the count.
+size_t utf8_encode(uint32_t cp, char *out);
+
+#endif // UTF8_H